@@ -0,0 +1,412 @@
+// ---------------------------------------------------------------------------
+// micro-benchmarks of the compiler's hot routines
+//
+// Every routine runs on its own, for a few values of the input size that matters to it, after a
+// warm-up. Each repetition times a batch of calls sized to take about a millisecond, and the results
+// (time per call over the repetitions, hardware counters per call where perf_event_open works) are
+// written as JSON, one object per routine and value, to keep next to the commit they were taken on.
+//
+//   gcc -std=gnu11 -O2 bench/bench.c -o build/bench -lm -lpthread
+//   build/bench [--filter=NAME] [--reps=N] > bench.json
+
+#define HW6_NO_MAIN
+#include "../src/hw6.c"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+volatile int64_t sink; // results go here so no call is optimized away
+
+// ---------------------------------------------------------------------------
+// hardware counters
+
+#define N_COUNTERS 4
+
+const char* counter_names[N_COUNTERS] = {"cycles", "instructions", "branch_misses", "cache_misses"};
+
+typedef struct Counters {
+  int fd[N_COUNTERS]; // -1 where the counter is not available
+  bool any;
+} Counters;
+
+void open_counters(Counters* c) {
+  c->any = false;
+  for (int i = 0; i < N_COUNTERS; ++i)
+    c->fd[i] = -1;
+#ifdef __linux__
+  const uint64_t configs[N_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    c->fd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    c->any = c->any || (c->fd[i] >= 0);
+  }
+#endif
+}
+
+void close_counters(Counters* c) {
+#ifdef __linux__
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    if (c->fd[i] >= 0)
+      close(c->fd[i]);
+  }
+#endif
+}
+
+void start_counters(Counters* c) {
+#ifdef __linux__
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    if (c->fd[i] >= 0) {
+      ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#else
+  (void) c;
+#endif
+}
+
+// adding what was counted since start_counters to totals
+void stop_counters(Counters* c, double* totals) {
+#ifdef __linux__
+  for (int i = 0; i < N_COUNTERS; ++i) {
+    uint64_t value = 0;
+    if (c->fd[i] >= 0) {
+      ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(c->fd[i], &value, sizeof(value)) == (ssize_t) sizeof(value))
+        totals[i] += (double) value;
+    }
+  }
+#else
+  (void) c;
+  (void) totals;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// routines
+
+typedef struct Bench {
+  const char* name;
+  const char* param;       // what the values are
+  const long values[4];    // 0 terminated
+  void (*setup)(long value, void** data);
+  void (*run)(void* data, long n); // n calls
+  void (*teardown)(void* data);
+} Bench;
+
+// get_reg: looking up every variable of a table with table_size of them
+typedef struct Reg_Data {
+  char reg_table[8][MAX_TOKEN_SIZE];
+  char names[8][MAX_TOKEN_SIZE];
+  int size;
+} Reg_Data;
+
+void setup_get_reg(long value, void** data) {
+  Reg_Data* d = (Reg_Data*) calloc(1, sizeof(Reg_Data));
+  d->size = (int) value;
+  for (int i = 0; i < 8; ++i) {
+    snprintf(d->names[i], MAX_TOKEN_SIZE, "var%c", (char) ('0' + i));
+    strcpy(d->reg_table[i], (i < d->size) ? d->names[i] : "(empty)");
+  }
+  *data = d;
+}
+
+void run_get_reg(void* data, long n) {
+  Reg_Data* d = (Reg_Data*) data;
+  for (long i = 0; i < n; ++i) {
+    const char* name = d->names[i % d->size];
+    uint8_t reg;
+    get_reg(d->reg_table, name, (int) strlen(name), &reg);
+    sink += reg;
+  }
+}
+
+// next_token: lexing a whole statement whose constants have the given number of digits
+typedef struct Lex_Data {
+  char line[MAX_STRING_SIZE];
+  int len;
+} Lex_Data;
+
+void setup_lexer(long value, void** data) {
+  Lex_Data* d = (Lex_Data*) calloc(1, sizeof(Lex_Data));
+  char digits[16];
+  for (int i = 0; i < value; ++i)
+    digits[i] = (char) ('1' + i % 9);
+  digits[value] = '\0';
+  d->len = snprintf(d->line, MAX_STRING_SIZE, "a = b * %s + c - %s / d %% -%s;", digits, digits, digits);
+  *data = d;
+}
+
+void run_lexer(void* data, long n) {
+  Lex_Data* d = (Lex_Data*) data;
+  for (long i = 0; i < n; ++i) {
+    Lexer lex;
+    init_lexer(&lex, d->line, d->len);
+    Token tok;
+    do {
+      tok = next_token(&lex);
+      sink += tok.value;
+    } while (tok.kind != TOK_END);
+  }
+}
+
+// make_tree: 64 statements with chains of the given length
+#define TREE_LINES 64
+
+typedef struct Tree_Data {
+  char* src;
+  Line* lines;
+  int n_lines;
+} Tree_Data;
+
+void setup_make_tree(long value, void** data) {
+  Tree_Data* d = (Tree_Data*) calloc(1, sizeof(Tree_Data));
+  size_t cap = TREE_LINES * (value + 1) * 16;
+  d->src = (char*) malloc(cap);
+  size_t len = 0;
+  for (int i = 0; i < TREE_LINES; ++i) {
+    len += snprintf(d->src + len, cap - len, "%c = b", 'a' + i % 8);
+    for (int j = 0; j < value; ++j)
+      len += (j % 2 == 0) ? snprintf(d->src + len, cap - len, " %c %d", "+-*/%"[j % 5], 1000 + j) : snprintf(d->src + len, cap - len, " %c c", "+-*/%"[j % 5]);
+    len += snprintf(d->src + len, cap - len, ";\n");
+  }
+  Input in = {d->src, len, false};
+  d->lines = split_statements(&in, &(d->n_lines));
+  *data = d;
+}
+
+void run_make_tree(void* data, long n) {
+  Tree_Data* d = (Tree_Data*) data;
+  for (long i = 0; i < n; ++i) {
+    char reg_table[][MAX_TOKEN_SIZE] = {"(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)"};
+    Equation** eqs = NULL;
+    make_tree(d->src, d->lines, d->n_lines, reg_table, &eqs);
+    sink += eqs[d->n_lines - 1]->n_ops;
+    for (int j = 0; j < d->n_lines; ++j)
+      free_eq(eqs[j]);
+    counted_free(eqs);
+  }
+}
+
+void teardown_make_tree(void* data) {
+  Tree_Data* d = (Tree_Data*) data;
+  counted_free(d->lines);
+  free(d->src);
+}
+
+// MIPS_mul_prep and power_of_2: a constant of the given magnitude
+void setup_constant(long value, void** data) {
+  long* d = (long*) malloc(sizeof(long));
+  *d = value;
+  *data = d;
+}
+
+void run_mul_prep(void* data, long n) {
+  const int v = (int) *(long*) data;
+  for (long i = 0; i < n; ++i) {
+    bool shifts[32] = {false};
+    sink += MIPS_mul_prep(v - (int) (i & 1), shifts);
+  }
+}
+
+void run_power_of_2(void* data, long n) {
+  const int v = (int) *(long*) data;
+  for (long i = 0; i < n; ++i) {
+    int bit = 0;
+    sink += power_of_2(v - (int) (i & 1), &bit) + bit;
+  }
+}
+
+// MIPS_emit: emitting the given number of instructions into empty code, growing it as it goes
+// (setup_constant)
+void run_emit(void* data, long n) {
+  const int count = (int) *(long*) data;
+  for (long i = 0; i < n; ++i) {
+    MIPS_Code code;
+    init_MIPS_code(&code);
+    for (int j = 0; j < count; ++j)
+      MIPS_emit(&code, OP_ADD, 8 + (j & 7), 16, 17, 0, 0);
+    sink += code.n;
+    free_MIPS_code(&code);
+  }
+}
+
+// MIPS_add, MIPS_sub, MIPS_mul, MIPS_div, MIPS_mod: one operation with a constant of the given
+// magnitude (0 for a register operand), with a fresh constant pool every time
+typedef struct Emit_Data {
+  Equation* eq;
+  MIPS_Code code;
+  int32_t operand;
+} Emit_Data;
+
+void setup_emitter(const char op, long value, void** data) {
+  Emit_Data* d = (Emit_Data*) calloc(1, sizeof(Emit_Data));
+  d->eq = alloc_eq(0, 0);
+  d->eq->rd = REG_S(0);
+  d->eq->rs = REG_S(1);
+  d->operand = (int32_t) value;
+  push_op(d->eq, op, (value != 0) ? OPERAND_CONST : OPERAND_REG, (value != 0) ? d->operand : REG_S(2));
+  init_MIPS_code(&(d->code));
+  d->code.tune = find_tune(default_tunes[ARCH_MIPS1]);
+  *data = d;
+}
+
+void setup_add(long value, void** data) { setup_emitter('+', value, data); }
+void setup_sub(long value, void** data) { setup_emitter('-', value, data); }
+void setup_mul(long value, void** data) { setup_emitter('*', value, data); }
+void setup_div(long value, void** data) { setup_emitter('/', value, data); }
+void setup_mod(long value, void** data) { setup_emitter('%', value, data); }
+
+void run_emitter(void* data, long n) {
+  Emit_Data* d = (Emit_Data*) data;
+  for (long i = 0; i < n; ++i) {
+    int curr_t = -1;
+    int curr_L = -1;
+    Const_Pool pool;
+    init_const_pool(&pool);
+    d->code.n = 0; // keeping the storage
+    exs_to_MIPS(d->eq, 0, &(d->code), &curr_t, &curr_L, &pool);
+    sink += d->code.n;
+  }
+}
+
+void teardown_emitter(void* data) {
+  Emit_Data* d = (Emit_Data*) data;
+  free_eq(d->eq);
+  free_MIPS_code(&(d->code));
+}
+
+const Bench benches[] = {
+  {"get_reg", "table_size", {1, 4, 8, 0}, setup_get_reg, run_get_reg, NULL},
+  {"next_token", "digits", {1, 5, 10, 0}, setup_lexer, run_lexer, NULL},
+  {"make_tree", "chain_length", {1, 8, 64, 0}, setup_make_tree, run_make_tree, teardown_make_tree},
+  {"MIPS_mul_prep", "constant", {10, 1000, 1000000, 2147483647}, setup_constant, run_mul_prep, NULL},
+  {"power_of_2", "constant", {10, 1024, 1000000, 1073741824}, setup_constant, run_power_of_2, NULL},
+  {"MIPS_emit", "instructions", {16, 256, 4096, 65536}, setup_constant, run_emit, NULL},
+  {"MIPS_add", "constant", {0, 1000, 100000, 0}, setup_add, run_emitter, teardown_emitter},
+  {"MIPS_sub", "constant", {0, 1000, 100000, 0}, setup_sub, run_emitter, teardown_emitter},
+  {"MIPS_mul", "constant", {0, 10, 1000, 1000003}, setup_mul, run_emitter, teardown_emitter},
+  {"MIPS_div", "constant", {0, 1024, 1000, 1000003}, setup_div, run_emitter, teardown_emitter},
+  {"MIPS_mod", "constant", {0, 1000, 1000003, 0}, setup_mod, run_emitter, teardown_emitter},
+};
+
+#define N_BENCHES ((int) (sizeof(benches) / sizeof(benches[0])))
+
+// ---------------------------------------------------------------------------
+// measuring
+
+#define WARMUP_SECONDS 0.02
+#define SAMPLE_SECONDS 0.001
+
+int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+double time_calls(const Bench* bench, void* data, const long n) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bench->run(data, n);
+  return seconds_since(&start);
+}
+
+// one routine at one value, as a JSON object
+void measure(const Bench* bench, const long value, const int reps, Counters* counters, const bool first) {
+  void* data = NULL;
+  bench->setup(value, &data);
+
+  // warm-up, finding how many calls take SAMPLE_SECONDS on the way
+  long n = 1;
+  double warm = 0;
+  while (warm < WARMUP_SECONDS) {
+    double t = time_calls(bench, data, n);
+    warm += t;
+    if (t < SAMPLE_SECONDS)
+      n *= 2;
+  }
+
+  double* ns = (double*) malloc(reps * sizeof(double));
+  double totals[N_COUNTERS] = {0};
+  for (int r = 0; r < reps; ++r) {
+    start_counters(counters);
+    ns[r] = time_calls(bench, data, n) * 1e9 / n;
+    stop_counters(counters, totals);
+  }
+
+  double mean = 0;
+  for (int r = 0; r < reps; ++r)
+    mean += ns[r] / reps;
+  double var = 0;
+  for (int r = 0; r < reps; ++r)
+    var += (ns[r] - mean) * (ns[r] - mean) / ((reps > 1) ? reps - 1 : 1);
+  qsort(ns, reps, sizeof(double), compare_doubles);
+
+  printf("%s    {\"name\": \"%s\", \"%s\": %ld, \"calls_per_rep\": %ld, \"reps\": %d,\n", first ? "" : ",\n", bench->name, bench->param, value, n, reps);
+  printf("     \"ns_per_call\": {\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, \"max\": %.3f}",
+         ns[0], ns[reps / 2], mean, sqrt(var), ns[reps - 1]);
+  if (counters->any) {
+    printf(",\n     \"per_call\": {");
+    bool sep = false;
+    for (int i = 0; i < N_COUNTERS; ++i) {
+      if (counters->fd[i] < 0)
+        continue;
+      printf("%s\"%s\": %.3f", sep ? ", " : "", counter_names[i], totals[i] / ((double) n * reps));
+      sep = true;
+    }
+    printf("}");
+  }
+  printf("}");
+
+  free(ns);
+  if (bench->teardown != NULL)
+    bench->teardown(data);
+  free(data);
+}
+
+int main(int argc, char* argv[]) {
+  const char* filter = NULL;
+  int reps = 25;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--filter=", 9) == 0)
+      filter = argv[i] + 9;
+    else if (strncmp(argv[i], "--reps=", 7) == 0 && atoi(argv[i] + 7) > 0)
+      reps = atoi(argv[i] + 7);
+    else {
+      fprintf(stderr, "Usage: %s [--filter=NAME] [--reps=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Stats bench_stats; // the routines count their allocations
+  memset(&bench_stats, 0, sizeof(bench_stats));
+  use_stats(&bench_stats);
+  Counters counters;
+  open_counters(&counters);
+
+  printf("{\n  \"counters\": \"%s\",\n  \"results\": [\n", counters.any ? "perf_event_open" : "unavailable");
+  bool first = true;
+  for (int b = 0; b < N_BENCHES; ++b) {
+    if (filter != NULL && strstr(benches[b].name, filter) == NULL)
+      continue;
+    for (int v = 0; v < 4 && (v == 0 || benches[b].values[v] != 0); ++v) {
+      measure(&benches[b], benches[b].values[v], reps, &counters, first);
+      first = false;
+      fflush(stdout);
+    }
+  }
+  printf("\n  ]\n}\n");
+  close_counters(&counters);
+  return 0;
+}
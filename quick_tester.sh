@@ -1,5 +1,30 @@
 #!/bin/bash
 
+# building the current sources, every check below runs them
+gcc -std=gnu11 -O2 src/hw6.c -o build/hw6 -lm -lpthread || exit 1
+
+failed=0
+
+# expect NAME EXPECTED COMMAND...: the output of COMMAND has to be the file EXPECTED, and COMMAND has
+# to succeed
+expect() {
+	local name=$1 expected=$2
+	shift 2
+	printf "\nTesting %s...\n\n" "$name"
+	local out
+	out=$(mktemp)
+	if ! "$@" > "$out" 2>/dev/null; then
+		echo "FAILED: \"$*\" exited with an error"
+		failed=1
+	elif ! diff "$expected" "$out"; then
+		echo "FAILED: output differs from $expected"
+		failed=1
+	else
+		echo "ok"
+	fi
+	rm -f "$out"
+}
+
 printf "\nTesting \"example1.src\"...\n\n"
 valgrind --leak-check=full ./build/hw6 tests/example1.src
 
@@ -40,4 +65,72 @@ printf "\nTesting \"example12.src\"...\n\n"
 valgrind --leak-check=full ./build/hw6 tests/example12.src
 
 printf "\nTesting \"example13.src\"...\n\n"
-valgrind --leak-check=full ./build/hw6 tests/example13.src
\ No newline at end of file
+valgrind --leak-check=full ./build/hw6 tests/example13.src
+
+expect "\"balance_overflow.src\" at -O2" tests/balance_overflow.expected \
+	./build/hw6 -O2 tests/balance_overflow.src --eval-batch tests/balance_overflow.csv
+
+expect "\"range_div_zero.src\" at -O2" tests/range_div_zero.expected ./build/hw6 -O2 tests/range_div_zero.src
+expect "\"range_div_zero.src\" at -Os" tests/range_div_zero.expected ./build/hw6 -Os tests/range_div_zero.src
+
+# compiling tests/incremental.src, then the edited copy with the state of the first run
+incremental_edit() {
+	local state
+	state=$(mktemp)
+	./build/hw6 --incremental="$state" tests/incremental.src > /dev/null &&
+		./build/hw6 --incremental="$state" tests/incremental_edited.src
+	local status=$?
+	rm -f "$state"
+	return $status
+}
+expect "\"incremental_edited.src\" after \"incremental.src\" (--incremental)" tests/incremental_edited.expected incremental_edit
+expect "\"noreorder_hilo.src\" (--noreorder)" tests/noreorder_hilo.expected ./build/hw6 --noreorder tests/noreorder_hilo.src
+expect "\"noreorder_hilo.src\" (--sched --noreorder)" tests/noreorder_hilo.sched.expected ./build/hw6 --sched --noreorder tests/noreorder_hilo.src
+
+expect "\"empty_statements.src\"" tests/empty_statements.expected ./build/hw6 tests/empty_statements.src
+
+expect "\"mul_const.src\"" tests/mul_const.expected ./build/hw6 tests/mul_const.src
+expect "\"mul_const.src\" (--march=mips32)" tests/mul_const.mips32.expected ./build/hw6 --march=mips32 tests/mul_const.src
+
+expect "\"pipeline.src\" (--pipeline)" tests/pipeline.expected ./build/hw6 --pipeline tests/pipeline.src
+expect "\"pipeline.src\" (--pipeline -O2, compiled at once)" tests/pipeline.O2.expected ./build/hw6 --pipeline -O2 tests/pipeline.src
+
+# the machine code of tests/encode_hilo.src, checked against the assembler's output for the same
+# assembly, and the object file around it (same .text, checked with llvm-readelf)
+encode_hex() (
+	set -o pipefail
+	./build/hw6 --emit="$1" "$2" | od -An -tx1
+)
+expect "\"encode_hilo.src\" (--emit=bin)" tests/encode_hilo.expected encode_hex bin tests/encode_hilo.src
+expect "\"encode_hilo.src\" (--emit=elf)" tests/encode_hilo.elf.expected encode_hex elf tests/encode_hilo.src
+
+expect "\"value_profile.src\" (--value-profile)" tests/value_profile.expected \
+	./build/hw6 --value-profile tests/value_profile.prof tests/value_profile.src
+
+# -Osuper with a database: a second run reads it, a run with its replacements corrupted has to search
+# again and write the correct ones back, all at a path too long for a fixed size buffer
+superopt_db() (
+	dir=$(mktemp -d)
+	db="$dir/$(printf 'd%.0s' {1..150}).superopt"
+	first=$(./build/hw6 -Osuper --superopt-db="$db" "$1") && cp "$db" "$dir/good" &&
+		[ "$(./build/hw6 -Osuper --superopt-db="$db" "$1")" = "$first" ] &&
+		awk 'NR > 1 { $NF = $NF + 1 } { print }' "$dir/good" > "$db" &&
+		[ "$(./build/hw6 -Osuper --superopt-db="$db" "$1")" = "$first" ] && cmp -s "$db" "$dir/good" &&
+		echo "$first"
+	status=$?
+	rm -rf "$dir"
+	exit $status
+)
+expect "\"mul_const.src\" (-Osuper --superopt-db)" tests/mul_const.super.expected superopt_db tests/mul_const.src
+
+# the library API (hw6.h), tests/library.c built against the current sources
+library_test() (
+	bin=$(mktemp)
+	gcc -std=gnu11 -O2 tests/library.c -o "$bin" -lm -lpthread && "$bin"
+	status=$?
+	rm -f "$bin"
+	exit $status
+)
+expect "library API (tests/library.c)" tests/library.expected library_test
+
+exit $failed
@@ -0,0 +1,291 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// branch delay slots (--noreorder)
+//
+// With .set noreorder the instruction after a branch always runs, whichever way the branch goes.
+// Every slot gets, in order of preference:
+//   - an instruction from before the branch that the branch does not depend on,
+//   - for bltz and bne, the first instruction of the target if the label has no other way in and the
+//     register it writes is dead on the fall-through path (the target then starts one later),
+//   - for j, a copy of the first instruction of the target, jumping past it to a new label,
+//   - a nop.
+// mult/div and mfhi/mflo are never moved, and neither is an instruction whose leaving would bring an
+// mfhi/mflo closer than the core allows to the mult/div after it (see hilo_spacing). mips1 code with
+// the slots filled here gets a last pass that puts nops into any spacing still too short (space_hilo),
+// as the assembler would have in reorder mode.
+
+#define DELAY_LOOKBACK 8 // instructions searched before a branch
+#define DELAY_LOOKAHEAD 64 // instructions searched for a read on the fall-through path
+#define MIPS1_HILO_SPACING 2 // instructions the mips1 ISA wants between mfhi/mflo and mult/div
+
+bool is_branch(const int op) {
+  return op == OP_BLTZ || op == OP_BNE || op == OP_J;
+}
+
+// instructions that may go into a delay slot
+bool slot_candidate(const MIPS_Instr* instr) {
+  switch (instr->op) {
+    case OP_ADD: case OP_ADDI: case OP_ADDIU: case OP_ADDU: case OP_SUB: case OP_SUBU: case OP_MOVE: case OP_LI: case OP_LUI: case OP_ORI: case OP_ANDI:
+    case OP_SLL: case OP_SRL: case OP_SRA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// a and b can trade places
+bool independent(const MIPS_Instr* a, const MIPS_Instr* b) {
+  MIPS_Access acc_a, acc_b;
+  MIPS_access(a, &acc_a);
+  MIPS_access(b, &acc_b);
+  for (int i = 0; i < acc_a.n_defs; ++i) {
+    if (acc_has(acc_b.uses, acc_b.n_uses, acc_a.defs[i]) || acc_has(acc_b.defs, acc_b.n_defs, acc_a.defs[i]))
+      return false;
+  }
+  for (int i = 0; i < acc_b.n_defs; ++i) {
+    if (acc_has(acc_a.uses, acc_a.n_uses, acc_b.defs[i]))
+      return false;
+  }
+  return true;
+}
+
+// instructions needed between mfhi/mflo and the next mult/div in code
+int hilo_spacing(const MIPS_Code* code) {
+  int spacing = (code->tune != NULL) ? code->tune->hilo_hazard : 0;
+  if (code->march == ARCH_MIPS1 && spacing < MIPS1_HILO_SPACING)
+    spacing = MIPS1_HILO_SPACING;
+  return spacing;
+}
+
+// taking instruction k out of code keeps every mfhi/mflo at least spacing instructions from the
+// mult/div after it
+bool keeps_hilo_spacing(const MIPS_Code* code, const int k, const int spacing) {
+  int between = -1; // instructions between the last mfhi/mflo before k and k
+  for (int j = k - 1, n = 0; j >= 0 && n < spacing && between < 0; --j) {
+    int op = code->instrs[j].op;
+    if (op == OP_COMMENT || op == OP_LABEL)
+      continue;
+    if (is_hilo_read(op))
+      between = n;
+    n++;
+  }
+  if (between < 0)
+    return true;
+  for (int j = k + 1, n = between; j < code->n && n < spacing; ++j) {
+    int op = code->instrs[j].op;
+    if (op == OP_COMMENT || op == OP_LABEL)
+      continue;
+    if (is_hilo_write(op))
+      return false;
+    n++;
+  }
+  return true;
+}
+
+// index in out of an instruction of the current block that can move behind the branch, -1 if none
+int slot_from_before(MIPS_Code* out, const int block_start, const MIPS_Instr* branch) {
+  int n_seen = 0;
+  for (int k = out->n - 1; k >= block_start && n_seen < DELAY_LOOKBACK; --k) {
+    MIPS_Instr* cand = &(out->instrs[k]);
+    if (cand->op == OP_COMMENT)
+      continue;
+    n_seen++;
+    if (!slot_candidate(cand) || !independent(cand, branch) || !keeps_hilo_spacing(out, k, hilo_spacing(out)))
+      continue;
+    bool movable = true;
+    for (int j = k + 1; j < out->n && movable; ++j)
+      movable = (out->instrs[j].op == OP_COMMENT) || independent(cand, &(out->instrs[j]));
+    if (movable)
+      return k;
+  }
+  return -1;
+}
+
+// reg is written before it is read on every path starting at instruction i, looking at no more
+// than *budget instructions
+bool dead_from(MIPS_Code* code, const int* label_pos, int i, const int reg, int* budget) {
+  for (; *budget > 0; ++i) {
+    if (i >= code->n)
+      return t_num(reg) >= 0; // s registers are the result of the program
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (instr->op == OP_COMMENT || instr->op == OP_LABEL)
+      continue;
+    if (instr->op == OP_BLTZ || instr->op == OP_BNE) { // both ways
+      if (instr->rs == reg || (instr->op == OP_BNE && instr->rt == reg) || !dead_from(code, label_pos, label_pos[instr->label], reg, budget))
+        return false;
+      continue;
+    }
+    if (instr->op == OP_J) {
+      i = label_pos[instr->label];
+      continue;
+    }
+    (*budget)--;
+    MIPS_Access acc;
+    MIPS_access(instr, &acc);
+    if (acc_has(acc.uses, acc.n_uses, reg))
+      return false;
+    if (acc_has(acc.defs, acc.n_defs, reg))
+      return true;
+  }
+  return false;
+}
+
+// first instruction after label L, -1 if it is not a slot candidate
+int first_after_label(MIPS_Code* code, const int* label_pos, const int label) {
+  for (int i = label_pos[label] + 1; i < code->n; ++i) {
+    if (code->instrs[i].op == OP_COMMENT)
+      continue;
+    return slot_candidate(&(code->instrs[i])) ? i : -1;
+  }
+  return -1;
+}
+
+// the instruction before position i is an unconditional jump, so nothing falls through into it
+bool no_fall_in(MIPS_Code* code, int i) {
+  for (--i; i >= 0; --i) {
+    int op = code->instrs[i].op;
+    if (op == OP_COMMENT)
+      continue;
+    return op == OP_J;
+  }
+  return false;
+}
+
+// filling the delay slot after every branch, code then holds every slot explicitly
+void fill_delay_slots(MIPS_Code* code) {
+  // labels: position and number of branches to them
+  int n_labels = 0;
+  for (int i = 0; i < code->n; ++i) {
+    if ((code->instrs[i].op == OP_LABEL || is_branch(code->instrs[i].op)) && code->instrs[i].label >= n_labels)
+      n_labels = code->instrs[i].label + 1;
+  }
+  int* label_pos = (int*) counted_malloc(MEM_CODE, (n_labels + 1) * sizeof(int));
+  int* refs = (int*) counted_calloc(MEM_CODE, n_labels + 1, sizeof(int));
+  int* skip_label = (int*) counted_malloc(MEM_CODE, (n_labels + 1) * sizeof(int)); // label placed after the first instruction, -1 if none
+  bool* moved = (bool*) counted_calloc(MEM_CODE, code->n + 1, sizeof(bool));      // taken into a delay slot
+  for (int i = 0; i < n_labels; ++i) {
+    label_pos[i] = code->n; // unused
+    skip_label[i] = -1;
+  }
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (instr->op == OP_LABEL)
+      label_pos[instr->label] = i;
+    else if (is_branch(instr->op))
+      refs[instr->label]++;
+  }
+  int* after_skip = (int*) counted_malloc(MEM_CODE, (code->n + 1) * sizeof(int)); // label to place after an instruction, -1 if none
+  for (int i = 0; i < code->n; ++i)
+    after_skip[i] = -1;
+  int next_label = n_labels;
+
+  MIPS_Code out;
+  init_MIPS_code(&out);
+  out.march = code->march;
+  out.tune = code->tune;
+  const MIPS_Instr nop = {OP_NOP, 0, 0, 0, 0, 0};
+  int block_start = 0;
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr instr = code->instrs[i];
+    if (moved[i])
+      continue;
+    if (!is_branch(instr.op)) {
+      MIPS_emit(&out, instr.op, instr.rd, instr.rs, instr.rt, instr.imm, instr.label);
+      if (instr.op == OP_LABEL)
+        block_start = out.n;
+      if (after_skip[i] >= 0) {
+        MIPS_emit(&out, OP_LABEL, 0, 0, 0, 0, after_skip[i]);
+        block_start = out.n;
+      }
+      continue;
+    }
+
+    // from before the branch
+    MIPS_Instr slot = nop;
+    int k = slot_from_before(&out, block_start, &instr);
+    if (k >= 0) {
+      slot = out.instrs[k];
+      memmove(&(out.instrs[k]), &(out.instrs[k + 1]), (out.n - k - 1) * sizeof(MIPS_Instr));
+      out.n--;
+    }
+
+    // from the target of a conditional branch
+    else if ((instr.op == OP_BLTZ || instr.op == OP_BNE) && refs[instr.label] == 1 && label_pos[instr.label] < code->n && label_pos[instr.label] > i
+             && no_fall_in(code, label_pos[instr.label])) {
+      int t = first_after_label(code, label_pos, instr.label);
+      MIPS_Access acc;
+      if (t >= 0 && !moved[t] && after_skip[t] < 0) {
+        MIPS_access(&(code->instrs[t]), &acc);
+        bool dead = true;
+        for (int d = 0; d < acc.n_defs && dead; ++d) {
+          int budget = DELAY_LOOKAHEAD;
+          dead = dead_from(code, label_pos, i + 1, acc.defs[d], &budget);
+        }
+        if (dead) {
+          slot = code->instrs[t];
+          moved[t] = true;
+        }
+      }
+    }
+
+    // copy of the target of a jump, continuing after it
+    else if (instr.op == OP_J && label_pos[instr.label] < code->n) {
+      int t = first_after_label(code, label_pos, instr.label);
+      if (t >= 0 && !moved[t]) {
+        if (skip_label[instr.label] < 0) {
+          skip_label[instr.label] = next_label++;
+          after_skip[t] = skip_label[instr.label];
+        }
+        slot = code->instrs[t];
+        instr.label = skip_label[instr.label];
+      }
+    }
+
+    MIPS_emit(&out, instr.op, instr.rd, instr.rs, instr.rt, instr.imm, instr.label);
+    MIPS_emit(&out, slot.op, slot.rd, slot.rs, slot.rt, slot.imm, slot.label);
+    block_start = out.n;
+  }
+
+  counted_free(label_pos);
+  counted_free(refs);
+  counted_free(skip_label);
+  counted_free(moved);
+  counted_free(after_skip);
+  free_MIPS_code(code);
+  *code = out;
+  code->delay_slots = true;
+}
+
+// putting nops in front of every mult/div that follows mfhi/mflo too closely on mips1, counting the
+// nop the assembler puts after a branch unless code holds its delay slots
+void space_hilo(MIPS_Code* code) {
+  MIPS_Code out;
+  init_MIPS_code(&out);
+  out.march = code->march;
+  out.tune = code->tune;
+  out.profile = code->profile;
+  out.delay_slots = code->delay_slots;
+  int since = MIPS1_HILO_SPACING; // instructions since the last mfhi/mflo
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr instr = code->instrs[i];
+    if (instr.op == OP_COMMENT || instr.op == OP_LABEL) {
+      MIPS_emit(&out, instr.op, instr.rd, instr.rs, instr.rt, instr.imm, instr.label);
+      continue;
+    }
+    if (is_hilo_write(instr.op)) {
+      for (; since < MIPS1_HILO_SPACING; ++since)
+        MIPS_emit(&out, OP_NOP, 0, 0, 0, 0, 0);
+    }
+    MIPS_emit(&out, instr.op, instr.rd, instr.rs, instr.rt, instr.imm, instr.label);
+    if (is_hilo_read(instr.op))
+      since = 0;
+    else if (since < MIPS1_HILO_SPACING)
+      since += (is_branch(instr.op) && !code->delay_slots) ? 2 : 1;
+  }
+  free_MIPS_code(code);
+  *code = out;
+}
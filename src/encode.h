@@ -0,0 +1,344 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// encoding the generated MIPS code into 32 bit machine words (big endian)
+//
+// Branches get a nop in their delay slot, just like the assembler does in its default (reorder) mode,
+// unless the code already holds its delay slots (--noreorder), and mips1 code gets the nops that keep
+// mfhi/mflo two instructions away from the next mult/div (space_hilo) like the assembler puts in. move
+// becomes addu and li is expanded to addiu, ori, lui or lui+ori. Jumps are absolute, so the raw image
+// assumes it is loaded at address 0 while the ELF object carries an R_MIPS_26 relocation for every j.
+
+typedef struct MIPS_Bin {
+  uint32_t* words;
+  int n_words;
+  int* relocs; // word indices of j instructions (R_MIPS_26)
+  int n_relocs;
+  int* label_addr; // byte address of each label id, -1 if unused
+  int n_labels;
+} MIPS_Bin;
+
+// hardware number of a register id (of its own file for vector registers), -1 if it cannot be encoded
+int reg_num(const int reg) {
+  if (reg >= REG_W(0))
+    return reg - REG_W(0);
+  return (reg < N_REGS) ? reg : -1;
+}
+
+// number of words an instruction assembles into (delay_slots: branches come with their slot)
+int MIPS_instr_size(const MIPS_Instr* instr, const bool delay_slots) {
+  switch (instr->op) {
+    case OP_COMMENT: case OP_LABEL:
+      return 0;
+    case OP_LI:
+      return imm_cost(instr->imm);
+    case OP_BLTZ: case OP_BNE: case OP_J:
+      return delay_slots ? 1 : 2; // delay slot
+    default:
+      return 1;
+  }
+}
+
+void push_word(MIPS_Bin* bin, const uint32_t word) {
+  bin->words[bin->n_words++] = word;
+}
+
+uint32_t R_type(const int rs, const int rt, const int rd, const int sh, const int funct) {
+  return ((uint32_t) rs << 21) | ((uint32_t) rt << 16) | ((uint32_t) rd << 11) | ((uint32_t) sh << 6) | (uint32_t) funct;
+}
+
+uint32_t I_type(const int op, const int rs, const int rt, const int imm) {
+  return ((uint32_t) op << 26) | ((uint32_t) rs << 21) | ((uint32_t) rt << 16) | ((uint32_t) imm & 0xffff);
+}
+
+// MSA (major opcode 0x1e): operation and data format / operand above the fields ws and wd, the
+// minor opcode below; for the word format the data format is 2 (3R, 2R, I10), 10mmmmm (BIT) or
+// 1100nn (ELM)
+uint32_t MSA_type(const int high, const int ws, const int wd, const int minor) {
+  return (0x1eu << 26) | ((uint32_t) high << 16) | ((uint32_t) ws << 11) | ((uint32_t) wd << 6) | (uint32_t) minor;
+}
+
+// encoding one instruction, false if it is not supported
+bool encode_MIPS_instr(MIPS_Bin* bin, const MIPS_Instr* instr, const bool delay_slots) {
+  int rd = reg_num(instr->rd);
+  int rs = reg_num(instr->rs);
+  int rt = reg_num(instr->rt);
+  if (rd < 0 || rs < 0 || rt < 0)
+    return false;
+
+  switch (instr->op) {
+    case OP_COMMENT: case OP_LABEL:
+      return true;
+
+    case OP_ADD:  push_word(bin, R_type(rs, rt, rd, 0, 0x20)); return true;
+    case OP_SUB:  push_word(bin, R_type(rs, rt, rd, 0, 0x22)); return true;
+    case OP_MOVE: push_word(bin, R_type(rs, 0, rd, 0, 0x21)); return true; // addu rd,rs,$zero
+    case OP_SLL:  push_word(bin, R_type(0, rs, rd, instr->imm & 0x1f, 0x00)); return true;
+    case OP_SRL:  push_word(bin, R_type(0, rs, rd, instr->imm & 0x1f, 0x02)); return true;
+    case OP_SRA:  push_word(bin, R_type(0, rs, rd, instr->imm & 0x1f, 0x03)); return true;
+    case OP_ADDU: push_word(bin, R_type(rs, rt, rd, 0, 0x21)); return true;
+    case OP_SUBU: push_word(bin, R_type(rs, rt, rd, 0, 0x23)); return true;
+    case OP_MULT: push_word(bin, R_type(rs, rt, 0, 0, 0x18)); return true;
+    case OP_DIV:  push_word(bin, R_type(rs, rt, 0, 0, 0x1a)); return true;
+    case OP_NOP:  push_word(bin, 0); return true;
+    case OP_MUL:  push_word(bin, (0x1cu << 26) | R_type(rs, rt, rd, 0, 0x02)); return true; // SPECIAL2
+    case OP_MUL_R6: push_word(bin, R_type(rs, rt, rd, 2, 0x18)); return true;
+    case OP_DIV_R6: push_word(bin, R_type(rs, rt, rd, 2, 0x1a)); return true;
+    case OP_MOD_R6: push_word(bin, R_type(rs, rt, rd, 3, 0x1a)); return true;
+    case OP_MFHI: push_word(bin, R_type(0, 0, rd, 0, 0x10)); return true;
+    case OP_MFLO: push_word(bin, R_type(0, 0, rd, 0, 0x12)); return true;
+    case OP_ADDI:
+      if (!fits_imm16(instr->imm))
+        return false;
+      push_word(bin, I_type(0x08, rs, rd, instr->imm));
+      return true;
+    case OP_ADDIU:
+      if (!fits_imm16(instr->imm))
+        return false;
+      push_word(bin, I_type(0x09, rs, rd, instr->imm));
+      return true;
+    case OP_LUI:  push_word(bin, I_type(0x0f, 0, rd, instr->imm)); return true;
+    case OP_ORI:  push_word(bin, I_type(0x0d, rs, rd, instr->imm)); return true;
+    case OP_ANDI: push_word(bin, I_type(0x0c, rs, rd, instr->imm)); return true;
+
+    // MSA, words
+    case OP_ADDV_W: push_word(bin, MSA_type((0 << 7) | (2 << 5) | rt, rs, rd, 0x0e)); return true;
+    case OP_SUBV_W: push_word(bin, MSA_type((1 << 7) | (2 << 5) | rt, rs, rd, 0x0e)); return true;
+    case OP_MULV_W: push_word(bin, MSA_type((0 << 7) | (2 << 5) | rt, rs, rd, 0x12)); return true;
+    case OP_SLLI_W: push_word(bin, MSA_type(0x40 | (instr->imm & 0x1f), rs, rd, 0x09)); return true;
+    case OP_INSERT_W: push_word(bin, MSA_type((0x4 << 6) | 0x30 | (instr->imm & 3), rs, rd, 0x19)); return true;
+    case OP_COPY_S_W: push_word(bin, MSA_type((0x2 << 6) | 0x30 | (instr->imm & 3), rs, rd, 0x19)); return true;
+    case OP_FILL_W: push_word(bin, MSA_type((0xc0 << 2) | 2, rs, rd, 0x1e)); return true;
+    case OP_LDI_W:
+      if (!fits_imm10(instr->imm))
+        return false;
+      push_word(bin, (0x1eu << 26) | (6u << 23) | (2u << 21) | (((uint32_t) instr->imm & 0x3ff) << 11) | ((uint32_t) rd << 6) | 0x07);
+      return true;
+
+    case OP_LI:
+      if (instr->imm >= -32768 && instr->imm <= 32767)
+        push_word(bin, I_type(0x09, 0, rd, instr->imm)); // addiu
+      else if (instr->imm >= 0 && instr->imm <= 65535)
+        push_word(bin, I_type(0x0d, 0, rd, instr->imm)); // ori
+      else if ((instr->imm & 0xffff) == 0)
+        push_word(bin, I_type(0x0f, 0, rd, (uint32_t) instr->imm >> 16)); // lui
+      else {
+        push_word(bin, I_type(0x0f, 0, rd, (uint32_t) instr->imm >> 16)); // lui
+        push_word(bin, I_type(0x0d, rd, rd, instr->imm & 0xffff));      // ori
+      }
+      return true;
+
+    // branches, followed by a nop for the delay slot
+    case OP_BLTZ: {
+      int offset = (bin->label_addr[instr->label] - 4 * (bin->n_words + 1)) / 4;
+      push_word(bin, I_type(0x01, rs, 0, offset));
+      if (!delay_slots)
+        push_word(bin, 0);
+      return true;
+    }
+    case OP_BNE: {
+      int offset = (bin->label_addr[instr->label] - 4 * (bin->n_words + 1)) / 4;
+      push_word(bin, I_type(0x05, rs, rt, offset));
+      if (!delay_slots)
+        push_word(bin, 0);
+      return true;
+    }
+    case OP_J:
+      bin->relocs[bin->n_relocs++] = bin->n_words;
+      push_word(bin, (0x02u << 26) | (((uint32_t) bin->label_addr[instr->label] >> 2) & 0x3ffffff));
+      if (!delay_slots)
+        push_word(bin, 0);
+      return true;
+  }
+  return false;
+}
+
+// assembling the MIPS code into bin, false (with an error printed) on failure
+bool MIPS_assemble(MIPS_Code* code, MIPS_Bin* bin) {
+  // pass 1: sizes and label addresses
+  int n_words = 0;
+  int n_relocs = 0;
+  bin->n_labels = 0;
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    n_words += MIPS_instr_size(instr, code->delay_slots);
+    if (instr->op == OP_J)
+      n_relocs++;
+    if (instr->op == OP_LABEL && instr->label >= bin->n_labels)
+      bin->n_labels = instr->label + 1;
+  }
+  bin->words = (uint32_t*) counted_malloc(MEM_CODE, n_words * sizeof(uint32_t));
+  bin->n_words = 0;
+  bin->relocs = (int*) counted_malloc(MEM_CODE, n_relocs * sizeof(int));
+  bin->n_relocs = 0;
+  bin->label_addr = (int*) counted_malloc(MEM_CODE, bin->n_labels * sizeof(int));
+  for (int i = 0; i < bin->n_labels; ++i)
+    bin->label_addr[i] = -1;
+
+  int addr = 0;
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (instr->op == OP_LABEL)
+      bin->label_addr[instr->label] = addr;
+    addr += 4 * MIPS_instr_size(instr, code->delay_slots);
+  }
+
+  // pass 2: encoding
+  char buf[MAX_STRING_SIZE];
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    bool branch = (instr->op == OP_BLTZ || instr->op == OP_BNE || instr->op == OP_J);
+    if ((branch && (instr->label >= bin->n_labels || bin->label_addr[instr->label] < 0))
+        || !encode_MIPS_instr(bin, instr, code->delay_slots)) {
+      MIPS_format(instr, NULL, buf);
+      report_error("Unable to encode \"%s\"", buf);
+      return false;
+    }
+  }
+  return true;
+}
+
+void free_MIPS_bin(MIPS_Bin* bin) {
+  counted_free(bin->words);
+  counted_free(bin->relocs);
+  counted_free(bin->label_addr);
+}
+
+// ---------------------------------------------------------------------------
+// writing
+
+void put_be16(unsigned char* p, const uint32_t v) {
+  p[0] = (v >> 8) & 0xff;
+  p[1] = v & 0xff;
+}
+
+void put_be32(unsigned char* p, const uint32_t v) {
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+// raw image of the .text words
+void write_MIPS_bin(FILE* out, MIPS_Bin* bin) {
+  unsigned char word[4];
+  for (int i = 0; i < bin->n_words; ++i) {
+    put_be32(word, bin->words[i]);
+    fwrite(word, 1, 4, out);
+  }
+}
+
+// what each ISA revision puts in e_flags (EF_MIPS_ARCH_*, mips32r5 has none of its own) and in
+// .MIPS.abiflags (ISA level and revision, ASEs)
+const uint32_t elf_arch_flags[N_ARCHS] = {0x00000000, 0x50000000, 0x70000000, 0x90000000, 0x70000000};
+const uint8_t elf_isa_level[N_ARCHS] = {1, 32, 32, 32, 32};
+const uint8_t elf_isa_rev[N_ARCHS] = {0, 1, 2, 6, 5};
+
+// minimal ELF32 (big endian) relocatable for march: .text, .rel.text, .symtab, .strtab, .MIPS.abiflags,
+// .shstrtab
+void write_MIPS_elf(FILE* out, MIPS_Bin* bin, const MIPS_Arch march) {
+  const char shstrtab[] = "\0.text\0.rel.text\0.symtab\0.strtab\0.shstrtab\0.MIPS.abiflags";
+  const int sh_name[] = {0, 1, 7, 17, 25, 33, 43};
+
+  // symbols: null, .text section, then one local per label
+  char (*names)[16] = counted_malloc(MEM_CODE, bin->n_labels * sizeof(*names));
+  int n_syms = 2;
+  int strtab_size = 1;
+  for (int i = 0; i < bin->n_labels; ++i) {
+    *(put_label(names[i], i)) = '\0';
+    if (bin->label_addr[i] >= 0) {
+      n_syms++;
+      strtab_size += strlen(names[i]) + 1;
+    }
+  }
+
+  // layout
+  int abi_off = 56;
+  int text_off = abi_off + 24;
+  int text_size = 4 * bin->n_words;
+  int rel_off = text_off + text_size;
+  int rel_size = 8 * bin->n_relocs;
+  int sym_off = rel_off + rel_size;
+  int sym_size = 16 * n_syms;
+  int str_off = sym_off + sym_size;
+  int shstr_off = str_off + strtab_size;
+  int sh_off = (shstr_off + (int) sizeof(shstrtab) + 3) & ~3;
+  int file_size = sh_off + 7 * 40;
+
+  unsigned char* buf = (unsigned char*) counted_calloc(MEM_CODE, file_size, 1);
+
+  // ELF header
+  memcpy(buf, "\x7f" "ELF", 4);
+  buf[4] = 1; // 32 bit
+  buf[5] = 2; // big endian
+  buf[6] = 1; // version
+  put_be16(buf + 16, 1);      // ET_REL
+  put_be16(buf + 18, 8);      // EM_MIPS
+  put_be32(buf + 20, 1);      // version
+  put_be32(buf + 32, sh_off);
+  put_be32(buf + 36, elf_arch_flags[march] | 0x1000 | 0x1 // EF_MIPS_ABI_O32, EF_MIPS_NOREORDER (delay slots are already filled)
+                     | ((march == ARCH_MIPS32R6) ? 0x400 : 0)); // EF_MIPS_NAN2008, as r6 requires
+  put_be16(buf + 40, 52);     // header size
+  put_be16(buf + 46, 40);     // section header size
+  put_be16(buf + 48, 7);      // number of sections
+  put_be16(buf + 50, 6);      // .shstrtab
+
+  // .MIPS.abiflags: version 0, 32 bit GPRs, no FPU code (fp_abi "any"), MSA on mips32r5
+  buf[abi_off + 2] = elf_isa_level[march];
+  buf[abi_off + 3] = elf_isa_rev[march];
+  buf[abi_off + 4] = 1;                                       // AFL_REG_32
+  put_be32(buf + abi_off + 12, has_msa(march) ? 0x200 : 0);   // AFL_ASE_MSA
+
+  // .text
+  for (int i = 0; i < bin->n_words; ++i)
+    put_be32(buf + text_off + 4 * i, bin->words[i]);
+
+  // .rel.text against the .text section symbol, addend stays in the instruction
+  for (int i = 0; i < bin->n_relocs; ++i) {
+    put_be32(buf + rel_off + 8 * i, 4 * bin->relocs[i]);
+    put_be32(buf + rel_off + 8 * i + 4, (1 << 8) | 4); // R_MIPS_26
+  }
+
+  // .symtab and .strtab
+  unsigned char* sym = buf + sym_off + 16;
+  sym[12] = 3; // STB_LOCAL, STT_SECTION
+  put_be16(sym + 14, 1);
+  int str_pos = 1;
+  sym += 16;
+  for (int i = 0; i < bin->n_labels; ++i) {
+    if (bin->label_addr[i] < 0)
+      continue;
+    put_be32(sym, str_pos);
+    put_be32(sym + 4, bin->label_addr[i]);
+    put_be16(sym + 14, 1); // STB_LOCAL, STT_NOTYPE in .text
+    strcpy((char*) buf + str_off + str_pos, names[i]);
+    str_pos += strlen(names[i]) + 1;
+    sym += 16;
+  }
+  counted_free(names);
+
+  // .shstrtab
+  memcpy(buf + shstr_off, shstrtab, sizeof(shstrtab));
+
+  // section headers: name, type, flags, addr, offset, size, link, info, align, entsize
+  const int sh[7][10] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {sh_name[1], 1, 6, 0, text_off, text_size, 0, 0, 4, 0},            // SHT_PROGBITS, alloc + exec
+    {sh_name[2], 9, 0, 0, rel_off, rel_size, 3, 1, 4, 8},              // SHT_REL for .text
+    {sh_name[3], 2, 0, 0, sym_off, sym_size, 4, n_syms, 4, 16},        // SHT_SYMTAB, all locals
+    {sh_name[4], 3, 0, 0, str_off, strtab_size, 0, 0, 1, 0},           // SHT_STRTAB
+    {sh_name[6], 0x7000002a, 2, 0, abi_off, 24, 0, 0, 8, 24},       // SHT_MIPS_ABIFLAGS, alloc
+    {sh_name[5], 3, 0, 0, shstr_off, (int) sizeof(shstrtab), 0, 0, 1, 0}
+  };
+  for (int i = 0; i < 7; ++i) {
+    for (int j = 0; j < 10; ++j)
+      put_be32(buf + sh_off + 40 * i + 4 * j, sh[i][j]);
+  }
+
+  fwrite(buf, 1, file_size, out);
+  counted_free(buf);
+}
@@ -1,109 +1,132 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define MAX_STRING_SIZE 128
 #define MAX_TOKEN_SIZE 8
 
 // ---------------------------------------------------------------------------
+// Registers are kept as small integer ids (see mips.h) and constants as their value, so nothing
+// holds a copy of the text.
+//
+// The operations of a statement form a chain applied left to right to the first operand
+// (a = b + c * 2 is ((b + c) * 2)). The chain is stored as parallel arrays in one block (operators,
+// operand kinds, operand values), so it is built and walked with plain loops, however long it is.
 
-typedef struct Expression {
-  char rs[4];
-  char op; // single char (+, -, *, /, %)
-  char rt[MAX_TOKEN_SIZE];
+#define OPERAND_REG 0   // the operand is a register id
+#define OPERAND_CONST 1 // the operand is a constant
 
-  bool con; // second operand is a constant
-  bool neg; // second constant operand is negative
+typedef struct Equation {
+  uint32_t src_offset; // original operation, as a span of the input buffer
+  uint32_t src_length;
+  int32_t im; // load immediate (no operations)
+  uint8_t rd; // register id
+  uint8_t rs; // first operand register id
+
+  int n_ops; // length of the chain, 0 for a load immediate
+  int cap;
+  int32_t* operands; // second operand of every operation: register id or value (owns the block)
+  char* ops;         // operation (+, -, *, /, %)
+  uint8_t* kinds;    // OPERAND_REG or OPERAND_CONST
+} Equation;
 
-  struct Expression* left_ex; // pointer to left expression (if applicable)
-} Expression;
+Equation* alloc_eq(const uint32_t src_offset, const uint32_t src_length) {
+  Equation* new_eq = (Equation*) counted_malloc(MEM_TREE, sizeof(Equation));
 
-Expression* alloc_ex() {
-  Expression* new_ex = (Expression*) malloc(sizeof(Expression));
-  
-  strcpy(new_ex->rs, "$sx");
-  new_ex->op = '?';
-  strcpy(new_ex->rt, "$sx");
-  new_ex->con = false;
-  new_ex->neg = false;
-  new_ex->left_ex = NULL;
-  
-  return new_ex;
-}
+  new_eq->src_offset = src_offset;
+  new_eq->src_length = src_length;
+  new_eq->im = 0;
+  new_eq->rd = 0;
+  new_eq->rs = 0;
 
-void free_ex(Expression* ex) {
-  if (ex->left_ex != NULL)
-    free_ex(ex->left_ex);
-  free(ex);
-}
+  new_eq->n_ops = 0;
+  new_eq->cap = 0;
+  new_eq->operands = NULL;
+  new_eq->ops = NULL;
+  new_eq->kinds = NULL;
 
-void print_ex(Expression* ex, char* buf) {
-  if (ex != NULL) {
-    printf("%s  rs: %s\n", buf, ex->rs);
-    printf("%s  op: %c\n", buf, ex->op);
-    printf("%s  rt: %s\n", buf, ex->rt);
-    printf("%s  con: %d\n", buf, ex->con);
-    printf("%s  neg: %d\n", buf, ex->neg);
-    printf("%s  left_ex: %p\n", buf, ex->left_ex);
-  }
+  return new_eq;
 }
 
-// ---------------------------------------------------------------------------
-
-typedef struct Equation {
-  char og[MAX_STRING_SIZE]; // original operation in string
-  char rd[4];
-  char im[MAX_TOKEN_SIZE]; // load immediate
-  Expression* ex; // operation
-} Equation;
-
-Equation* alloc_eq(char* line) {
-  Equation* new_eq = (Equation*) malloc(sizeof(Equation));
-  
-  strcpy(new_eq->og, line);
-  strcpy(new_eq->rd, "$sx");
-  strcpy(new_eq->im, "?");
-  
-  new_eq->ex = NULL;
-  
-  return new_eq;
+// reusing eq for another statement, keeping the storage of its chain
+void reuse_eq(Equation* eq, const uint32_t src_offset, const uint32_t src_length) {
+  eq->src_offset = src_offset;
+  eq->src_length = src_length;
+  eq->im = 0;
+  eq->rd = 0;
+  eq->rs = 0;
+  eq->n_ops = 0;
 }
 
 void free_eq(Equation* eq) {
-  if (eq->ex != NULL)
-    free_ex(eq->ex);
-  free(eq);
+  counted_free(eq->operands);
+  counted_free(eq);
 }
 
-void print_eq(Equation* eq) {
+// appending an operation to the chain
+void push_op(Equation* eq, const char op, const uint8_t kind, const int32_t operand) {
+  if (eq->n_ops == eq->cap) {
+    int cap = (eq->cap == 0) ? 4 : 2 * eq->cap;
+    int32_t* operands = (int32_t*) counted_malloc(MEM_TREE, cap * (sizeof(int32_t) + 2));
+    char* ops = (char*) (operands + cap);
+    uint8_t* kinds = (uint8_t*) (ops + cap);
+    if (eq->n_ops > 0) {
+      memcpy(operands, eq->operands, eq->n_ops * sizeof(int32_t));
+      memcpy(ops, eq->ops, eq->n_ops);
+      memcpy(kinds, eq->kinds, eq->n_ops);
+    }
+    counted_free(eq->operands);
+    eq->operands = operands;
+    eq->ops = ops;
+    eq->kinds = kinds;
+    eq->cap = cap;
+  }
+  eq->operands[eq->n_ops] = operand;
+  eq->ops[eq->n_ops] = op;
+  eq->kinds[eq->n_ops] = kind;
+  eq->n_ops++;
+}
+
+// src is the input buffer the equation was parsed from
+void print_eq(Equation* eq, const char* src) {
   if (eq != NULL) {
-    printf("  og: %s\n", eq->og);
-    printf("  rd: %s\n", eq->rd);
-    printf("  im: %s\n", eq->im);
-    printf("  ex: %p\n", eq->ex);
+    printf("  og: %.*s\n", (int) eq->src_length, src + eq->src_offset);
+    printf("  rd: %d\n", eq->rd);
+    printf("  im: %d\n", eq->im);
+    printf("  rs: %d\n", eq->rs);
+    printf("  n_ops: %d\n", eq->n_ops);
   }
 }
 
+void print_chain(Equation* eq) {
+  for (int i = 0; i < eq->n_ops; ++i)
+    printf("  %d: %c %s %d\n", i, eq->ops[i], (eq->kinds[i] == OPERAND_CONST) ? "const" : "reg", eq->operands[i]);
+}
+
 // ---------------------------------------------------------------------------
+// one operation of a chain as the code generator sees it
 
-void print_ex_tree(Expression* curr_ex) {
-  // go as far down first
-  if (curr_ex->left_ex != NULL)
-    print_ex_tree(curr_ex->left_ex);
+typedef struct Expression {
+  int32_t rt; // second operand: register id, or the value if con
+  int rs;     // first operand register: the variable for the first operation, the result before it otherwise
+  int rd;     // register the result went to (set by the code generator)
+  int i;      // position in the chain
+  char op;    // single char (+, -, *, /, %)
 
-  // printing expression
-  printf("  %p:\n", curr_ex);
-  print_ex(curr_ex, "  ");
-}
+  bool con; // second operand is a constant
+  bool neg; // second constant operand is negative
+  const struct Div_Profile* profile; // divisors seen at run time for a division by a register, NULL if none
+} Expression;
+
+// ---------------------------------------------------------------------------
 
-void print_tree(Equation** eqs, const int eq_size) {
+void print_tree(Equation** eqs, const int eq_size, const char* src) {
   for (int i = 0; i < eq_size; ++i) {
     Equation* curr_eq = eqs[i];
     printf("%p:\n", curr_eq);
-    print_eq(curr_eq);
-    
-    // operation instruction
-    if (curr_eq->ex != NULL)
-      print_ex_tree(curr_eq->ex);
+    print_eq(curr_eq, src);
+    print_chain(curr_eq);
   }
 }
@@ -0,0 +1,41 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+// ---------------------------------------------------------------------------
+// errors
+//
+// report_error prints like printf, as "ERROR: ..." on stdout for the command line. A library compile
+// (see hw6.h) points error_buffer at its context instead, so the message is kept for hw6_error and
+// nothing is printed. The buffer is per thread, like the statistics.
+
+#define ERROR_SIZE 256
+
+typedef struct Error_Buffer {
+  char msg[ERROR_SIZE]; // first error only, empty if none
+} Error_Buffer;
+
+_Thread_local Error_Buffer* error_buffer = NULL;
+
+void report_error(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  if (error_buffer == NULL) {
+    printf("ERROR: ");
+    vprintf(format, args);
+    printf("\n");
+  } else if (error_buffer->msg[0] == '\0')
+    vsnprintf(error_buffer->msg, ERROR_SIZE, format, args);
+  va_end(args);
+}
+
+// "WARNING: ..." on stderr for the command line, nothing for a library compile
+void report_warning(const char* format, ...) {
+  if (error_buffer != NULL)
+    return;
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "WARNING: ");
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
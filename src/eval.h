@@ -0,0 +1,593 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// batch evaluation (--eval-batch)
+//
+// Runs the compiled instructions over many sets of initial variable values at once. The register
+// file holds one row of EVAL_BLOCK lanes per register (structure of arrays), and every instruction is
+// applied to whole rows, with AVX2 or SSE2 where the host has them. mult and division have no vector
+// instruction and go lane by lane. The only branches are the forward ones around a division by a
+// power of 2 or a divisor from the value profile, so they become masks: a lane that branches waits at the label, and the lanes still
+// running skip the instructions in between. The words of an MSA vector register get a row each.
+//
+// The input is CSV with a header of variable names (variables missing from it start at 0). The
+// output is CSV with the final value of every variable and the status of each row: ok, overflow
+// (add/addi/sub trapped) or div0.
+
+// ---------------------------------------------------------------------------
+// lanes
+
+#if defined(__AVX2__)
+typedef __m256i Lanes;
+#define LANE_WIDTH 8
+
+Lanes lanes_load(const int32_t* p) { return _mm256_load_si256((const __m256i*) p); }
+void lanes_store(int32_t* p, const Lanes v) { _mm256_store_si256((__m256i*) p, v); }
+Lanes lanes_splat(const int32_t x) { return _mm256_set1_epi32(x); }
+Lanes lanes_add(const Lanes a, const Lanes b) { return _mm256_add_epi32(a, b); }
+Lanes lanes_sub(const Lanes a, const Lanes b) { return _mm256_sub_epi32(a, b); }
+Lanes lanes_mul(const Lanes a, const Lanes b) { return _mm256_mullo_epi32(a, b); }
+Lanes lanes_and(const Lanes a, const Lanes b) { return _mm256_and_si256(a, b); }
+Lanes lanes_or(const Lanes a, const Lanes b) { return _mm256_or_si256(a, b); }
+Lanes lanes_xor(const Lanes a, const Lanes b) { return _mm256_xor_si256(a, b); }
+Lanes lanes_andnot(const Lanes a, const Lanes b) { return _mm256_andnot_si256(a, b); } // ~a & b
+Lanes lanes_sll(const Lanes a, const int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_srl(const Lanes a, const int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_sra(const Lanes a, const int n) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_equal(const Lanes a, const Lanes b) { return _mm256_cmpeq_epi32(a, b); }
+bool lanes_any(const Lanes m) { return _mm256_movemask_epi8(m) != 0; }
+
+#elif defined(__SSE2__)
+typedef __m128i Lanes;
+#define LANE_WIDTH 4
+
+Lanes lanes_load(const int32_t* p) { return _mm_load_si128((const __m128i*) p); }
+void lanes_store(int32_t* p, const Lanes v) { _mm_store_si128((__m128i*) p, v); }
+Lanes lanes_splat(const int32_t x) { return _mm_set1_epi32(x); }
+Lanes lanes_add(const Lanes a, const Lanes b) { return _mm_add_epi32(a, b); }
+Lanes lanes_sub(const Lanes a, const Lanes b) { return _mm_sub_epi32(a, b); }
+Lanes lanes_and(const Lanes a, const Lanes b) { return _mm_and_si128(a, b); }
+Lanes lanes_or(const Lanes a, const Lanes b) { return _mm_or_si128(a, b); }
+Lanes lanes_xor(const Lanes a, const Lanes b) { return _mm_xor_si128(a, b); }
+Lanes lanes_andnot(const Lanes a, const Lanes b) { return _mm_andnot_si128(a, b); } // ~a & b
+Lanes lanes_sll(const Lanes a, const int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_srl(const Lanes a, const int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_sra(const Lanes a, const int n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+Lanes lanes_equal(const Lanes a, const Lanes b) { return _mm_cmpeq_epi32(a, b); }
+bool lanes_any(const Lanes m) { return _mm_movemask_epi8(m) != 0; }
+
+// low 32 bits of the products (SSE2 only multiplies the even lanes, to 64 bits)
+Lanes lanes_mul(const Lanes a, const Lanes b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#else
+typedef int32_t Lanes;
+#define LANE_WIDTH 1
+
+Lanes lanes_load(const int32_t* p) { return *p; }
+void lanes_store(int32_t* p, const Lanes v) { *p = v; }
+Lanes lanes_splat(const int32_t x) { return x; }
+Lanes lanes_add(const Lanes a, const Lanes b) { return (int32_t) ((uint32_t) a + (uint32_t) b); }
+Lanes lanes_sub(const Lanes a, const Lanes b) { return (int32_t) ((uint32_t) a - (uint32_t) b); }
+Lanes lanes_mul(const Lanes a, const Lanes b) { return (int32_t) ((uint32_t) a * (uint32_t) b); }
+Lanes lanes_and(const Lanes a, const Lanes b) { return a & b; }
+Lanes lanes_or(const Lanes a, const Lanes b) { return a | b; }
+Lanes lanes_xor(const Lanes a, const Lanes b) { return a ^ b; }
+Lanes lanes_andnot(const Lanes a, const Lanes b) { return ~a & b; }
+Lanes lanes_sll(const Lanes a, const int n) { return (int32_t) ((uint32_t) a << n); }
+Lanes lanes_srl(const Lanes a, const int n) { return (int32_t) ((uint32_t) a >> n); }
+Lanes lanes_sra(const Lanes a, const int n) { return a >> n; }
+Lanes lanes_equal(const Lanes a, const Lanes b) { return (a == b) ? -1 : 0; }
+bool lanes_any(const Lanes m) { return m != 0; }
+#endif
+
+// a where m is set, b elsewhere
+Lanes lanes_select(const Lanes m, const Lanes a, const Lanes b) {
+  return lanes_or(lanes_and(m, a), lanes_andnot(m, b));
+}
+
+// all ones where x is negative
+Lanes lanes_negative(const Lanes x) {
+  return lanes_sra(x, 31);
+}
+
+// ---------------------------------------------------------------------------
+// evaluator
+
+#define EVAL_BLOCK 256 // input sets evaluated together, a multiple of LANE_WIDTH
+
+typedef enum Eval_Status {
+  EVAL_OK,
+  EVAL_OVERFLOW, // add, addi or sub trapped
+  EVAL_DIV0,     // division by zero
+  N_EVAL_STATUS
+} Eval_Status;
+
+const char* eval_status_names[N_EVAL_STATUS] = {"ok", "overflow", "div0"};
+
+typedef struct Eval_State {
+  MIPS_Code* code;
+  int n_regs;       // register rows, the highest register id used + 1
+  int n_w_regs;     // vector registers, W_LANES rows each
+  int* label_slot;  // waiting row of every label
+  int n_slots;
+  int32_t* regs;    // n_regs rows
+  int32_t* w;       // n_w_regs * W_LANES rows
+  int32_t* hi;
+  int32_t* lo;
+  int32_t* active;  // all ones for the lanes running the current instruction
+  int32_t* waiting; // n_slots rows, the lanes waiting for a label
+  uint8_t status[EVAL_BLOCK];
+} Eval_State;
+
+// row of a register, the one of word 0 for a vector register
+int32_t* eval_row(Eval_State* st, const int reg) {
+  if (reg >= REG_W(0))
+    return st->w + (size_t) (reg - REG_W(0)) * W_LANES * EVAL_BLOCK;
+  return st->regs + (size_t) reg * EVAL_BLOCK;
+}
+
+bool eval_branch(const int op) {
+  return op == OP_BLTZ || op == OP_BNE || op == OP_J;
+}
+
+// register rows and label masks for code, false (reported) if it branches backwards
+bool init_eval(Eval_State* st, MIPS_Code* code) {
+  st->code = code;
+  st->n_regs = N_REGS;
+  st->n_w_regs = 0;
+  int n_labels = 0;
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (instr->op == OP_COMMENT)
+      continue;
+    const int fields[3] = {instr->rd, instr->rs, instr->rt};
+    for (int j = 0; j < 3; ++j) {
+      if (fields[j] >= REG_W(0) && fields[j] - REG_W(0) >= st->n_w_regs)
+        st->n_w_regs = fields[j] - REG_W(0) + 1;
+      else if (fields[j] < REG_W(0) && fields[j] >= st->n_regs)
+        st->n_regs = fields[j] + 1;
+    }
+    if ((instr->op == OP_LABEL || eval_branch(instr->op)) && instr->label >= n_labels)
+      n_labels = instr->label + 1;
+  }
+
+  // a waiting row per label, shared by labels whose branches do not overlap
+  int* label_pos = (int*) malloc((n_labels + 1) * sizeof(int));
+  int* free_slots = (int*) malloc((n_labels + 1) * sizeof(int));
+  st->label_slot = (int*) malloc((n_labels + 1) * sizeof(int));
+  for (int l = 0; l < n_labels; ++l) {
+    label_pos[l] = -1;
+    st->label_slot[l] = -1;
+  }
+  for (int i = 0; i < code->n; ++i) {
+    if (code->instrs[i].op == OP_LABEL)
+      label_pos[code->instrs[i].label] = i;
+  }
+  bool ok = true;
+  int n_free = 0;
+  st->n_slots = 0;
+  for (int i = 0; i < code->n && ok; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (eval_branch(instr->op)) {
+      if (label_pos[instr->label] <= i) {
+        report_error("--eval-batch only follows forward branches (L%d)", instr->label);
+        ok = false;
+      } else if (st->label_slot[instr->label] < 0)
+        st->label_slot[instr->label] = (n_free > 0) ? free_slots[--n_free] : st->n_slots++;
+    } else if (instr->op == OP_LABEL && st->label_slot[instr->label] >= 0)
+      free_slots[n_free++] = st->label_slot[instr->label];
+  }
+  free(label_pos);
+  free(free_slots);
+  if (!ok) {
+    free(st->label_slot);
+    return false;
+  }
+
+  size_t row = EVAL_BLOCK * sizeof(int32_t);
+  st->regs = (int32_t*) aligned_alloc(64, (st->n_regs + 3 + st->n_w_regs * W_LANES) * row);
+  st->hi = eval_row(st, st->n_regs);
+  st->lo = eval_row(st, st->n_regs + 1);
+  st->active = eval_row(st, st->n_regs + 2);
+  st->w = eval_row(st, st->n_regs + 3);
+  st->waiting = (int32_t*) aligned_alloc(64, (st->n_slots + 1) * row);
+  memset(st->waiting, 0, (st->n_slots + 1) * row);
+  return true;
+}
+
+void free_eval(Eval_State* st) {
+  free(st->label_slot);
+  free(st->regs);
+  free(st->waiting);
+}
+
+// stopping the lanes of m (a row) with status
+void eval_stop(Eval_State* st, const int k, const Lanes m, const Eval_Status status) {
+  _Alignas(32) int32_t stop[LANE_WIDTH];
+  lanes_store(stop, m);
+  for (int j = 0; j < LANE_WIDTH; ++j) {
+    if (stop[j] != 0)
+      st->status[k + j] = status;
+  }
+  lanes_store(st->active + k, lanes_andnot(m, lanes_load(st->active + k)));
+}
+
+// rd = r on the active lanes of k
+void eval_write(Eval_State* st, int32_t* rd, const int k, const Lanes r) {
+  lanes_store(rd + k, lanes_select(lanes_load(st->active + k), r, lanes_load(rd + k)));
+}
+
+// rd = rs + rt (or rs - rt), trapping on overflow if trap is set
+void eval_add(Eval_State* st, int32_t* rd, const int32_t* rs, const int32_t* rt, const bool sub, const bool trap) {
+  for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+    Lanes a = lanes_load(rs + k);
+    Lanes b = lanes_load(rt + k);
+    Lanes r = sub ? lanes_sub(a, b) : lanes_add(a, b);
+    if (trap) { // the sign of the result is wrong
+      Lanes wrong = sub ? lanes_and(lanes_xor(a, b), lanes_xor(a, r)) : lanes_and(lanes_xor(a, r), lanes_xor(b, r));
+      Lanes overflow = lanes_and(lanes_negative(wrong), lanes_load(st->active + k));
+      if (lanes_any(overflow))
+        eval_stop(st, k, overflow, EVAL_OVERFLOW);
+    }
+    eval_write(st, rd, k, r);
+  }
+}
+
+// HI/LO = rs * rt, one lane at a time
+void eval_mult(Eval_State* st, const int32_t* rs, const int32_t* rt) {
+  for (int k = 0; k < EVAL_BLOCK; ++k) {
+    if (st->active[k] == 0)
+      continue;
+    int64_t p = (int64_t) rs[k] * rt[k];
+    st->lo[k] = (int32_t) (uint32_t) p;
+    st->hi[k] = (int32_t) (uint32_t) ((uint64_t) p >> 32);
+  }
+}
+
+// quotient into q and remainder into r (either may be NULL), one lane at a time
+void eval_div(Eval_State* st, int32_t* q, int32_t* r, const int32_t* rs, const int32_t* rt) {
+  for (int k = 0; k < EVAL_BLOCK; ++k) {
+    if (st->active[k] == 0)
+      continue;
+    if (rt[k] == 0) {
+      st->status[k] = EVAL_DIV0;
+      st->active[k] = 0;
+      continue;
+    }
+    int32_t quot = (rt[k] == -1) ? (int32_t) (0u - (uint32_t) rs[k]) : rs[k] / rt[k]; // INT32_MIN / -1 wraps
+    int32_t rem = (rt[k] == -1) ? 0 : rs[k] % rt[k];
+    if (q != NULL)
+      q[k] = quot;
+    if (r != NULL)
+      r[k] = rem;
+  }
+}
+
+// whether any lane is active
+bool eval_running(Eval_State* st) {
+  Lanes m = lanes_splat(0);
+  for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+    m = lanes_or(m, lanes_load(st->active + k));
+  return lanes_any(m);
+}
+
+// executing instruction instr on the active lanes (not a branch or label)
+void eval_instr(Eval_State* st, MIPS_Instr* instr) {
+  int32_t* rd = eval_row(st, instr->rd);
+  const int32_t* rs = eval_row(st, instr->rs);
+  const int32_t* rt = eval_row(st, instr->rt);
+  if (instr->rd == REG_ZERO && instr->op != OP_MULT && instr->op != OP_DIV)
+    return; // nothing to write (only a nop is encoded like this)
+
+  switch (instr->op) {
+    case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU:
+      eval_add(st, rd, rs, rt, instr->op == OP_SUB || instr->op == OP_SUBU, instr->op == OP_ADD || instr->op == OP_SUB);
+      break;
+    case OP_ADDI: case OP_ADDIU: {
+      Lanes b = lanes_splat(instr->imm);
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+        Lanes a = lanes_load(rs + k);
+        Lanes r = lanes_add(a, b);
+        if (instr->op == OP_ADDI) {
+          Lanes overflow = lanes_and(lanes_negative(lanes_and(lanes_xor(a, r), lanes_xor(b, r))), lanes_load(st->active + k));
+          if (lanes_any(overflow))
+            eval_stop(st, k, overflow, EVAL_OVERFLOW);
+        }
+        eval_write(st, rd, k, r);
+      }
+      break;
+    }
+    case OP_MULT:
+      eval_mult(st, rs, rt);
+      break;
+    case OP_MUL: case OP_MUL_R6:
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+        eval_write(st, rd, k, lanes_mul(lanes_load(rs + k), lanes_load(rt + k)));
+      break;
+    case OP_DIV:
+      eval_div(st, st->lo, st->hi, rs, rt);
+      break;
+    case OP_DIV_R6:
+      eval_div(st, rd, NULL, rs, rt);
+      break;
+    case OP_MOD_R6:
+      eval_div(st, NULL, rd, rs, rt);
+      break;
+    case OP_MFLO: case OP_MFHI: case OP_MOVE: {
+      const int32_t* from = (instr->op == OP_MFLO) ? st->lo : (instr->op == OP_MFHI) ? st->hi : rs;
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+        eval_write(st, rd, k, lanes_load(from + k));
+      break;
+    }
+    case OP_LI: case OP_LUI: {
+      Lanes v = lanes_splat((instr->op == OP_LUI) ? (int32_t) ((uint32_t) instr->imm << 16) : instr->imm);
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+        eval_write(st, rd, k, v);
+      break;
+    }
+    case OP_ORI: case OP_ANDI: {
+      Lanes v = lanes_splat(instr->imm & 0xffff);
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+        Lanes a = lanes_load(rs + k);
+        eval_write(st, rd, k, (instr->op == OP_ORI) ? lanes_or(a, v) : lanes_and(a, v));
+      }
+      break;
+    }
+    case OP_SLL: case OP_SRL: case OP_SRA:
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+        Lanes a = lanes_load(rs + k);
+        Lanes r = (instr->op == OP_SLL) ? lanes_sll(a, instr->imm) : (instr->op == OP_SRL) ? lanes_srl(a, instr->imm) : lanes_sra(a, instr->imm);
+        eval_write(st, rd, k, r);
+      }
+      break;
+
+    // MSA, a row per word
+    case OP_INSERT_W: case OP_COPY_S_W: {
+      int32_t* to = (instr->op == OP_INSERT_W) ? rd + (size_t) instr->imm * EVAL_BLOCK : rd;
+      const int32_t* from = (instr->op == OP_COPY_S_W) ? rs + (size_t) instr->imm * EVAL_BLOCK : rs;
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+        eval_write(st, to, k, lanes_load(from + k));
+      break;
+    }
+    case OP_FILL_W: case OP_LDI_W:
+      for (int e = 0; e < W_LANES; ++e) {
+        for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH)
+          eval_write(st, rd + (size_t) e * EVAL_BLOCK, k, (instr->op == OP_FILL_W) ? lanes_load(rs + k) : lanes_splat(instr->imm));
+      }
+      break;
+    case OP_ADDV_W: case OP_SUBV_W: case OP_MULV_W: case OP_SLLI_W:
+      for (int e = 0; e < W_LANES; ++e) {
+        size_t at = (size_t) e * EVAL_BLOCK;
+        for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+          Lanes a = lanes_load(rs + at + k);
+          Lanes r;
+          if (instr->op == OP_SLLI_W)
+            r = lanes_sll(a, instr->imm);
+          else {
+            Lanes b = lanes_load(rt + at + k);
+            r = (instr->op == OP_ADDV_W) ? lanes_add(a, b) : (instr->op == OP_SUBV_W) ? lanes_sub(a, b) : lanes_mul(a, b);
+          }
+          eval_write(st, rd + at, k, r);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// lanes taking branch instr (before its delay slot runs), into its label's waiting row
+void eval_take_branch(Eval_State* st, MIPS_Instr* instr, int32_t* taken) {
+  const int32_t* rs = eval_row(st, instr->rs);
+  const int32_t* rt = eval_row(st, instr->rt);
+  for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+    Lanes m = lanes_load(st->active + k);
+    if (instr->op == OP_BLTZ)
+      m = lanes_and(m, lanes_negative(lanes_load(rs + k)));
+    else if (instr->op == OP_BNE)
+      m = lanes_andnot(lanes_equal(lanes_load(rs + k), lanes_load(rt + k)), m);
+    lanes_store(taken + k, m);
+  }
+}
+
+// running the code on the first n lanes, their inputs already in the rows of the variables
+void eval_block(Eval_State* st, const int n) {
+  MIPS_Code* code = st->code;
+  memset(st->hi, 0, 2 * EVAL_BLOCK * sizeof(int32_t)); // hi and lo
+  for (int k = 0; k < EVAL_BLOCK; ++k) {
+    st->active[k] = (k < n) ? -1 : 0;
+    st->status[k] = EVAL_OK;
+  }
+  bool running = (n > 0);
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+    if (instr->op == OP_LABEL) { // lanes waiting here join again
+      int slot = st->label_slot[instr->label];
+      if (slot < 0)
+        continue;
+      int32_t* waiting = st->waiting + (size_t) slot * EVAL_BLOCK;
+      for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+        lanes_store(st->active + k, lanes_or(lanes_load(st->active + k), lanes_load(waiting + k)));
+        lanes_store(waiting + k, lanes_splat(0));
+      }
+      running = eval_running(st);
+      continue;
+    }
+    if (!running || instr->op == OP_COMMENT || instr->op == OP_NOP)
+      continue;
+    if (!eval_branch(instr->op)) {
+      eval_instr(st, instr);
+      if (instr->op == OP_ADD || instr->op == OP_ADDI || instr->op == OP_SUB || instr->op == OP_DIV || instr->op == OP_DIV_R6 || instr->op == OP_MOD_R6)
+        running = eval_running(st); // lanes may have stopped
+      continue;
+    }
+
+    // branch: the taken lanes wait at the label, after the delay slot ran on all of them
+    int32_t* waiting = st->waiting + (size_t) st->label_slot[instr->label] * EVAL_BLOCK;
+    _Alignas(64) int32_t taken[EVAL_BLOCK];
+    eval_take_branch(st, instr, taken);
+    if (code->delay_slots && i + 1 < code->n)
+      eval_instr(st, &(code->instrs[++i]));
+    for (int k = 0; k < EVAL_BLOCK; k += LANE_WIDTH) {
+      Lanes m = lanes_and(lanes_load(taken + k), lanes_load(st->active + k)); // not stopped in the slot
+      lanes_store(waiting + k, lanes_or(lanes_load(waiting + k), m));
+      lanes_store(st->active + k, lanes_andnot(m, lanes_load(st->active + k)));
+    }
+    running = eval_running(st);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// CSV input and output
+
+// next field of the line at *p (up to end), as a trimmed string in buf, false (buf empty) at the end
+// of the line
+bool next_csv_field(const char** p, const char* end, char* buf, const int size) {
+  const char* s = *p;
+  buf[0] = '\0';
+  if (s >= end || *s == '\n')
+    return false;
+  const char* e = s;
+  while (e < end && *e != ',' && *e != '\n')
+    ++e;
+  *p = (e < end && *e == ',') ? e + 1 : e;
+  while (s < e && is_blank(*s))
+    ++s;
+  while (e > s && is_blank(e[-1]))
+    --e;
+  int len = (int) (e - s);
+  if (len >= size)
+    len = size - 1;
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+  return true;
+}
+
+// start of the next non blank line from p, end if none
+const char* next_csv_line(const char* p, const char* end) {
+  while (p < end && *p != '\n')
+    ++p;
+  while (p < end && is_blank(*p))
+    ++p;
+  return p;
+}
+
+// one output row: the variables and the status of lane k
+void write_eval_row(FILE* out, Eval_State* st, const int* vars, const int n_vars, const int k, char* buf) {
+  char* p = buf;
+  for (int v = 0; v < n_vars; ++v) {
+    if (st->status[k] == EVAL_OK)
+      p = put_int(p, eval_row(st, vars[v])[k]);
+    *(p++) = ',';
+  }
+  p = put_str(p, eval_status_names[st->status[k]]);
+  *(p++) = '\n';
+  fwrite(buf, 1, p - buf, out);
+}
+
+// evaluating code over every row of the CSV file, writing the results to out and the throughput to
+// stderr, false (reported) on errors
+bool eval_batch(MIPS_Code* code, char reg_table[][MAX_TOKEN_SIZE], const char* filename, FILE* out) {
+  Input in;
+  if (!map_file(filename, &in)) {
+    report_error("Cannot read \"%s\"", filename);
+    return false;
+  }
+  const char* p = in.data;
+  const char* end = in.data + in.size;
+  while (p < end && is_blank(*p))
+    ++p;
+
+  // header: the variable of every column
+  int columns[8];
+  int n_columns = 0;
+  char field[MAX_STRING_SIZE];
+  bool ok = true;
+  while (ok && next_csv_field(&p, end, field, MAX_STRING_SIZE)) {
+    int reg = -1;
+    for (int i = 0; i < 8 && reg < 0; ++i) {
+      if (strcmp(reg_table[i], field) == 0)
+        reg = REG_S(i);
+    }
+    if (reg < 0 || n_columns == 8) {
+      report_error("\"%s\" is not a variable of the program (%s, column %d)", field, filename, n_columns + 1);
+      ok = false;
+    } else
+      columns[n_columns++] = reg;
+  }
+  p = next_csv_line(p, end);
+
+  Eval_State st;
+  ok = ok && init_eval(&st, code);
+  if (!ok) {
+    unmap_file(&in);
+    return false;
+  }
+
+  // output header: every variable of the program
+  int vars[8];
+  int n_vars = 0;
+  for (int i = 0; i < 8; ++i) {
+    if (strcmp(reg_table[i], "(empty)") != 0) {
+      vars[n_vars++] = REG_S(i);
+      fprintf(out, "%s,", reg_table[i]);
+    }
+  }
+  fprintf(out, "status\n");
+
+  // a block of rows at a time
+  long n_rows = 0;
+  long row = 1;
+  double seconds = 0;
+  char buf[9 * 16];
+  while (ok && p < end) {
+    memset(st.regs, 0, (size_t) st.n_regs * EVAL_BLOCK * sizeof(int32_t));
+    int n = 0;
+    for (; n < EVAL_BLOCK && p < end && ok; ++n, ++row, p = next_csv_line(p, end)) {
+      for (int c = 0; c < n_columns && ok; ++c) {
+        next_csv_field(&p, end, field, MAX_STRING_SIZE);
+        char* rest;
+        long long v = strtoll(field, &rest, 10);
+        if (field[0] == '\0' || *rest != '\0' || v < INT32_MIN || v > INT32_MAX) {
+          report_error("Bad value \"%s\" (%s, row %ld, column %d)", field, filename, row, c + 1);
+          ok = false;
+        } else
+          eval_row(&st, columns[c])[n] = (int32_t) v;
+      }
+      if (ok && next_csv_field(&p, end, field, MAX_STRING_SIZE)) {
+        report_error("More than %d values (%s, row %ld)", n_columns, filename, row);
+        ok = false;
+      }
+    }
+    if (!ok)
+      break;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    eval_block(&st, n);
+    seconds += seconds_since(&start);
+    for (int k = 0; k < n; ++k)
+      write_eval_row(out, &st, vars, n_vars, k, buf);
+    n_rows += n;
+  }
+  fflush(out);
+  if (ok)
+    fprintf(stderr, "%ld evaluations in %.6f s, %.0f evaluations/sec (%d lanes per instruction)\n",
+            n_rows, seconds, (seconds > 0) ? n_rows / seconds : 0.0, LANE_WIDTH);
+  free_eval(&st);
+  unmap_file(&in);
+  return ok;
+}
@@ -1,15 +1,31 @@
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "hw6.h"
+#include "trace.h"
+#include "error.h"
+#include "stats.h"
 #include "equation.h"
+#include "input.h"
+#include "profile.h"
+#include "lexer.h"
+#include "mips.h"
+#include "sched.h"
+#include "delay.h"
+#include "encode.h"
+#include "super.h"
+#include "eval.h"
+#include "ir.h"
+#include "ring.h"
 
 // -----------------------------------------------------------------------------------------------------------------------------
 // debugging
-bool debug = false;
-bool verbose = false;
 
 // printing register table
 void print_reg_table(char reg_table[][MAX_TOKEN_SIZE]) {
@@ -21,298 +37,355 @@ void print_reg_table(char reg_table[][MAX_TOKEN_SIZE]) {
 // -----------------------------------------------------------------------------------------------------------------------------
 // file manipulation
 
-// open file
-FILE* get_file(const char* filename) {
-  FILE* file = fopen(filename, "r");
-  if (file == NULL) {
-    printf("ERROR: Unable to open \"%s\"!\n", filename);
-    exit(1);
+// map file, false if it cannot be read
+bool read_file(const char* filename, Input* in) {
+  if (!map_file(filename, in)) {
+    report_error("Unable to open \"%s\"!", filename);
+    return false;
   }
-
-  if (debug) printf("Debug: Opening \"%s\"...\n", filename);
-  return file; // remember to close the file!
+  TRACE(TRACE_IO, "Debug: Opened \"%s\" (%zu bytes, %s)\n", filename, in->size, in->mapped ? "mapped" : "read");
+  return true;
 }
 
-// read file into string array
-void parse_file(FILE* file, char*** lines, int* n_lines) {
-  *lines = (char**) malloc(0); // array to store lines
-
-  if (debug) printf("Debug: Parsing:\n");
-  char line[MAX_STRING_SIZE];
-  while (fgets(line, MAX_STRING_SIZE, file) != NULL) {
-    // increasing array size
-    (*n_lines)++;
-    *lines = realloc(*lines, *n_lines * sizeof(char*));
-    (*lines)[*n_lines - 1] = (char*) malloc(MAX_STRING_SIZE * sizeof(char));
-    char* curr_line = (*lines)[*n_lines - 1];
-
-    // trimming newline
-    line[strcspn(line, "\r\n")] = '\0';
-
-    // saving new line
-    strcpy(curr_line, line);
-    if (debug) {
-      printf("  %p: ", (*lines)[*n_lines - 1]);
-      printf("%s (%s)\n", (*lines)[*n_lines - 1], line);
-    }
-  }
-  if (debug) {
-    printf("Debug: lines: %p\n", *lines);
+// splitting the file into statements
+Line* read_statements(const Input* in, int* n_lines) {
+  Line* lines = split_statements(in, n_lines);
+  if (TRACE_ON(TRACE_IO)) {
+    printf("Debug: Parsing:\n");
+    for (int i = 0; i < *n_lines; ++i)
+      printf("  %d: %.*s\n", i, lines[i].len, lines[i].str);
     printf("Debug: n_lines: %d\n", *n_lines);
   }
-  fclose(file); // done reading file
+  return lines;
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
 // processing
 
-// find corresponding register for a variable
+// find corresponding register id for a variable (len characters at var)
 // if not found add to register table and return newly assigned register
-void get_reg(char reg_table[][MAX_TOKEN_SIZE], char* var, char* reg) {
-  // register
-  strcpy(reg, "$sx"); // x will be replaced by register number
-
+bool get_reg(char reg_table[][MAX_TOKEN_SIZE], const char* var, const int len, uint8_t* reg) {
   // finding var
-  if (debug) printf("Debug: Finding \"%s\"...\n", var);
+  TRACE(TRACE_REGALLOC, "Debug: Finding \"%.*s\"...\n", len, var);
   for (int i = 0; i < 8; ++i) {
-    if (strcmp(reg_table[i], var) == 0) {
-      reg[2] = ('0' + i);
-      if (debug) printf("Debug: Returning \"%s\"...\n", reg);
-      return;
+    if (strncmp(reg_table[i], var, len) == 0 && reg_table[i][len] == '\0') {
+      *reg = REG_S(i);
+      TRACE(TRACE_REGALLOC, "Debug: Returning \"$s%d\"...\n", i);
+      return true;
     } else if (strcmp(reg_table[i], "(empty)") == 0) {
-      if (debug && verbose) printf("  %d: Is empty\n", i);
+      TRACE(TRACE_REGALLOC | TRACE_VERBOSE, "  %d: Is empty\n", i);
     } else
-      if (debug && verbose) printf("  %d: Not found\n", i);
+      TRACE(TRACE_REGALLOC | TRACE_VERBOSE, "  %d: Not found\n", i);
   }
 
-  if (debug) printf("Debug: Adding \"%s\" to register table...\n", var);
+  if (len >= MAX_TOKEN_SIZE) {
+    report_error("Variable name \"%.*s\" is too long", len, var);
+    return false;
+  }
+  TRACE(TRACE_REGALLOC, "Debug: Adding \"%.*s\" to register table...\n", len, var);
   for (int i = 0; i < 8; ++i) {
     if (strcmp(reg_table[i], "(empty)") == 0) {
-      strcpy(reg_table[i], var);
-      reg[2] = ('0' + i);
-      if (debug) printf("Debug: Returning \"%s\"...\n", reg);
-      return;
+      memcpy(reg_table[i], var, len);
+      reg_table[i][len] = '\0';
+      *reg = REG_S(i);
+      TRACE(TRACE_REGALLOC, "Debug: Returning \"$s%d\"...\n", i);
+      return true;
     } else
-      if (debug && verbose) printf("  %d: Not empty\n", i);
+      TRACE(TRACE_REGALLOC | TRACE_VERBOSE, "  %d: Not empty\n", i);
   }
 
-  printf("ERROR: Register table is full\n");
+  report_error("Register table is full");
+  return false;
 }
 
 // get next token and print
-char* nexttok() {
-  char* tok = strtok(NULL, " ;"); // next token
-  if (debug)
-    printf("\nDebug: tok: %s\n", tok);
+Token nexttok(Lexer* lex) {
+  Token tok = next_token(lex);
+  TRACE(TRACE_LEXER, "\nDebug: tok: %.*s (kind %d)\n", tok.length, lex->src + tok.offset, tok.kind);
   return tok;
 }
 
-// check if a token is numeric
-bool isnumeric(char* tok) {
-  int size = strlen(tok);
-  for (int i = 0; i < size; ++i) {
-    char c = tok[i];
-    if (debug && verbose)
-      printf("  %c\n", c);
-    
-    if (i == 0 && c == '-') // could be a negative number
-      continue;
+// saving a constant token (from the line at src)
+bool save_constant(const char* src, const Token tok, int32_t* dest) {
+  if (tok.kind == TOK_ERROR) {
+    report_error("Constant %.*s is out of range", tok.length, src + tok.offset);
+    return false;
+  }
+  *dest = tok.value;
+  return true;
+}
+
+// building the expression tree of a single line (len characters) into curr_eq
+bool make_eq(const char* curr_line, const int len, char reg_table[][MAX_TOKEN_SIZE], Equation* curr_eq) {
+  Lexer lex;
+  init_lexer(&lex, curr_line, len);
+
+  // rd =
+  Token tok = nexttok(&lex);
+  if (tok.kind != TOK_NAME) {
+    report_error("Expected a variable at the start of \"%.*s\"", len, curr_line);
+    return false;
+  }
+  if (!get_reg(reg_table, curr_line + tok.offset, tok.length, &(curr_eq->rd)))
+    return false;
+  if (nexttok(&lex).kind != TOK_ASSIGN) {
+    report_error("Expected \"=\" in \"%.*s\"", len, curr_line);
+    return false;
+  }
+
+  // if tok is a number, then this line is a li (constants cannot be on the left side of operations)
+  tok = nexttok(&lex);
+  if (tok.kind == TOK_NUM || tok.kind == TOK_ERROR) {
+    TRACE(TRACE_TREE, "Debug: li operation\n");
+    if (!save_constant(curr_line, tok, &(curr_eq->im))) // saving to equation struct
+      return false;
+    tok = nexttok(&lex);
+  }
 
-    // checking if character is a number
-    if (c < '0' || c > '9') {
-      if (debug)
-        printf("Debug: %s is not numeric\n", tok);
+  // expression
+  else if (tok.kind == TOK_NAME) {
+    // first operand/register
+    uint8_t rs;
+    if (!get_reg(reg_table, curr_line + tok.offset, tok.length, &rs))
       return false;
+
+    curr_eq->rs = rs;
+
+    // extending the chain by one operation and second operand at a time
+    tok = nexttok(&lex);
+    while (tok.kind == TOK_OP) {
+      const char op = curr_line[tok.offset]; // saving op
+      TRACE(TRACE_TREE, "Debug: New operation %d: %c\n", curr_eq->n_ops, op);
+
+      // saving operation and second operand
+      tok = nexttok(&lex);
+      if (tok.kind == TOK_NUM || tok.kind == TOK_ERROR) { // constant operand
+        int32_t value;
+        if (!save_constant(curr_line, tok, &value))
+          return false;
+        push_op(curr_eq, op, OPERAND_CONST, value);
+      } else if (tok.kind == TOK_NAME) { // only register operands
+        uint8_t rt;
+        if (!get_reg(reg_table, curr_line + tok.offset, tok.length, &rt))
+          return false;
+        push_op(curr_eq, op, OPERAND_REG, rt);
+      } else {
+        report_error("Expected an operand after \"%c\" in \"%.*s\"", op, len, curr_line);
+        return false;
+      }
+
+      tok = nexttok(&lex);
     }
+    if (curr_eq->n_ops == 0) {
+      report_error("Expected an operation in \"%.*s\"", len, curr_line);
+      return false;
+    }
+  }
+
+  if (tok.kind != TOK_END) {
+    report_error("Unexpected \"%.*s\" in \"%.*s\"", tok.length, curr_line + tok.offset, len, curr_line);
+    return false;
+  }
+
+  if (TRACE_ON(TRACE_TREE)) {
+    printf("\n");
+    print_reg_table(reg_table);
+    printf("Debug: curr_eq: %p\n", curr_eq);
+    print_eq(curr_eq, curr_line - curr_eq->src_offset);
   }
-  if (debug)
-    printf("Debug: %s is numeric\n", tok);
   return true;
 }
 
-// tree building
-void make_tree(char** lines, const int n_lines, char reg_table[][MAX_TOKEN_SIZE], Equation*** eqs) {
-  if (debug) printf("\nDebug: Making array/tree...\n");
+// tree building (lines point into the input buffer src), false if a line could not be parsed
+bool make_tree(const char* src, Line* lines, const int n_lines, char reg_table[][MAX_TOKEN_SIZE], Equation*** eqs) {
+  TRACE(TRACE_TREE, "\nDebug: Making array/tree...\n");
   
   // allocating equation array
-  *eqs = (Equation**) malloc(n_lines * sizeof(Equation*));
+  *eqs = (Equation**) counted_malloc(MEM_TREE, n_lines * sizeof(Equation*));
   for (int i = 0; i < n_lines; ++i) {
-    (*eqs)[i] = alloc_eq(lines[i]);
-    if (debug) printf("Debug: New equation allocated at %p\n", (*eqs)[i]);
+    (*eqs)[i] = alloc_eq(lines[i].str - src, lines[i].len);
+    TRACE(TRACE_TREE, "Debug: New equation allocated at %p\n", (*eqs)[i]);
   }
 
   // traversing through lines
-  Equation* curr_eq = NULL;    // current equation
-  Expression* curr_ex = NULL;  // current expression
   for (int i = 0; i < n_lines; ++i) {
-    if (debug) printf("\n\n\nDebug: line %d: %p: %s\n", i, lines[i], lines[i]);
-    char* curr_line = lines[i];
-    char tok_line[MAX_STRING_SIZE];
-    strcpy(tok_line, curr_line);
-
-    // traversing through tokens
-    int s = 0; // current state
-    char* tok = strtok(tok_line, " ;"); // remove spaces and semicolons
-    while (tok != NULL) {
-      if (debug) {
-        printf("\nDebug: s: %d\n", s);
-        printf("Debug: tok: %s\n", tok);
-      }
-
-      switch(s) {
-        // new equation
-        case 0:
-          if (debug) printf("Debug: New Equation:\n");
-
-          // getting equation
-          curr_eq = (*eqs)[i];
+    TRACE(TRACE_TREE, "\n\n\nDebug: line %d: %p: %.*s\n", i, lines[i].str, lines[i].len, lines[i].str);
+    if (!make_eq(lines[i].str, lines[i].len, reg_table, (*eqs)[i]))
+      return false;
+  }
 
-          // getting first operand/register
-          get_reg(reg_table, tok, curr_eq->rd);
+  // end of function
+  TRACE(TRACE_TREE, "\nDebug: %d lines of C read, tree built!\n", n_lines);
+  return true;
+}
 
-          s++;
-          break;
+// -----------------------------------------------------------------------------------------------------------------------------
+// compiling
 
-        // determining li or op
-        case 1:
-          tok = nexttok();
-          // if tok is a number, then this line is a li (constants cannot be on the left side of operations)
-          if (isnumeric(tok)) { 
-            if (debug) printf("Debug: li operation\n");
-            strcpy(curr_eq->im, tok); // saving to equation struct
-          }
+// ---------------------------------------------------------------------------
+// constant pool
+//
+// Constants that have to be built in a register (divisors, multipliers kept as mult, addends outside
+// the addi range) go into a new t register. t registers are never reused, so once a constant is in
+// one it stays there for the rest of the program and later uses of the same value only need the
+// register. Once the pool is full, the least recently used constant is forgotten (its register keeps
+// the value, it is just not looked up any more). Whole program, incremental and pipelined compiles
+// all forget the same way, so they give the same code. Constants built in conditional code are not
+// remembered.
+
+#define CONST_POOL_SIZE 8
+
+typedef struct Const_Pool {
+  int32_t value[CONST_POOL_SIZE];
+  int reg[CONST_POOL_SIZE];
+  int n; // least recently used first
+} Const_Pool;
+
+void init_const_pool(Const_Pool* pool) {
+  memset(pool, 0, sizeof(Const_Pool));
+}
 
-          // new expression
-          else { 
-            // allocating new expression
-            if (debug) printf("Debug: New Expression:\n");
-            curr_ex = alloc_ex(); 
-            if (debug) printf("       New expression allocated at %p\n", curr_ex);
+// index of v in the pool, -1 if it is not there
+int find_const(const Const_Pool* pool, const int32_t v) {
+  for (int i = 0; i < pool->n; ++i) {
+    if (pool->value[i] == v)
+      return i;
+  }
+  return -1;
+}
 
-            // getting first operand/register
-            get_reg(reg_table, tok, curr_ex->rs);
+// dropping entry i, keeping the order of the others
+void drop_const(Const_Pool* pool, const int i) {
+  memmove(pool->value + i, pool->value + i + 1, (pool->n - i - 1) * sizeof(int32_t));
+  memmove(pool->reg + i, pool->reg + i + 1, (pool->n - i - 1) * sizeof(int));
+  pool->n--;
+}
 
-            s = 2;
-          } 
-          break;
+// v now in reg, as the most recently used entry
+void add_const(Const_Pool* pool, const int32_t v, const int reg) {
+  pool->value[pool->n] = v;
+  pool->reg[pool->n] = reg;
+  pool->n++;
+}
 
-        // complete creating expression
-        case 2:
-          if (debug) printf("Debug: other operation\n");
+// register already holding v, -1 if none (counts as a use of it)
+int pooled_const(Const_Pool* pool, const int32_t v) {
+  int i = find_const(pool, v);
+  if (i < 0)
+    return -1;
+  int reg = pool->reg[i];
+  drop_const(pool, i);
+  add_const(pool, v, reg);
+  return reg;
+}
 
-          // connecting to equation
-          if (curr_eq->ex == NULL) {
-            curr_eq->ex = curr_ex;
-          }
+// building v in reg
+void load_const(MIPS_Code* code, const int reg, const int32_t v) {
+  TRACE(TRACE_CODEGEN, "Debug: Building constant %d (%d instructions)\n", v, imm_cost(v));
+  MIPS_load_imm(code, reg, v);
+}
 
-          // extend expression
-          else {
-            // allocating new expression
-            if (debug) printf("Debug: New Expression:\n");
-            Expression* new_ex = alloc_ex(); 
-            if (debug) printf("       New expression allocated at %p\n", curr_ex);
-
-            // reshaping equation structure
-            new_ex->left_ex = curr_ex;
-            curr_ex = new_ex;
-            curr_eq->ex = curr_ex;
-          }
+// register for a constant operand: the pooled one, otherwise a new t register (*load set to build it)
+int const_reg(Const_Pool* pool, const int32_t v, int* curr_t, bool* load) {
+  int reg = pooled_const(pool, v);
+  *load = (reg < 0);
+  if (!(*load))
+    return reg;
+
+  // making room, the least recently used one is forgotten
+  if (pool->n == CONST_POOL_SIZE) {
+    TRACE(TRACE_CODEGEN, "Debug: Forgetting constant %d for %d\n", pool->value[0], v);
+    drop_const(pool, 0);
+  }
+  reg = t_reg(++(*curr_t));
+  add_const(pool, v, reg);
+  return reg;
+}
 
-          // saving operation and second operand
-          curr_ex->op = tok[0]; // saving op
-          tok = nexttok();
-          // second operand (rt)
-          if (isnumeric(tok)) { // constant operand
-            strcpy(curr_ex->rt, tok); 
-            curr_ex->con = true;
-            if (atoi(tok) < 0)
-              curr_ex->neg = true;
-          } else { // only register operands
-            get_reg(reg_table, tok, curr_ex->rt);
-          }
+// ---------------------------------------------------------------------------
+// target dependent instructions, for the ISA in code->march
 
-          break;
-      }
+// rd = rs + imm (r6 has no addi)
+void emit_addi(MIPS_Code* code, const int rd, const int rs, const int32_t imm) {
+  MIPS_emit(code, (code->march == ARCH_MIPS32R6) ? OP_ADDIU : OP_ADDI, rd, rs, 0, imm, 0);
+}
 
-      tok = strtok(NULL, " ;"); // next token
+// rd = rs * rt
+//
+// There is no madd/msub selection: `+` and `-` are add and sub, which trap on overflow, while
+// madd/msub accumulate into HI/LO and wrap, so fusing `a * b + c` would lose the trap the source
+// asks for. Where a sum may wrap (the reassociated ones at -O1 and above) there is still nothing to
+// gain, as every product is followed by a plain operand (operators are applied left to right) and
+// mul + addu (2 instructions on mips32) beats mtlo + madd + mflo (3). r6 has no madd at all.
+void emit_mul(MIPS_Code* code, const int rd, const int rs, const int rt) {
+  if (code->march == ARCH_MIPS1) {
+    MIPS_emit(code, OP_MULT, 0, rs, rt, 0, 0);
+    MIPS_emit(code, OP_MFLO, rd, 0, 0, 0, 0);
+  } else
+    MIPS_emit(code, (code->march == ARCH_MIPS32R6) ? OP_MUL_R6 : OP_MUL, rd, rs, rt, 0, 0);
+}
 
-      if (debug) {
-        printf("\n");
-        print_reg_table(reg_table);
-        printf("Debug: curr_eq: %p\n", curr_eq);
-        print_eq(curr_eq);
-        printf("Debug: curr_ex: %p\n", curr_ex);
-        print_ex(curr_ex, "");
-      }
-    }
+// rd = rs / rt, or rs % rt for remainder
+void emit_div(MIPS_Code* code, const int rd, const int rs, const int rt, const bool remainder) {
+  if (code->march == ARCH_MIPS32R6)
+    MIPS_emit(code, remainder ? OP_MOD_R6 : OP_DIV_R6, rd, rs, rt, 0, 0);
+  else {
+    MIPS_emit(code, OP_DIV, 0, rs, rt, 0, 0);
+    MIPS_emit(code, remainder ? OP_MFHI : OP_MFLO, rd, 0, 0, 0, 0);
   }
-
-  // end of function
-  if (debug)
-    printf("\nDebug: %d lines of C read, tree built!\n", n_lines);
 }
 
-// -----------------------------------------------------------------------------------------------------------------------------
-// compiling
+// ---------------------------------------------------------------------------
+// registers
 
-// increase MIPS_code AND n_MIPS by n lines
-char** realloc_MIPS_code(char** MIPS_code, int* n_MIPS, const int n) {
-  if (debug) printf("Debug: Increasing MIPS code array by %d lines...\n", n);
-  int old_size = *n_MIPS;
-  *n_MIPS += n;
-  MIPS_code = (char**) realloc(MIPS_code, *n_MIPS * sizeof(char*));
-  for (int i = old_size; i < *n_MIPS; ++i)
-    MIPS_code[i] = (char*) malloc(MAX_STRING_SIZE * sizeof(char));
-  if (debug) printf("       Realloc succesful!\n");
-  return MIPS_code;
+// destination register of an operation: the equation's rd for the last one of the chain, otherwise a new t register
+int ex_rd(Equation* curr_eq, Expression* curr_ex, int* curr_t) {
+  curr_ex->rd = (curr_ex->i == curr_eq->n_ops - 1) ? curr_eq->rd : t_reg(++(*curr_t));
+  return curr_ex->rd;
+}
+
+// first operand of an operation: the variable for the first one of the chain, otherwise the result of the one before
+int ex_rs(Expression* curr_ex) {
+  return curr_ex->rs;
 }
 
 // ---------------------------------------------------------------------------
 // addition
-void MIPS_add(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t) {
-  if (debug) {
+void MIPS_add(Equation* curr_eq, Expression* curr_ex, MIPS_Code* code, int* curr_t, Const_Pool* pool) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("Debug: Adding:\n");
     printf("  con: %d\n", curr_ex->con);
     printf("  neg: %d\n", curr_ex->neg);
     printf("  curr_t: %d\n", *curr_t);
   }
 
-  // expanding array
-  *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-  char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-  // determining rd
-  int old_t = *curr_t;
-  char rd[] = "$tx";
-  if (curr_eq->ex == curr_ex)
-    strcpy(rd, curr_eq->rd);
-  else
-    rd[2] = ('0' + ++(*curr_t));
+  // constant too large for addi, built in a register first
+  if (curr_ex->con && !fits_imm16(curr_ex->rt)) {
+    bool load;
+    int rt = const_reg(pool, curr_ex->rt, curr_t, &load);
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
+    if (load)
+      load_const(code, rt, curr_ex->rt);
+    MIPS_emit(code, OP_ADD, rd, rs, rt, 0, 0);
+    return;
+  }
 
-  // determining rs
-  char rs[] = "$tx";
-  if (curr_ex->left_ex == NULL)
-    strcpy(rs, curr_ex->rs);
-  else
-    rs[2] = ('0' + old_t);
+  // determining registers
+  int rd = ex_rd(curr_eq, curr_ex, curr_t);
+  int rs = ex_rs(curr_ex);
 
   // writing the instruction
   if (!(curr_ex->con)) // adding with registers
-    strcpy(curr_line, "add ");
+    MIPS_emit(code, OP_ADD, rd, rs, curr_ex->rt, 0, 0);
   else // adding with constant
-    strcpy(curr_line, "addi ");
-  // rest of the instruction
-  strcat(curr_line, rd);
-  strcat(curr_line, ",");
-  strcat(curr_line, rs);
-  strcat(curr_line, ",");
-  strcat(curr_line, curr_ex->rt);
+    emit_addi(code, rd, rs, curr_ex->rt);
 }
 
 // ---------------------------------------------------------------------------
 // subtraction
-void MIPS_sub(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t) {
-  if (debug) {
+void MIPS_sub(Equation* curr_eq, Expression* curr_ex, MIPS_Code* code, int* curr_t, Const_Pool* pool) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("Debug: Subtracting:\n");
     printf("  con: %d\n", curr_ex->con);
     printf("  neg: %d\n", curr_ex->neg);
@@ -321,49 +394,32 @@ void MIPS_sub(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
   // registers only
   if (!(curr_ex->con)) {
-    // expanding array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-    char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-    // determining rd
-    int old_t = *curr_t;
-    char rd[] = "$tx";
-    if (curr_eq->ex == curr_ex)
-      strcpy(rd, curr_eq->rd);
-    else
-      rd[2] = ('0' + ++(*curr_t));
+    // determining registers
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
 
-    // determining rs
-    char rs[] = "$tx";
-    if (curr_ex->left_ex == NULL)
-      strcpy(rs, curr_ex->rs);
-    else
-      rs[2] = ('0' + old_t);
+    MIPS_emit(code, OP_SUB, rd, rs, curr_ex->rt, 0, 0);
+  }
 
-    strcpy(curr_line, "sub ");
-    strcat(curr_line, rd);
-    strcat(curr_line, ",");
-    strcat(curr_line, rs);
-    strcat(curr_line, ",");
-    strcat(curr_line, curr_ex->rt);
+  // with INT32_MIN, whose negation is itself: x + INT32_MIN would trap for the wrong x
+  else if (curr_ex->rt == INT32_MIN) {
+    bool load;
+    int rt = const_reg(pool, curr_ex->rt, curr_t, &load);
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
+    if (load)
+      load_const(code, rt, curr_ex->rt);
+    MIPS_emit(code, OP_SUB, rd, rs, rt, 0, 0);
   }
 
   // with constant
   else {
-    // negate
-    if (curr_ex->rt[0] == '-') { // already negative
-      char* tok = strtok(curr_ex->rt, "-");
-      strcpy(curr_ex->rt, tok);
-    } else {
-      char temp[MAX_TOKEN_SIZE];
-      strcpy(temp, curr_ex->rt);
-      strcpy(curr_ex->rt, "-");
-      strcat(curr_ex->rt, temp);
-    }
+    // negate (wrapping, like the hardware would)
+    curr_ex->rt = (int32_t) (0u - (uint32_t) curr_ex->rt);
 
     // send to add
     curr_ex->op = '+';
-    MIPS_add(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t);
+    MIPS_add(curr_eq, curr_ex, code, curr_t, pool);
   }
 }
 
@@ -372,20 +428,19 @@ void MIPS_sub(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
 // prepping for multiplication by a constant rt by first calculating the bit shifts needed
 int MIPS_mul_prep(const int rt, bool* shifts) {
-  if (debug) printf("Debug: Multiplying by constant %d:\n", rt);
+  TRACE(TRACE_CODEGEN, "Debug: Multiplying by constant %d:\n", rt);
 
   int n_shifts = 0; // number of shift operations needed
-  int rem = abs(rt);
+  uint32_t rem = (rt < 0) ? 0u - (uint32_t) rt : (uint32_t) rt; // magnitude, 2^31 for INT32_MIN
   for (int i = 31; i >= 1; --i) { // multiply by 1 is not necessary
-    int new_rem = rem - pow(2,i);
-    if (new_rem >= 0) {
+    if (rem >= (1u << i)) {
       n_shifts++;
       shifts[i] = true;
-      rem = new_rem;
+      rem -= 1u << i;
     }
   }
 
-  if (debug) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("       Shifts needed:");
     for (int i = 31; i >= 0; --i) {
       if (shifts[i])
@@ -396,8 +451,14 @@ int MIPS_mul_prep(const int rt, bool* shifts) {
   return n_shifts;
 }
 
-void MIPS_mul(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t) {
-  if (debug) {
+// cycles for multiplying by the constant rt with mult/mul, against 2 per shift plus 2 for shifts and adds
+int mul_const_cost(MIPS_Code* code, const int32_t rt, Const_Pool* pool) {
+  int load = (find_const(pool, rt) >= 0) ? 0 : imm_cost(rt);
+  return load + code->tune->mult + ((code->march == ARCH_MIPS1) ? 1 : 0); // mflo
+}
+
+void MIPS_mul(Equation* curr_eq, Expression* curr_ex, MIPS_Code* code, int* curr_t, Const_Pool* pool) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("Debug: Multiplying:\n");
     printf("  con: %d\n", curr_ex->con);
     printf("  neg: %d\n", curr_ex->neg);
@@ -406,130 +467,41 @@ void MIPS_mul(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
   // registers only
   if (!(curr_ex->con)) {
-    // expanding array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 2);
-    char* line1 = (*MIPS_code)[*n_MIPS-2];
-    char* line2 = (*MIPS_code)[*n_MIPS-1];
-
-    // determining rd
-    int old_t = *curr_t;
-    char rd[] = "$tx";
-    if (curr_eq->ex == curr_ex)
-      strcpy(rd, curr_eq->rd);
-    else
-      rd[2] = ('0' + ++(*curr_t));
-
-    // determining rs
-    char rs[] = "$tx";
-    if (curr_ex->left_ex == NULL)
-      strcpy(rs, curr_ex->rs);
-    else
-      rs[2] = ('0' + old_t);
+    // determining registers
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
 
-    // line 1
-    strcpy(line1, "mult ");
-    strcat(line1, rs);
-    strcat(line1, ",");
-    strcat(line1, curr_ex->rt);
-
-    // line 2
-    strcpy(line2, "mflo ");
-    strcat(line2, rd);
+    emit_mul(code, rd, rs, curr_ex->rt);
   }
 
   // with constant
   else {
     // 0
-    if (strcmp(curr_ex->rt, "0") == 0) {
-      // expanding array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-      char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-      // determining rd
-      char rd[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd, curr_eq->rd);
-      else
-        rd[2] = ('0' + ++(*curr_t));
-
-      // writing instruction
-      strcpy(curr_line, "li ");
-      strcat(curr_line, rd);
-      strcat(curr_line, ",0");
+    if (curr_ex->rt == 0) {
+      int rd = ex_rd(curr_eq, curr_ex, curr_t);
+      MIPS_emit(code, OP_LI, rd, 0, 0, 0, 0);
     }
 
     // 1
-    else if (strcmp(curr_ex->rt, "1") == 0) {
-      // expanding array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 2);
-      char* line1 = (*MIPS_code)[*n_MIPS-2];
-      char* line2 = (*MIPS_code)[*n_MIPS-1];
-
-      // determining rds
-      int old_t = *curr_t;
-      char rd1[] = "$tx";
-      rd1[2] = ('0' + ++(*curr_t));
-      char rd2[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd2, curr_eq->rd);
-      else
-        rd2[2] = ('0' + ++(*curr_t));
-
-      // determining rs
-      char rs[] = "$tx";
-      if (curr_ex->left_ex == NULL)
-        strcpy(rs, curr_ex->rs);
-      else
-        rs[2] = ('0' + old_t);
-
-      // line 1
-      strcpy(line1, "move ");
-      strcat(line1, rd1);
-      strcat(line1, ",");
-      strcat(line1, rs);
-
-      // line 2
-      strcpy(line2, "move ");
-      strcat(line2, rd2);
-      strcat(line2, ",");
-      strcat(line2, rd1);
+    else if (curr_ex->rt == 1) {
+      // determining registers
+      int rd1 = t_reg(++(*curr_t));
+      int rd2 = ex_rd(curr_eq, curr_ex, curr_t);
+      int rs = ex_rs(curr_ex);
+
+      MIPS_emit(code, OP_MOVE, rd1, rs, 0, 0, 0);
+      MIPS_emit(code, OP_MOVE, rd2, rd1, 0, 0, 0);
     }
 
     // -1
-    else if (strcmp(curr_ex->rt, "-1") == 0) {
-      // expanding array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 2);
-      char* line1 = (*MIPS_code)[*n_MIPS-2];
-      char* line2 = (*MIPS_code)[*n_MIPS-1];
-
-      // determining rds
-      int old_t = *curr_t;
-      char rd1[] = "$tx";
-      rd1[2] = ('0' + ++(*curr_t));
-      char rd2[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd2, curr_eq->rd);
-      else
-        rd2[2] = ('0' + ++(*curr_t));
-
-      // determining rs
-      char rs[] = "$tx";
-      if (curr_ex->left_ex == NULL)
-        strcpy(rs, curr_ex->rs);
-      else
-        rs[2] = ('0' + old_t);
-
-      // line 1
-      strcpy(line1, "move ");
-      strcat(line1, rd1);
-      strcat(line1, ",");
-      strcat(line1, rs);
-
-      // line 2
-      strcpy(line2, "sub ");
-      strcat(line2, rd2);
-      strcat(line2, ",$zero,");
-      strcat(line2, rd1);
+    else if (curr_ex->rt == -1) {
+      // determining registers
+      int rd1 = t_reg(++(*curr_t));
+      int rd2 = ex_rd(curr_eq, curr_ex, curr_t);
+      int rs = ex_rs(curr_ex);
+
+      MIPS_emit(code, OP_MOVE, rd1, rs, 0, 0, 0);
+      MIPS_emit(code, OP_SUB, rd2, REG_ZERO, rd1, 0, 0);
     }
 
     // other constants
@@ -538,111 +510,166 @@ void MIPS_mul(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
       bool shifts[32];
       for (int i = 0; i < 32; ++i)
         shifts[i] = false;
-      int n_shifts = MIPS_mul_prep(atoi(curr_ex->rt), shifts);
-
-      // expanding array
-      int d_size = n_shifts * 2 + 2; // change in code size (2 for each shift/add and another 2 for the last add and move)
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, d_size);
-      int i_line = *n_MIPS - d_size; // current line index
-
-      // determining rds
-      int old_t = *curr_t;
-      char rd1[] = "$tx";
-      rd1[2] = ('0' + ++(*curr_t));
-      char rd2[] = "$tx";
-      rd2[2] = ('0' + ++(*curr_t));
-      char rd3[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd3, curr_eq->rd);
-      else
-        rd3[2] = ('0' + ++(*curr_t));
+      int n_shifts = MIPS_mul_prep(curr_ex->rt, shifts);
+
+      // multiplying is cheaper on this core (only for an explicit --march, the default output keeps the shifts)
+      if (code->mul_by_cost && mul_const_cost(code, curr_ex->rt, pool) < 2 * n_shifts + 2) {
+        bool load;
+        int rt = const_reg(pool, curr_ex->rt, curr_t, &load);
+        int rd = ex_rd(curr_eq, curr_ex, curr_t);
+        int rs = ex_rs(curr_ex);
+        if (load)
+          load_const(code, rt, curr_ex->rt);
+        emit_mul(code, rd, rs, rt);
+        return;
+      }
 
-      // determining rs
-      char rs[] = "$tx";
-      if (curr_ex->left_ex == NULL)
-        strcpy(rs, curr_ex->rs);
-      else
-        rs[2] = ('0' + old_t);
+      // determining registers
+      int rd1 = t_reg(++(*curr_t));
+      int rd2 = t_reg(++(*curr_t));
+      int rd3 = ex_rd(curr_eq, curr_ex, curr_t);
+      int rs = ex_rs(curr_ex);
 
       // debug: checking
-      if (debug && verbose) {
+      if (TRACE_ON(TRACE_CODEGEN | TRACE_VERBOSE)) {
         printf("Debug: curr_t: %d\n", *curr_t);
-        printf("Debug: rd1: %s\n", rd1);
-        printf("       rd2: %s\n", rd2);
-        printf("       rd3: %s\n", rd3);
-        printf("        rs: %s\n", rs);
+        printf("Debug: rd1: %d\n", rd1);
+        printf("       rd2: %d\n", rd2);
+        printf("       rd3: %d\n", rd3);
+        printf("        rs: %d\n", rs);
       }
 
       // generating instructions
-      char* curr_line = NULL;
       bool first = true;
       for (int i = 31; i >= 1; --i) {
-        if (debug) printf("Debug: %d: %d\n", i, shifts[i]);
+        TRACE(TRACE_CODEGEN, "Debug: %d: %d\n", i, shifts[i]);
         if (shifts[i]) {
-          // sll
-          curr_line = (*MIPS_code)[i_line];
-          strcpy(curr_line, "sll ");
-          strcat(curr_line, rd1);
-          strcat(curr_line, ",");
-          strcat(curr_line, rs);
-          strcat(curr_line, ",");
-          char num[3];
-          sprintf(num, "%d", i);
-          strcat(curr_line, num);
-
-          // add
-          curr_line = (*MIPS_code)[++i_line];
+          MIPS_emit(code, OP_SLL, rd1, rs, 0, i, 0);
           if (first) { // move if first
-            strcpy(curr_line, "move ");
-            strcat(curr_line, rd2);
-            strcat(curr_line, ",");
-            strcat(curr_line, rd1);
+            MIPS_emit(code, OP_MOVE, rd2, rd1, 0, 0, 0);
             first = false;
           }
-          else {
-            strcpy(curr_line, "add ");
-            strcat(curr_line, rd2);
-            strcat(curr_line, ",");
-            strcat(curr_line, rd2);
-            strcat(curr_line, ",");
-            strcat(curr_line, rd1);
-          }
-
-          i_line++;
+          else
+            MIPS_emit(code, OP_ADD, rd2, rd2, rd1, 0, 0);
         }
       }
-      // last two lines
-      curr_line = (*MIPS_code)[i_line];
-      strcpy(curr_line, "add ");
-      strcat(curr_line, rd2);
-      strcat(curr_line, ",");
-      strcat(curr_line, rd2);
-      strcat(curr_line, ",");
-      strcat(curr_line, rs);
-      curr_line = (*MIPS_code)[++i_line];
-      if (!(curr_ex->neg)) { // positive constant
-        strcpy(curr_line, "move ");
-        strcat(curr_line, rd3);
-        strcat(curr_line, ",");
-        strcat(curr_line, rd2);
-      } else {               // negative constant
-        strcpy(curr_line, "sub ");
-        strcat(curr_line, rd3);
-        strcat(curr_line, ",$zero,");
-        strcat(curr_line, rd2);
-      }
+      // last two instructions
+      if (curr_ex->rt & 1) // bit 0 is not among the shifts
+        MIPS_emit(code, OP_ADD, rd2, rd2, rs, 0, 0);
+      if (!(curr_ex->neg) || curr_ex->rt == INT32_MIN) // positive constant, or INT32_MIN where x * 2^31 is its own negation
+        MIPS_emit(code, OP_MOVE, rd3, rd2, 0, 0, 0);
+      else                 // negative constant
+        MIPS_emit(code, OP_SUB, rd3, REG_ZERO, rd2, 0, 0);
     }
   }
 }
 
+// ---------------------------------------------------------------------------
+// divisors from the value profile (--value-profile)
+//
+// rd = rs / rt (or rs % rt) where the profile says rt is mostly the same d = +-2^k:
+//       li   $c,d           (unless pooled)
+//       bne  rt,$c,Lslow
+//       (rs / d with shifts, rounding towards zero like div, see reduce_div in ir.h)
+//       j    Ldone
+//   Lslow:
+//       div  rs,rt / mflo rd
+//   Ldone:
+// The test is only put in when the cycles the shifts save on d outweigh the test and the jump on
+// every execution.
+
+// instructions for rs / d (or rs % d) with shifts
+int shift_div_cost(const int32_t d, const bool remainder) {
+  uint32_t m = (d < 0) ? 0u - (uint32_t) d : (uint32_t) d;
+  if (m == 1)
+    return 1;
+  return ((m == 2) ? 3 : 4) + (remainder ? 2 : (d < 0) ? 1 : 0);
+}
+
+// divisor of prof to test for, 0 if testing does not pay off
+int32_t profiled_divisor(const Div_Profile* prof, MIPS_Code* code, const bool remainder, Const_Pool* pool) {
+  const int div_cost = code->tune->div + ((code->march == ARCH_MIPS32R6) ? 0 : 1); // mflo
+  int32_t best = 0;
+  long best_gain = 0;
+  for (int i = 0; i < prof->n; ++i) {
+    int32_t d = prof->values[i];
+    uint32_t m = (d < 0) ? 0u - (uint32_t) d : (uint32_t) d;
+    if (d == 0 || d == INT32_MIN || (m & (m - 1)) != 0)
+      continue;
+    int test = ((find_const(pool, d) >= 0) ? 0 : imm_cost(d)) + 2;              // bne and its slot
+    long gain = prof->counts[i] * (long) (div_cost - shift_div_cost(d, remainder) - 2) // j and its slot
+                - prof->total * (long) test;
+    if (gain > best_gain) {
+      best = d;
+      best_gain = gain;
+    }
+  }
+  return best;
+}
+
+// rd = rs / rt (or rs % rt) testing for the divisor of the profile first, false if that does not pay off
+bool MIPS_div_profiled(Expression* curr_ex, MIPS_Code* code, const int rd, const int rs, const bool remainder, int* curr_t, int* curr_L, Const_Pool* pool) {
+  if (curr_ex->profile == NULL)
+    return false;
+  const int32_t d = profiled_divisor(curr_ex->profile, code, remainder, pool);
+  if (d == 0)
+    return false;
+  TRACE(TRACE_CODEGEN, "Debug: Testing for divisor %d first\n", d);
+
+  // determining registers and labels
+  bool load;
+  int rc = const_reg(pool, d, curr_t, &load);
+  if (load)
+    load_const(code, rc, d);
+  int Lslow = ++(*curr_L);
+  int Ldone = ++(*curr_L);
+
+  // writing instructions
+  MIPS_emit(code, OP_BNE, 0, curr_ex->rt, rc, 0, Lslow);      // bne rt,rc,Lslow
+  uint32_t m = (d < 0) ? 0u - (uint32_t) d : (uint32_t) d;
+  if (m == 1) {
+    if (remainder)                                             // li rd,0
+      MIPS_emit(code, OP_LI, rd, 0, 0, 0, 0);
+    else                                                       // move rd,rs / subu rd,$zero,rs
+      MIPS_emit(code, (d > 0) ? OP_MOVE : OP_SUBU, rd, (d > 0) ? rs : REG_ZERO, (d > 0) ? 0 : rs, 0, 0);
+  } else {
+    int k = __builtin_ctz(m);
+    int sign = rs;
+    if (k > 1) {                                               // sra t1,rs,31
+      sign = t_reg(++(*curr_t));
+      MIPS_emit(code, OP_SRA, sign, rs, 0, 31, 0);
+    }
+    int bias = t_reg(++(*curr_t));                             // srl t2,t1,32-k
+    MIPS_emit(code, OP_SRL, bias, sign, 0, 32 - k, 0);
+    int sum = t_reg(++(*curr_t));                              // addu t3,rs,t2
+    MIPS_emit(code, OP_ADDU, sum, rs, bias, 0, 0);
+    if (!remainder && d > 0)                                   // sra rd,t3,k
+      MIPS_emit(code, OP_SRA, rd, sum, 0, k, 0);
+    else {
+      int q = t_reg(++(*curr_t));                              // sra t4,t3,k
+      MIPS_emit(code, OP_SRA, q, sum, 0, k, 0);
+      if (remainder) {                                         // sll t4,t4,k / subu rd,rs,t4
+        MIPS_emit(code, OP_SLL, q, q, 0, k, 0);
+        MIPS_emit(code, OP_SUBU, rd, rs, q, 0, 0);
+      } else                                                   // subu rd,$zero,t4
+        MIPS_emit(code, OP_SUBU, rd, REG_ZERO, q, 0, 0);
+    }
+  }
+  MIPS_emit(code, OP_J, 0, 0, 0, 0, Ldone);                    // j Ldone
+  MIPS_emit(code, OP_LABEL, 0, 0, 0, 0, Lslow);                // Lslow:
+  emit_div(code, rd, rs, curr_ex->rt, remainder);              // div rs,rt / mflo rd
+  MIPS_emit(code, OP_LABEL, 0, 0, 0, 0, Ldone);                // Ldone:
+  return true;
+}
+
 // ---------------------------------------------------------------------------
 // division
 
 // checks if a 32 bit number is a power of 2
 bool power_of_2(int n, int* n_bit) {
-  n = abs(n);
+  uint32_t m = (n < 0) ? 0u - (uint32_t) n : (uint32_t) n; // magnitude, 2^31 for INT32_MIN
   for (int i = 0; i < 32; ++i) {
-    if (n - pow(2,i) == 0) {
+    if (m == (1u << i)) {
       *n_bit = i;
       return true;
     }
@@ -650,8 +677,8 @@ bool power_of_2(int n, int* n_bit) {
   return false;
 }
 
-void MIPS_div(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t, int* curr_L) {
-  if (debug) {
+void MIPS_div(Equation* curr_eq, Expression* curr_ex, MIPS_Code* code, int* curr_t, int* curr_L, Const_Pool* pool) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("Debug: Dividing:\n");
     printf("  con: %d\n", curr_ex->con);
     printf("  neg: %d\n", curr_ex->neg);
@@ -660,236 +687,75 @@ void MIPS_div(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
   // registers only
   if (!(curr_ex->con)) {
-    // expanding array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 2);
-    char* line1 = (*MIPS_code)[*n_MIPS-2];
-    char* line2 = (*MIPS_code)[*n_MIPS-1];
-
-    // determining rd
-    int old_t = *curr_t;
-    char rd[] = "$tx";
-    if (curr_eq->ex == curr_ex)
-      strcpy(rd, curr_eq->rd);
-    else
-      rd[2] = ('0' + ++(*curr_t));
-
-    // determining rs
-    char rs[] = "$tx";
-    if (curr_ex->left_ex == NULL)
-      strcpy(rs, curr_ex->rs);
-    else
-      rs[2] = ('0' + old_t);
+    // determining registers
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
 
-    // line 1
-    strcpy(line1, "div ");
-    strcat(line1, rs);
-    strcat(line1, ",");
-    strcat(line1, curr_ex->rt);
-
-    // line 2
-    strcpy(line2, "mflo ");
-    strcat(line2, rd);
+    if (!MIPS_div_profiled(curr_ex, code, rd, rs, false, curr_t, curr_L, pool))
+      emit_div(code, rd, rs, curr_ex->rt, false);
   }
 
   // with constant
   else {
     // 1
-    if (strcmp(curr_ex->rt, "1") == 0) {
-      // expanding array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-      char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-      // determining rd
-      int old_t = *curr_t;
-      char rd[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd, curr_eq->rd);
-      else
-        rd[2] = ('0' + ++(*curr_t));
+    if (curr_ex->rt == 1) {
+      // determining registers
+      int rd = ex_rd(curr_eq, curr_ex, curr_t);
+      int rs = ex_rs(curr_ex);
 
-      // determining rs
-      char rs[] = "$tx";
-      if (curr_ex->left_ex == NULL)
-        strcpy(rs, curr_ex->rs);
-      else
-        rs[2] = ('0' + old_t);
-
-      // writing instruction
-      strcpy(curr_line, "move ");
-      strcat(curr_line, rd);
-      strcat(curr_line, ",");
-      strcat(curr_line, rs);
+      MIPS_emit(code, OP_MOVE, rd, rs, 0, 0, 0);
     }
 
     // -1
-    else if (strcmp(curr_ex->rt, "-1") == 0) {
-      // expanding array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-      char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-      // determining rd
-      int old_t = *curr_t;
-      char rd[] = "$tx";
-      if (curr_eq->ex == curr_ex)
-        strcpy(rd, curr_eq->rd);
-      else
-        rd[2] = ('0' + ++(*curr_t));
-
-      // determining rs
-      char rs[] = "$tx";
-      if (curr_ex->left_ex == NULL)
-        strcpy(rs, curr_ex->rs);
-      else
-        rs[2] = ('0' + old_t);
+    else if (curr_ex->rt == -1) {
+      // determining registers
+      int rd = ex_rd(curr_eq, curr_ex, curr_t);
+      int rs = ex_rs(curr_ex);
 
-      // writing instruction
-      strcpy(curr_line, "sub ");
-      strcat(curr_line, rd);
-      strcat(curr_line, ",$zero,");
-      strcat(curr_line, rs);
+      MIPS_emit(code, OP_SUB, rd, REG_ZERO, rs, 0, 0);
     }
 
     // other constants
     else {
       // checking if rt is a power of 2
       int i_bit = -1;
-      if (power_of_2(atoi(curr_ex->rt), &i_bit)) {
-        // check whether first operand is negative
-        int d_size = 8;
-        if (curr_ex->rt[0] == '-')
-          d_size++; // additional sub instruction
-
-        // expanding array
-        *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, d_size);
-        
-        // determining rd
-        int old_t = *curr_t;
-        char rd1[] = "$tx";
-        if (curr_eq->ex == curr_ex) // this expression is at the top, use equation rd
-          strcpy(rd1, curr_eq->rd);
-        else
-          rd1[2] = ('0' + ++(*curr_t));
-        char rd2[] = "$tx";
-        rd2[2] = ('0' + ++(*curr_t));
-
-        // determining rs
-        char rs[] = "$tx";
-        if (curr_ex->left_ex == NULL)
-          strcpy(rs, curr_ex->rs);
-        else
-          rs[2] = ('0' + old_t);
+      if (power_of_2(curr_ex->rt, &i_bit)) {
+        // determining registers
+        int rd1 = ex_rd(curr_eq, curr_ex, curr_t); // this expression is at the top, use equation rd
+        int rd2 = t_reg(++(*curr_t));
+        int rs = ex_rs(curr_ex);
 
         // determining labels
-        char Lx[] = "Lx";
-        Lx[1] = ('0' + ++(*curr_L));
-        char Ly[] = "Ly";
-        Ly[1] = ('0' + ++(*curr_L));
+        int Lx = ++(*curr_L);
+        int Ly = ++(*curr_L);
 
         // writing instructions
-        int i_line = *n_MIPS-d_size;
-        
-        // bltz rs,Lx
-        char* curr_line = (*MIPS_code)[i_line];
-        strcpy(curr_line, "bltz ");
-        strcat(curr_line, rs);
-        strcat(curr_line, ",");
-        strcat(curr_line, Lx);
-
-        // srl rd1,rs,i_bit
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, "srl ");
-        strcat(curr_line, rd1);
-        strcat(curr_line, ",");
-        strcat(curr_line, rs);
-        strcat(curr_line, ",");
-        char num[3];
-        sprintf(num, "%d", i_bit);
-        strcat(curr_line, num);
-
-        // sub rd1,$zero,rd1 (if constant is negative)
-        if (curr_ex->neg) {
-          curr_line = (*MIPS_code)[++i_line];
-          strcpy(curr_line, "sub ");
-          strcat(curr_line, rd1);
-          strcat(curr_line, ",$zero,");
-          strcat(curr_line, rd1);
+        MIPS_emit(code, OP_BLTZ, 0, rs, 0, 0, Lx);         // bltz rs,Lx
+        MIPS_emit(code, OP_SRL, rd1, rs, 0, i_bit, 0);     // srl rd1,rs,i_bit
+        if (curr_ex->neg)                                  // sub rd1,$zero,rd1 (if constant is negative)
+          MIPS_emit(code, OP_SUB, rd1, REG_ZERO, rd1, 0, 0);
+        MIPS_emit(code, OP_J, 0, 0, 0, 0, Ly);             // j Ly
+        MIPS_emit(code, OP_LABEL, 0, 0, 0, 0, Lx);         // Lx:
+        int rt = pooled_const(pool, curr_ex->rt);          // li rd2,rt (conditional, so not pooled)
+        if (rt < 0) {
+          rt = rd2;
+          MIPS_load_imm(code, rd2, curr_ex->rt);
         }
-
-        // j Ly
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, "j ");
-        strcat(curr_line, Ly);
-
-        // Lx:
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, Lx);
-        strcat(curr_line, ":");
-
-        // li rd2,rt
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, "li ");
-        strcat(curr_line, rd2);
-        strcat(curr_line, ",");
-        strcat(curr_line, curr_ex->rt);
-
-        // div rs,rd2
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, "div ");
-        strcat(curr_line, rs);
-        strcat(curr_line, ",");
-        strcat(curr_line, rd2);
-
-        // mflo rd1
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, "mflo ");
-        strcat(curr_line, rd1);
-
-        // Ly:
-        curr_line = (*MIPS_code)[++i_line];
-        strcpy(curr_line, Ly);
-        strcat(curr_line, ":");
+        emit_div(code, rd1, rs, rt, false);                // div rs,rt / mflo rd1
+        MIPS_emit(code, OP_LABEL, 0, 0, 0, 0, Ly);         // Ly:
       }
 
       // not a power of 2
       else {
-        // expanding array
-        *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 3);
-        char* line1 = (*MIPS_code)[*n_MIPS-3];
-        char* line2 = (*MIPS_code)[*n_MIPS-2];
-        char* line3 = (*MIPS_code)[*n_MIPS-1];
-
-        // determining rd
-        int old_t = *curr_t;
-        char rd1[] = "$tx";
-        rd1[2] = ('0' + ++(*curr_t));
-        char rd2[] = "$tx";
-        if (curr_eq->ex == curr_ex)
-          strcpy(rd2, curr_eq->rd);
-        else
-          rd2[2] = ('0' + ++(*curr_t));
-
-        // determining rs
-        char rs[] = "$tx";
-        if (curr_ex->left_ex == NULL)
-          strcpy(rs, curr_ex->rs);
-        else
-          rs[2] = ('0' + old_t);
-
-        // line 1
-        strcpy(line1, "li ");
-        strcat(line1, rd1);
-        strcat(line1, ",");
-        strcat(line1, curr_ex->rt);
-
-        // line 2
-        strcpy(line2, "div ");
-        strcat(line2, rs);
-        strcat(line2, ",");
-        strcat(line2, rd1);
-
-        // line 3
-        strcpy(line3, "mflo ");
-        strcat(line3, rd2);
+        // determining registers
+        bool load;
+        int rd1 = const_reg(pool, curr_ex->rt, curr_t, &load);
+        int rd2 = ex_rd(curr_eq, curr_ex, curr_t);
+        int rs = ex_rs(curr_ex);
+
+        if (load)
+          load_const(code, rd1, curr_ex->rt);
+        emit_div(code, rd2, rs, rd1, false);
       }
     }
   }
@@ -897,8 +763,8 @@ void MIPS_div(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
 // ---------------------------------------------------------------------------
 // modulo
-void MIPS_mod(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t) {
-  if (debug) {
+void MIPS_mod(Equation* curr_eq, Expression* curr_ex, MIPS_Code* code, int* curr_t, int* curr_L, Const_Pool* pool) {
+  if (TRACE_ON(TRACE_CODEGEN)) {
     printf("Debug: Modulo:\n");
     printf("  con: %d\n", curr_ex->con);
     printf("  neg: %d\n", curr_ex->neg);
@@ -907,228 +773,1594 @@ void MIPS_mod(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_
 
   // registers only
   if (!(curr_ex->con)) {
-    // expanding array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 2);
-    char* line1 = (*MIPS_code)[*n_MIPS-2];
-    char* line2 = (*MIPS_code)[*n_MIPS-1];
-
-    // determining rd
-    int old_t = *curr_t;
-    char rd[] = "$tx";
-    if (curr_eq->ex == curr_ex)
-      strcpy(rd, curr_eq->rd);
-    else
-      rd[2] = ('0' + ++(*curr_t));
+    // determining registers
+    int rd = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
 
-    // determining rs
-    char rs[] = "$tx";
-    if (curr_ex->left_ex == NULL)
-      strcpy(rs, curr_ex->rs);
-    else
-      rs[2] = ('0' + old_t);
-
-    // line 1
-    strcpy(line1, "div ");
-    strcat(line1, rs);
-    strcat(line1, ",");
-    strcat(line1, curr_ex->rt);
-
-    // line 2
-    strcpy(line2, "mfhi ");
-    strcat(line2, rd);
+    if (!MIPS_div_profiled(curr_ex, code, rd, rs, true, curr_t, curr_L, pool))
+      emit_div(code, rd, rs, curr_ex->rt, true);
   }
 
   // with constant
   else {
-    // expanding array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 3);
-    char* line1 = (*MIPS_code)[*n_MIPS-3];
-    char* line2 = (*MIPS_code)[*n_MIPS-2];
-    char* line3 = (*MIPS_code)[*n_MIPS-1];
-
     // extra t register for storing constant
-    int old_t = *curr_t;
-    char rd1[] = "$tx";
-    rd1[2] = ('0' + ++(*curr_t));
-
-    // line 1
-    strcpy(line1, "li ");
-    strcat(line1, rd1);
-    strcat(line1, ",");
-    strcat(line1, curr_ex->rt);
-
-    // determining rd
-    char rd2[] = "$tx";
-    if (curr_eq->ex == curr_ex)
-      strcpy(rd2, curr_eq->rd);
-    else
-      rd2[2] = ('0' + ++(*curr_t));
+    bool load;
+    int rd1 = const_reg(pool, curr_ex->rt, curr_t, &load);
+    int rd2 = ex_rd(curr_eq, curr_ex, curr_t);
+    int rs = ex_rs(curr_ex);
+
+    if (load)
+      load_const(code, rd1, curr_ex->rt);
+    emit_div(code, rd2, rs, rd1, true);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// chain part of compiling, one operation after the other (statement i_line)
+void exs_to_MIPS(Equation* curr_eq, const int i_line, MIPS_Code* code, int* curr_t, int* curr_L, Const_Pool* pool) {
+  Expression ex;
+  ex.rs = curr_eq->rs;
+  for (int i = 0; i < curr_eq->n_ops; ++i) {
+    ex.i = i;
+    ex.op = curr_eq->ops[i];
+    ex.rt = curr_eq->operands[i];
+    ex.con = (curr_eq->kinds[i] == OPERAND_CONST);
+    ex.neg = ex.con && ex.rt < 0;
+    ex.rd = -1;
+    ex.profile = (!ex.con && (ex.op == '/' || ex.op == '%')) ? find_div_profile(code->profile, i_line, i) : NULL;
+
+    const char op = ex.op; // MIPS_sub may turn it into an addition
+    const int n_before = code->n;
+    switch (op){
+      case '+':
+        MIPS_add(curr_eq, &ex, code, curr_t, pool);
+        break;
+
+      case '-':
+        MIPS_sub(curr_eq, &ex, code, curr_t, pool);
+        break;
+
+      case '*':
+        MIPS_mul(curr_eq, &ex, code, curr_t, pool);
+        break;
+
+      case '/':
+        MIPS_div(curr_eq, &ex, code, curr_t, curr_L, pool);
+        break;
+
+      case '%':
+        MIPS_mod(curr_eq, &ex, code, curr_t, curr_L, pool);
+        break;
+    }
+    stats_op(op, code->n - n_before);
+    ex.rs = ex.rd; // the next operation works on the result
+  }
+}
+
+// compiling a single equation (line i_line of the C code), appending its instructions to code
+void eq_to_MIPS(Equation* curr_eq, const int i_line, MIPS_Code* code, int* curr_t, int* curr_L, Const_Pool* pool) {
+  TRACE(TRACE_CODEGEN, "\n\n\nDebug: curr_eq: %p: line %d\n", curr_eq, i_line);
 
-    // determining rs
-    char rs[] = "$tx";
-    if (curr_ex->left_ex == NULL)
-      strcpy(rs, curr_ex->rs);
+  // comment original C code
+  MIPS_emit(code, OP_COMMENT, 0, 0, 0, i_line, 0);
+
+  // simple li
+  if (curr_eq->n_ops == 0) {
+    TRACE(TRACE_CODEGEN, "Debug: li operation\n");
+    int n_before = code->n;
+    int reg = fits_imm16(curr_eq->im) ? -1 : pooled_const(pool, curr_eq->im);
+    if (reg >= 0)
+      MIPS_emit(code, OP_MOVE, curr_eq->rd, reg, 0, 0, 0);
     else
-      rs[2] = ('0' + old_t);
+      MIPS_load_imm(code, curr_eq->rd, curr_eq->im);
+    stats_op('=', code->n - n_before);
+  }
 
-    // line 2
-    strcpy(line2, "div ");
-    strcat(line2, rs);
-    strcat(line2, ",");
-    strcat(line2, rd1);
+  // more complicated op
+  else
+    exs_to_MIPS(curr_eq, i_line, code, curr_t, curr_L, pool); // creating intermediate instructions 
+
+  // debugging
+  if (TRACE_ON(TRACE_CODEGEN)) {
+    printf("\nDebug: MIPS code:\n");
+    char buf[MAX_STRING_SIZE];
+    for (int i = 0; i < code->n; ++i) {
+      if (code->instrs[i].op == OP_COMMENT)
+        continue; // the original line is not at hand here
+      MIPS_format(&(code->instrs[i]), NULL, buf);
+      printf("  %d:\t%s\n", i, buf);
+    }
+  }
+}
 
-    // line 3
-    strcpy(line3, "mfhi ");
-    strcat(line3, rd2);
+// ---------------------------------------------------------------------------
+// superword level parallelism (MSA, --march=mips32r5)
+//
+// Neighbouring statements that are chains of multiplications of the same shape (as many operations,
+// a register or the same constant at each position) and do not read what an earlier one of them
+// writes are compiled together, a word of an MSA register per statement: the operands are inserted
+// into $w0-$w3 (filled in if all statements use the same register), the chain runs once with
+// mulv.w or slli.w/addv.w and copy_s.w takes out each result. Only * wraps like the vector
+// instructions, + and - trap on overflow and stay scalar. A group is only formed when it saves
+// cycles over the scalar code, inserts and copies included. Whole program compiles only.
+
+// operand j of the chain of statement i (-1: the variable it starts from)
+int slp_operand(Equation** eqs, const int i, const int j) {
+  return (j < 0) ? eqs[i]->rs : eqs[i]->operands[j];
+}
+
+// statements i..i+k-1 use the same register as operand j
+bool slp_uniform(Equation** eqs, const int i, const int k, const int j) {
+  for (int l = 1; l < k; ++l) {
+    if (slp_operand(eqs, i + l, j) != slp_operand(eqs, i, j))
+      return false;
   }
+  return true;
+}
+
+// statement i + l can run beside statements i..i+l-1
+bool slp_isomorphic(Equation** eqs, const int i, const int l) {
+  Equation* first = eqs[i];
+  Equation* eq = eqs[i + l];
+  if (eq->n_ops != first->n_ops)
+    return false;
+  for (int j = 0; j < eq->n_ops; ++j) {
+    if (first->ops[j] != '*' || eq->ops[j] != '*' || eq->kinds[j] != first->kinds[j])
+      return false;
+    if (eq->kinds[j] == OPERAND_CONST && eq->operands[j] != first->operands[j])
+      return false;
+  }
+  for (int m = 0; m < l; ++m) { // reading a result of the group
+    for (int j = -1; j < eq->n_ops; ++j) {
+      if ((j < 0 || eq->kinds[j] == OPERAND_REG) && slp_operand(eqs, i + l, j) == eqs[i + m]->rd)
+        return false;
+    }
+  }
+  return true;
+}
+
+// shifts for multiplying by the magnitude of c, bit 0 aside
+int slp_shifts(const int32_t c) {
+  uint32_t mag = (c < 0) ? 0u - (uint32_t) c : (uint32_t) c;
+  int n = 0;
+  for (int b = 1; b < 32; ++b)
+    n += (mag >> b) & 1;
+  return n;
+}
+
+// vector instructions for multiplying by c with shifts and adds (|c| > 1)
+int slp_shift_cost(const int32_t c) {
+  return 2 * slp_shifts(c) - 1 + (c & 1) + ((c < 0) ? 2 : 0);
+}
+
+// cycles for multiplying by c with a vector of it and mulv.w
+int slp_splat_cost(MIPS_Code* code, const int32_t c, Const_Pool* pool) {
+  int load = fits_imm10(c) ? 0 : (find_const(pool, c) >= 0) ? 0 : imm_cost(c);
+  return 1 + load + code->tune->mult;
+}
+
+// cycles saved by compiling statements i..i+k-1 together, negative if they are not
+int slp_gain(Equation** eqs, const int i, const int k, MIPS_Code* code, Const_Pool* pool) {
+  Equation* first = eqs[i];
+  int scalar = 0; // per statement
+  int vector = (slp_uniform(eqs, i, k, -1) ? 1 : k) + k;
+  for (int j = 0; j < first->n_ops; ++j) {
+    if (first->kinds[j] == OPERAND_REG) {
+      scalar += code->tune->mult;
+      vector += (slp_uniform(eqs, i, k, j) ? 1 : k) + code->tune->mult;
+      continue;
+    }
+    int32_t c = first->operands[j];
+    if (c == 0 || c == 1 || c == -1) { // li, move + move, move + sub
+      scalar += (c == 0) ? 1 : 2;
+      vector += (c == 1) ? 0 : (c == 0) ? 1 : 2;
+      continue;
+    }
+    int shift_add = 2 * slp_shifts(c) + 2;
+    int mul = mul_const_cost(code, c, pool);
+    scalar += (mul < shift_add) ? mul : shift_add;
+    int splat = slp_splat_cost(code, c, pool);
+    vector += (splat < slp_shift_cost(c)) ? splat : slp_shift_cost(c);
+  }
+  return k * scalar - vector;
+}
+
+// number of statements from i to compile together, 1 if none
+int slp_group(Equation** eqs, const int i, const int n_eqs, MIPS_Code* code, Const_Pool* pool) {
+  if (eqs[i]->n_ops == 0)
+    return 1;
+  int k = 1;
+  while (k < W_LANES && i + k < n_eqs && slp_isomorphic(eqs, i, k))
+    k++;
+  for (; k > 1; --k) {
+    if (slp_gain(eqs, i, k, code, pool) > 0)
+      return k;
+  }
+  return 1;
+}
+
+// operand j of statements i..i+k-1 into $w<w>
+void slp_gather(Equation** eqs, const int i, const int k, const int j, const int w, MIPS_Code* code) {
+  if (slp_uniform(eqs, i, k, j)) {
+    MIPS_emit(code, OP_FILL_W, REG_W(w), slp_operand(eqs, i, j), 0, 0, 0);
+    return;
+  }
+  for (int l = 0; l < k; ++l)
+    MIPS_emit(code, OP_INSERT_W, REG_W(w), slp_operand(eqs, i + l, j), 0, l, 0);
+}
+
+// compiling statements i..i+k-1 (lines of the C code) together
+void slp_to_MIPS(Equation** eqs, const int i, const int k, MIPS_Code* code, int* curr_t, Const_Pool* pool) {
+  TRACE(TRACE_CODEGEN, "\n\n\nDebug: Vectorizing lines %d-%d\n", i, i + k - 1);
+  for (int l = 0; l < k; ++l)
+    MIPS_emit(code, OP_COMMENT, 0, 0, 0, i + l, 0);
+
+  Equation* first = eqs[i];
+  int n_moves = code->n;
+  slp_gather(eqs, i, k, -1, 0, code);
+  n_moves = code->n - n_moves;
+  int acc = 0; // $w0 or $w3 hold the chain so far, $w1 an operand, $w2 a shifted one
+  for (int j = 0; j < first->n_ops; ++j) {
+    const int n_before = code->n;
+    const int32_t c = first->operands[j];
+    if (first->kinds[j] == OPERAND_REG) {
+      slp_gather(eqs, i, k, j, 1, code);
+      MIPS_emit(code, OP_MULV_W, REG_W(acc), REG_W(acc), REG_W(1), 0, 0);
+    }
+    else if (c == 0)
+      MIPS_emit(code, OP_LDI_W, REG_W(acc), 0, 0, 0, 0);
+    else if (c == -1) {
+      MIPS_emit(code, OP_LDI_W, REG_W(1), 0, 0, 0, 0);
+      MIPS_emit(code, OP_SUBV_W, REG_W(acc), REG_W(1), REG_W(acc), 0, 0);
+    }
+    else if (c != 1 && slp_splat_cost(code, c, pool) <= slp_shift_cost(c)) {
+      if (fits_imm10(c))
+        MIPS_emit(code, OP_LDI_W, REG_W(1), 0, 0, c, 0);
+      else {
+        bool load;
+        int reg = const_reg(pool, c, curr_t, &load);
+        if (load)
+          load_const(code, reg, c);
+        MIPS_emit(code, OP_FILL_W, REG_W(1), reg, 0, 0, 0);
+      }
+      MIPS_emit(code, OP_MULV_W, REG_W(acc), REG_W(acc), REG_W(1), 0, 0);
+    }
+    else if (c != 1) { // shifts of the magnitude, added up in the other chain register
+      uint32_t mag = (c < 0) ? 0u - (uint32_t) c : (uint32_t) c;
+      int to = (acc == 0) ? 3 : 0;
+      bool first_shift = true;
+      for (int b = 31; b >= 1; --b) {
+        if (!((mag >> b) & 1))
+          continue;
+        if (first_shift)
+          MIPS_emit(code, OP_SLLI_W, REG_W(to), REG_W(acc), 0, b, 0);
+        else {
+          MIPS_emit(code, OP_SLLI_W, REG_W(2), REG_W(acc), 0, b, 0);
+          MIPS_emit(code, OP_ADDV_W, REG_W(to), REG_W(to), REG_W(2), 0, 0);
+        }
+        first_shift = false;
+      }
+      if (mag & 1)
+        MIPS_emit(code, OP_ADDV_W, REG_W(to), REG_W(to), REG_W(acc), 0, 0);
+      if (c < 0) {
+        MIPS_emit(code, OP_LDI_W, REG_W(1), 0, 0, 0, 0);
+        MIPS_emit(code, OP_SUBV_W, REG_W(to), REG_W(1), REG_W(to), 0, 0);
+      }
+      acc = to;
+    }
+    stats_op('*', code->n - n_before);
+    for (int l = 1; l < k; ++l)
+      stats_op('*', 0);
+  }
+
+  for (int l = 0; l < k; ++l)
+    MIPS_emit(code, OP_COPY_S_W, eqs[i + l]->rd, REG_W(acc), 0, l, 0);
+  stats_op_instrs('*', n_moves + k);
+}
+
+// converting data struct into MIPS code  
+void eqs_to_MIPS(Equation** eqs, const int n_eqs, MIPS_Code* code) {
+  TRACE(TRACE_CODEGEN, "\nDebug: Compiling MIPS code into array at %p...\n", code);
+
+  int curr_t = -1; // counter for t registers (not reset for every line of C code?)
+  int curr_L = -1; // counter for labels
+  Const_Pool pool; // constants already in a register
+  init_const_pool(&pool);
+  for (int i = 0; i < n_eqs;) {
+    int k = has_msa(code->march) ? slp_group(eqs, i, n_eqs, code, &pool) : 1;
+    if (k > 1)
+      slp_to_MIPS(eqs, i, k, code, &curr_t, &pool);
+    else
+      eq_to_MIPS(eqs[i], i, code, &curr_t, &curr_L, &pool);
+    i += k;
+  }
+  TRACE(TRACE_CODEGEN, "\nDebug: Compiling completed!\n");
 }
 
 // ---------------------------------------------------------------------------
-// tree part of compiling
-void exs_to_MIPS(Equation* curr_eq, Expression* curr_ex, char*** MIPS_code, int* n_MIPS, int* curr_t, int* curr_L) {
-  // reach bottom of tree first
-  if (curr_ex->left_ex != NULL) {
-    exs_to_MIPS(curr_eq, curr_ex->left_ex, MIPS_code, n_MIPS, curr_t, curr_L);
+// compiling the IR (-O1 and up)
+//
+// Statements are compiled in order, each one computing only what its live binding needs. A value
+// goes into a new t register (or straight into the $s register of the statement it is bound to) the
+// first time it is needed and is taken from there afterwards. Before an $s register is overwritten,
+// a value that is still needed from it is moved to a t register.
+
+typedef struct IR_Codegen {
+  IR_Program* prog;
+  MIPS_Code* code;
+  int* home;      // register holding each value, -1 if it is not computed (any more)
+  int* pending;   // uses of each value not compiled yet
+  int content[8]; // value in each $s register, -1 if none
+  int curr_t;
+  Const_Pool pool;
+} IR_Codegen;
+
+// register holding the constant v, built in a new t register unless pooled
+int IR_const_reg(IR_Codegen* cg, const int32_t v) {
+  if (v == 0)
+    return REG_ZERO;
+  bool load;
+  int reg = const_reg(&(cg->pool), v, &(cg->curr_t), &load);
+  if (load)
+    load_const(cg->code, reg, v);
+  return reg;
+}
+
+// about to overwrite $s register reg: saving its value if it is still needed
+void IR_free_reg(IR_Codegen* cg, const int reg) {
+  int var = reg - REG_S(0);
+  int v = cg->content[var];
+  cg->content[var] = -1;
+  if (v < 0 || cg->home[v] != reg)
+    return;
+  if (cg->pending[v] == 0) {
+    cg->home[v] = -1;
+    return;
+  }
+  int t = t_reg(++(cg->curr_t));
+  MIPS_emit(cg->code, OP_MOVE, t, reg, 0, 0, 0);
+  cg->home[v] = t;
+}
+
+int IR_compute(IR_Codegen* cg, int v);
+
+// computing value v into rd (a new t register if rd < 0), returns the register
+int IR_emit_value(IR_Codegen* cg, const int v, int rd) {
+  IR_Value* val = &(cg->prog->values[v]);
+  MIPS_Code* code = cg->code;
+  const bool trapping = (val->src == '+' || val->src == '-'); // add/sub of the C code, the rest wraps like mult
+
+  // operands, constants the instruction cannot take directly in a register
+  int a = IR_resolve(cg->prog, val->a);
+  int b = (val->b >= 0) ? IR_resolve(cg->prog, val->b) : -1;
+  int rs = IR_compute(cg, a);
+  int rt = (b >= 0) ? IR_compute(cg, b) : -1;
+  const int n_before = code->n;
+  if (b < 0 && IR_binary(val->op)) {
+    bool imm = (val->op == '+' && fits_imm16(val->imm)) || (val->op == '-' && val->imm != INT32_MIN && fits_imm16(-val->imm));
+    if (!imm)
+      rt = IR_const_reg(cg, val->imm);
   }
+  cg->pending[a]--;
+  if (b >= 0)
+    cg->pending[b]--;
+  if (rd < 0)
+    rd = t_reg(++(cg->curr_t));
+  else
+    IR_free_reg(cg, rd);
 
-  // bottom of tree / back up
-  switch (curr_ex->op){
+  switch (val->op) {
     case '+':
-      MIPS_add(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t);
+      if (rt < 0 && trapping)
+        emit_addi(code, rd, rs, val->imm);
+      else if (rt < 0)
+        MIPS_emit(code, OP_ADDIU, rd, rs, 0, val->imm, 0);
+      else
+        MIPS_emit(code, trapping ? OP_ADD : OP_ADDU, rd, rs, rt, 0, 0);
       break;
-  
     case '-':
-      MIPS_sub(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t);
+      if (rt < 0 && trapping)
+        emit_addi(code, rd, rs, -val->imm);
+      else if (rt < 0)
+        MIPS_emit(code, OP_ADDIU, rd, rs, 0, -val->imm, 0);
+      else
+        MIPS_emit(code, trapping ? OP_SUB : OP_SUBU, rd, rs, rt, 0, 0);
       break;
-
     case '*':
-      MIPS_mul(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t);
+      emit_mul(code, rd, rs, rt);
       break;
-
-    case '/':
-      MIPS_div(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t, curr_L);
+    case '/': case '%':
+      emit_div(code, rd, rs, rt, val->op == '%');
+      break;
+    case IR_NEG:
+      MIPS_emit(code, trapping ? OP_SUB : OP_SUBU, rd, REG_ZERO, rs, 0, 0);
+      break;
+    case IR_SHL:
+      MIPS_emit(code, OP_SLL, rd, rs, 0, val->imm, 0);
       break;
+    case IR_SRA:
+      MIPS_emit(code, OP_SRA, rd, rs, 0, val->imm, 0);
+      break;
+    case IR_SRL:
+      MIPS_emit(code, OP_SRL, rd, rs, 0, val->imm, 0);
+      break;
+    case IR_AND:
+      MIPS_emit(code, OP_ANDI, rd, rs, 0, val->imm, 0);
+      break;
+  }
+  stats_op_instrs((val->src == IR_SRC_WRAP) ? '+' : val->src, code->n - n_before);
+  cg->home[v] = rd;
+  return rd;
+}
+
+// register holding value v, computing it first if needed
+int IR_compute(IR_Codegen* cg, int v) {
+  if (cg->home[v] >= 0)
+    return cg->home[v];
+  if (cg->prog->values[v].op == IR_CONST) {
+    cg->home[v] = IR_const_reg(cg, cg->prog->values[v].imm);
+    return cg->home[v];
+  }
+  return IR_emit_value(cg, v, -1);
+}
+
+// compiling statement i_line (just the comment if it is dead)
+void IR_stmt_to_MIPS(IR_Codegen* cg, IR_Stmt* stmt, const int i_line) {
+  MIPS_Code* code = cg->code;
+  MIPS_emit(code, OP_COMMENT, 0, 0, 0, i_line, 0);
+  if (!stmt->live)
+    return;
+
+  int v = IR_resolve(cg->prog, stmt->value);
+  IR_Value* val = &(cg->prog->values[v]);
+  int n_before = code->n;
+  cg->pending[v]--;
+  if (cg->home[v] == stmt->rd) // already there
+    return;
+  if (cg->home[v] < 0 && val->op != IR_CONST) { // computed right into the variable
+    IR_emit_value(cg, v, stmt->rd);
+    cg->content[stmt->rd - REG_S(0)] = v;
+    return;
+  }
+
+  // copied from where it is, or a constant
+  IR_free_reg(cg, stmt->rd);
+  if (cg->home[v] >= 0)
+    MIPS_emit(code, OP_MOVE, stmt->rd, cg->home[v], 0, 0, 0);
+  else {
+    int reg = fits_imm16(val->imm) ? -1 : pooled_const(&(cg->pool), val->imm);
+    if (reg >= 0)
+      MIPS_emit(code, OP_MOVE, stmt->rd, reg, 0, 0, 0);
+    else
+      MIPS_load_imm(code, stmt->rd, val->imm);
+    cg->home[v] = stmt->rd;
+  }
+  cg->content[stmt->rd - REG_S(0)] = v;
+  stats_op_instrs('=', code->n - n_before);
+}
+
+// compiling the optimized program
+void IR_to_MIPS(IR_Program* prog, MIPS_Code* code) {
+  TRACE(TRACE_CODEGEN, "\nDebug: Compiling IR (%d values) into array at %p...\n", prog->n_values, code);
+
+  IR_Codegen cg;
+  cg.prog = prog;
+  cg.code = code;
+  cg.home = (int*) counted_malloc(MEM_CODE, (prog->n_values + 1) * sizeof(int));
+  cg.pending = (int*) counted_calloc(MEM_CODE, prog->n_values + 1, sizeof(int));
+  cg.curr_t = -1;
+  init_const_pool(&(cg.pool));
+  for (int i = 0; i < prog->n_values; ++i)
+    cg.home[i] = -1;
+  for (int i = 0; i < 8; ++i) { // inputs start out in their variables
+    cg.content[i] = prog->input[i];
+    if (prog->input[i] >= 0)
+      cg.home[prog->input[i]] = REG_S(i);
+  }
+
+  // uses of every value needed by a live statement
+  bool* needed = (bool*) counted_calloc(MEM_CODE, prog->n_values + 1, sizeof(bool));
+  for (int i = 0; i < prog->n_stmts; ++i) {
+    if (!prog->stmts[i].live)
+      continue;
+    int v = IR_resolve(prog, prog->stmts[i].value);
+    needed[v] = true;
+    cg.pending[v]++;
+  }
+  for (int i = prog->n_values - 1; i >= 0; --i) {
+    IR_Value* val = &(prog->values[i]);
+    if (!needed[i] || val->op == IR_COPY)
+      continue;
+    if (val->a >= 0) {
+      int a = IR_resolve(prog, val->a);
+      needed[a] = true;
+      cg.pending[a]++;
+    }
+    if (val->b >= 0) {
+      int b = IR_resolve(prog, val->b);
+      needed[b] = true;
+      cg.pending[b]++;
+    }
+  }
+
+  for (int i = 0; i < prog->n_stmts; ++i)
+    IR_stmt_to_MIPS(&cg, &(prog->stmts[i]), i);
+  counted_free(needed);
+  counted_free(cg.home);
+  counted_free(cg.pending);
+  TRACE(TRACE_CODEGEN, "\nDebug: Compiling completed!\n");
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// incremental compiling
+//
+// The state file remembers, for every line of the previous run, the MIPS code it produced and the
+// compiler state (register table, t and label counters, constant pool) right after it. A line is keyed by the hash
+// of its text together with the hash of the state before it, so an unchanged line that sees the
+// same state as last time is spliced in from the cache instead of going through make_eq/eq_to_MIPS.
+// Since compiling a line only depends on the line and that state, the output matches a clean build.
+// Every field read back is checked, and a checksum over all entries ends the file, so a damaged or
+// edited state file is thrown away as a whole.
+
+#define STATE_MAGIC "hw6-incremental 5"
+#define STATE_MAX_LINES (1 << 26)           // entries a state file may claim
+#define STATE_MAX_CODE (1 << 20)            // instructions of one cached line
+#define STATE_MAX_T (REG_W(0) - 32 - 1)     // t counter whose registers still have ids (see t_reg)
+
+typedef struct State_Entry {
+  uint64_t key;
+  Line line;
+  char reg_table[8][MAX_TOKEN_SIZE]; // register table after the line
+  int curr_t;                        // t counter after the line
+  int curr_L;                        // label counter after the line
+  Const_Pool pool;                   // constant pool after the line
+  MIPS_Instr* code;
+  int n_code;
+} State_Entry;
+
+typedef struct State_Cache {
+  State_Entry* entries; // open addressing table, key 0 marks an empty slot
+  int size;             // power of 2
+  int n_entries;
+} State_Cache;
+
+// 64 bit FNV-1a, continuing from h
+uint64_t hash_bytes(uint64_t h, const void* data, size_t n) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= bytes[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+uint64_t hash_state(char reg_table[][MAX_TOKEN_SIZE], const int curr_t, const int curr_L, Const_Pool* pool, MIPS_Code* code) {
+  uint64_t h = HASH_SEED;
+  for (int i = 0; i < 8; ++i)
+    h = hash_bytes(h, reg_table[i], strlen(reg_table[i]) + 1);
+  h = hash_bytes(h, &curr_t, sizeof(curr_t));
+  h = hash_bytes(h, &curr_L, sizeof(curr_L));
+  h = hash_bytes(h, &(code->march), sizeof(code->march)); // the code depends on the target too
+  h = hash_bytes(h, code->tune->name, strlen(code->tune->name));
+  h = hash_bytes(h, &(code->mul_by_cost), sizeof(code->mul_by_cost));
+  h = hash_bytes(h, &(pool->n), sizeof(pool->n));
+  h = hash_bytes(h, pool->value, pool->n * sizeof(int32_t));
+  h = hash_bytes(h, pool->reg, pool->n * sizeof(int));
+  return h;
+}
+
+uint64_t hash_line(const Line line, const uint64_t state_hash) {
+  uint64_t h = hash_bytes(HASH_SEED, line.str, line.len);
+  h = hash_bytes(h, &state_hash, sizeof(state_hash));
+  return (h == 0) ? 1 : h; // 0 is reserved for empty slots
+}
 
-    case '%':
-      MIPS_mod(curr_eq, curr_ex, MIPS_code, n_MIPS, curr_t);
+void init_state_cache(State_Cache* cache, const int n) {
+  cache->size = 16;
+  while (cache->size < 2 * n)
+    cache->size *= 2;
+  cache->entries = (State_Entry*) counted_calloc(MEM_CACHE, cache->size, sizeof(State_Entry));
+  cache->n_entries = 0;
+}
+
+// finding the slot of key (either holding it or empty)
+State_Entry* find_state_entry(State_Cache* cache, const uint64_t key) {
+  int i = (int) (key & (cache->size - 1));
+  while (cache->entries[i].key != 0 && cache->entries[i].key != key)
+    i = (i + 1) & (cache->size - 1);
+  return &(cache->entries[i]);
+}
+
+void free_state_cache(State_Cache* cache) {
+  for (int i = 0; i < cache->size; ++i) {
+    State_Entry* entry = &(cache->entries[i]);
+    if (entry->key == 0)
+      continue;
+    counted_free((char*) entry->line.str);
+    counted_free(entry->code);
+  }
+  counted_free(cache->entries);
+}
+
+// reading one line of the state file into *buf (growing as needed), without newline
+bool read_state_line(FILE* file, char** buf, size_t* cap) {
+  if (getline(buf, cap, file) < 0)
+    return false;
+  (*buf)[strcspn(*buf, "\r\n")] = '\0';
+  return true;
+}
+
+// field tok of a state line as a number in [lo, hi], false if it is missing, malformed or out of range
+bool state_int(const char* tok, const long long lo, const long long hi, long long* v) {
+  char* end = NULL;
+  if (tok == NULL)
+    return false;
+  errno = 0;
+  *v = strtoll(tok, &end, 10);
+  return errno == 0 && end != tok && *end == '\0' && *v >= lo && *v <= hi;
+}
+
+// next field of a state line being split with strtok_r, see state_int
+bool state_field(char** save, const long long lo, const long long hi, long long* v) {
+  return state_int(strtok_r(NULL, " ", save), lo, hi, v);
+}
+
+// the register id reg can appear in the code of an entry whose t counter ends at curr_t
+bool state_reg(const long long reg, const int curr_t) {
+  if (reg >= REG_W(0) && reg < REG_W(N_W_REGS))
+    return true;
+  if (reg < 0 || reg >= REG_W(0) || (reg >= N_REGS && reg < 42))
+    return false;
+  return t_num((int) reg) <= curr_t;
+}
+
+// reading a constant pool written as "n value reg value reg ...", false if malformed or if a register
+// is not a t register of the entry (t counter at curr_t)
+bool parse_const_pool(char* buf, const int curr_t, Const_Pool* pool) {
+  init_const_pool(pool);
+  char* save = NULL;
+  long long n, value, reg;
+  if (!state_int(strtok_r(buf, " ", &save), 0, CONST_POOL_SIZE, &n))
+    return false;
+  for (int i = 0; i < n; ++i) {
+    if (!state_field(&save, INT32_MIN, INT32_MAX, &value) || !state_field(&save, 0, REG_W(0) - 1, &reg)
+        || t_num((int) reg) < 0 || !state_reg(reg, curr_t))
+      return false;
+    pool->value[i] = (int32_t) value;
+    pool->reg[i] = (int) reg;
+  }
+  pool->n = (int) n;
+  return strtok_r(NULL, " ", &save) == NULL;
+}
+
+// checksum of an entry as saved, continuing from h
+uint64_t hash_state_entry(uint64_t h, const State_Entry* entry) {
+  h = hash_bytes(h, &(entry->key), sizeof(entry->key));
+  h = hash_bytes(h, &(entry->curr_t), sizeof(entry->curr_t));
+  h = hash_bytes(h, &(entry->curr_L), sizeof(entry->curr_L));
+  h = hash_bytes(h, &(entry->n_code), sizeof(entry->n_code));
+  for (int j = 0; j < 8; ++j)
+    h = hash_bytes(h, entry->reg_table[j], strlen(entry->reg_table[j]) + 1);
+  h = hash_bytes(h, &(entry->pool.n), sizeof(entry->pool.n));
+  h = hash_bytes(h, entry->pool.value, entry->pool.n * sizeof(int32_t));
+  h = hash_bytes(h, entry->pool.reg, entry->pool.n * sizeof(int));
+  h = hash_bytes(h, entry->line.str, entry->line.len);
+  for (int j = 0; j < entry->n_code; ++j) { // field by field, MIPS_Instr has padding
+    const MIPS_Instr* instr = &(entry->code[j]);
+    int32_t fields[6] = {instr->op, instr->rd, instr->rs, instr->rt, instr->imm, instr->label};
+    h = hash_bytes(h, fields, sizeof(fields));
+  }
+  return h;
+}
+
+// reading the next entry of the state file, false if it is malformed or out of range (nothing is
+// left allocated then)
+bool read_state_entry(FILE* file, char** buf, size_t* cap, State_Entry* entry) {
+  // key and counters
+  long long curr_t, curr_L, n_code;
+  char* save = NULL;
+  if (!read_state_line(file, buf, cap))
+    return false;
+  char* tok = strtok_r(*buf, " ", &save);
+  char* end = NULL;
+  unsigned long long key = (tok != NULL) ? strtoull(tok, &end, 16) : 0; // 0 marks empty slots
+  if (key == 0 || *end != '\0'
+      || !state_field(&save, -1, STATE_MAX_T, &curr_t) || !state_field(&save, -1, INT32_MAX - 1, &curr_L)
+      || !state_field(&save, 0, STATE_MAX_CODE, &n_code) || strtok_r(NULL, " ", &save) != NULL)
+    return false;
+  entry->key = key;
+  entry->curr_t = (int) curr_t;
+  entry->curr_L = (int) curr_L;
+  entry->n_code = (int) n_code;
+
+  // register table, 8 names that fit
+  if (!read_state_line(file, buf, cap))
+    return false;
+  tok = strtok_r(*buf, " ", &save);
+  for (int j = 0; j < 8; ++j) {
+    if (tok == NULL || strlen(tok) >= MAX_TOKEN_SIZE)
+      return false;
+    strcpy(entry->reg_table[j], tok);
+    tok = strtok_r(NULL, " ", &save);
+  }
+  if (tok != NULL)
+    return false;
+
+  // constant pool
+  if (!read_state_line(file, buf, cap) || !parse_const_pool(*buf, entry->curr_t, &(entry->pool)))
+    return false;
+
+  // original line
+  if (!read_state_line(file, buf, cap))
+    return false;
+  entry->line.len = strlen(*buf);
+  entry->line.str = (char*) counted_malloc(MEM_CACHE, entry->line.len + 1);
+  memcpy((char*) entry->line.str, *buf, entry->line.len + 1);
+
+  // MIPS code, one instruction per line
+  bool valid = true;
+  entry->code = (MIPS_Instr*) counted_malloc(MEM_CACHE, (entry->n_code + 1) * sizeof(MIPS_Instr));
+  for (int j = 0; j < entry->n_code && valid; ++j) {
+    long long f[6];
+    valid = read_state_line(file, buf, cap);
+    tok = valid ? strtok_r(*buf, " ", &save) : NULL;
+    valid = valid && state_int(tok, 0, N_OPS - 1, &f[0]);
+    for (int k = 1; k < 4; ++k)
+      valid = valid && state_field(&save, 0, UINT16_MAX, &f[k]) && state_reg(f[k], entry->curr_t);
+    valid = valid && state_field(&save, INT32_MIN, INT32_MAX, &f[4]) && state_field(&save, 0, (entry->curr_L > 0) ? entry->curr_L : 0, &f[5])
+            && strtok_r(NULL, " ", &save) == NULL;
+    if (valid) {
+      MIPS_Instr instr = {(uint8_t) f[0], (uint16_t) f[1], (uint16_t) f[2], (uint16_t) f[3], (int32_t) f[4], (int32_t) f[5]};
+      entry->code[j] = instr;
+    }
+  }
+  if (!valid) {
+    counted_free((char*) entry->line.str);
+    counted_free(entry->code);
+  }
+  return valid;
+}
+
+// loading the previous run. A missing state file, or one that is malformed anywhere or does not
+// match its checksum, gives an empty cache, so everything is compiled again.
+void load_state_cache(const char* filename, State_Cache* cache) {
+  FILE* file = fopen(filename, "r");
+  char* buf = NULL;
+  size_t cap = 0;
+  int n = 0;
+  if (file == NULL || !read_state_line(file, &buf, &cap) || strcmp(buf, STATE_MAGIC) != 0
+      || !read_state_line(file, &buf, &cap) || sscanf(buf, "%d", &n) != 1 || n < 0 || n > STATE_MAX_LINES) {
+    TRACE(TRACE_IO, "Debug: No usable state in \"%s\", compiling everything\n", filename);
+    if (file != NULL)
+      fclose(file);
+    free(buf);
+    init_state_cache(cache, 0);
+    return;
+  }
+
+  init_state_cache(cache, n);
+  uint64_t h = HASH_SEED;
+  bool valid = true;
+  for (int i = 0; i < n && valid; ++i) {
+    State_Entry entry;
+    valid = read_state_entry(file, &buf, &cap, &entry);
+    if (!valid)
       break;
+    h = hash_state_entry(h, &entry);
+    State_Entry* slot = find_state_entry(cache, entry.key);
+    if (slot->key != 0) { // a duplicate key, keeping the first one
+      counted_free((char*) entry.line.str);
+      counted_free(entry.code);
+      continue;
+    }
+    *slot = entry;
+    cache->n_entries++;
+  }
+  unsigned long long checksum;
+  valid = valid && read_state_line(file, &buf, &cap) && sscanf(buf, "%llx", &checksum) == 1 && checksum == h;
+  fclose(file);
+  free(buf);
+  if (!valid) {
+    TRACE(TRACE_IO, "Debug: State in \"%s\" is damaged, compiling everything\n", filename);
+    free_state_cache(cache);
+    init_state_cache(cache, 0);
+    return;
   }
+  TRACE(TRACE_IO, "Debug: Loaded %d cached lines from \"%s\"\n", cache->n_entries, filename);
 }
 
-// converting data struct into lines of MIPS code  
-void eqs_to_MIPS(Equation** eqs, const int n_eqs, char*** MIPS_code, int* n_MIPS) {
-  if (debug)
-    printf("\nDebug: Compiling MIPS code into array at %p...\n", MIPS_code);
+// writing the state of this run (one entry per line, in order, then the checksum of them all)
+void save_state(const char* filename, State_Entry* entries, const int n) {
+  char* tmp_name;
+  FILE* file = open_replacement(filename, &tmp_name);
+  if (file == NULL) {
+    report_error("Unable to write \"%s\"!", filename);
+    return;
+  }
+  fprintf(file, "%s\n%d\n", STATE_MAGIC, n);
+  uint64_t h = HASH_SEED;
+  for (int i = 0; i < n; ++i) {
+    State_Entry* entry = &(entries[i]);
+    h = hash_state_entry(h, entry);
+    fprintf(file, "%llx %d %d %d\n", (unsigned long long) entry->key, entry->curr_t, entry->curr_L, entry->n_code);
+    for (int j = 0; j < 8; ++j)
+      fprintf(file, (j == 0) ? "%s" : " %s", entry->reg_table[j]);
+    fprintf(file, "\n%d", entry->pool.n);
+    for (int j = 0; j < entry->pool.n; ++j)
+      fprintf(file, " %d %d", entry->pool.value[j], entry->pool.reg[j]);
+    fprintf(file, "\n%.*s\n", entry->line.len, entry->line.str);
+    for (int j = 0; j < entry->n_code; ++j) {
+      MIPS_Instr* instr = &(entry->code[j]);
+      fprintf(file, "%d %d %d %d %d %d\n", instr->op, instr->rd, instr->rs, instr->rt, instr->imm, instr->label);
+    }
+  }
+  fprintf(file, "%llx\n", (unsigned long long) h);
+  if (!replace_file(file, tmp_name, filename))
+    report_error("Unable to write \"%s\"!", filename);
+}
 
-  *MIPS_code = (char**) malloc(0); // empty array to start
-  int curr_t = -1; // counter for t registers (not reset for every line of C code?)
-  int curr_L = -1; // counter for labels
-  for (int i = 0; i < n_eqs; ++i) {
-    // getting equation and line
-    Equation* curr_eq = eqs[i];
-    if (debug) printf("\n\n\nDebug: curr_eq: %p: %s\n", curr_eq, curr_eq->og);
-
-    // ---------------------------------------------------------------------------
-    // expanding code line array
-    *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-    char* curr_line = (*MIPS_code)[*n_MIPS-1];
-
-    // comment original C code
-    strcpy(curr_line, "# ");
-    strcat(curr_line, curr_eq->og);
-
-    // ---------------------------------------------------------------------------
-    // simple li
-    if (curr_eq->ex == NULL) {
-      if (debug) printf("Debug: li operation\n");
-      
-      // expanding MIPS code array
-      *MIPS_code = realloc_MIPS_code(*MIPS_code, n_MIPS, 1);
-      curr_line = (*MIPS_code)[*n_MIPS-1];
-
-      // generating MIPS code
-      strcpy(curr_line, "li ");
-      strcat(curr_line, curr_eq->rd);
-      strcat(curr_line, ",");
-      strcat(curr_line, curr_eq->im);
+// same as make_tree followed by eqs_to_MIPS, but reusing the lines cached in state_file
+bool incremental_to_MIPS(const char* src, Line* lines, const int n_lines, char reg_table[][MAX_TOKEN_SIZE], const char* state_file, MIPS_Code* code) {
+  State_Cache cache;
+  load_state_cache(state_file, &cache);
+
+  State_Entry* new_entries = (State_Entry*) counted_malloc(MEM_CACHE, n_lines * sizeof(State_Entry));
+  int* first_lines = (int*) counted_malloc(MEM_CACHE, n_lines * sizeof(int)); // code moves while growing, so code pointers are set at the end
+  int curr_t = -1;
+  int curr_L = -1;
+  Const_Pool pool;
+  init_const_pool(&pool);
+  int n_reused = 0;
+  for (int i = 0; i < n_lines; ++i) {
+    uint64_t key = hash_line(lines[i], hash_state(reg_table, curr_t, curr_L, &pool, code));
+    State_Entry* cached = find_state_entry(&cache, key);
+    int first_line = code->n;
+    first_lines[i] = first_line;
+
+    // unchanged line seeing the same state, splice in the previous output
+    stats_begin(PHASE_CODEGEN);
+    if (cached->key != 0 && cached->line.len == lines[i].len && memcmp(cached->line.str, lines[i].str, lines[i].len) == 0) {
+      TRACE(TRACE_IO, "Debug: line %d reused: %.*s\n", i, lines[i].len, lines[i].str);
+      for (int j = 0; j < cached->n_code; ++j) {
+        MIPS_Instr* instr = &(cached->code[j]);
+        MIPS_emit(code, instr->op, instr->rd, instr->rs, instr->rt, (instr->op == OP_COMMENT) ? i : instr->imm, instr->label);
+      }
+      memcpy(reg_table, cached->reg_table, sizeof(cached->reg_table));
+      curr_t = cached->curr_t;
+      curr_L = cached->curr_L;
+      pool = cached->pool;
+      n_reused++;
+      stats_end(1);
+    }
+
+    // changed, or downstream of a change in registers or labels
+    else {
+      TRACE(TRACE_IO, "Debug: line %d recompiled: %.*s\n", i, lines[i].len, lines[i].str);
+      stats_begin(PHASE_PARSE);
+      Equation* eq = alloc_eq(lines[i].str - src, lines[i].len);
+      bool parsed = make_eq(lines[i].str, lines[i].len, reg_table, eq);
+      stats_end(1);
+      stats_begin(PHASE_CODEGEN);
+      if (parsed)
+        eq_to_MIPS(eq, i, code, &curr_t, &curr_L, &pool);
+      free_eq(eq);
+      stats_end(parsed ? 1 : 0);
+      if (!parsed) {
+        counted_free(first_lines);
+        counted_free(new_entries);
+        free_state_cache(&cache);
+        return false;
+      }
+    }
+
+    // remembering for the next run
+    State_Entry* entry = &(new_entries[i]);
+    entry->key = key;
+    entry->line = lines[i];
+    memcpy(entry->reg_table, reg_table, sizeof(entry->reg_table));
+    entry->curr_t = curr_t;
+    entry->curr_L = curr_L;
+    entry->pool = pool;
+    entry->n_code = code->n - first_line;
+  }
+  for (int i = 0; i < n_lines; ++i)
+    new_entries[i].code = code->instrs + first_lines[i];
+  TRACE(TRACE_IO, "\nDebug: %d of %d lines reused from \"%s\"\n", n_reused, n_lines, state_file);
+
+  save_state(state_file, new_entries, n_lines);
+  counted_free(first_lines);
+  counted_free(new_entries);
+  free_state_cache(&cache);
+  return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// pipelined compiling (--pipeline)
+//
+// Splitting and parsing, code generation and writing run on three threads at the same time, passing
+// batches of statements along SPSC rings in input order. Used batches go back to the parser through
+// a third ring, so there are never more than N_BATCHES in flight and a slow writer holds the other
+// stages back instead of the whole program piling up in memory. Only the -O0 code generator works
+// statement by statement, and since the output is written as it comes, a parse error stops the
+// output after the batch before it.
+
+#define BATCH_LINES 256
+#define N_BATCHES RING_SIZE // every ring can take all of them, so only the parser ever waits for one
+
+typedef struct Batch {
+  Line lines[BATCH_LINES];
+  Equation* eqs[BATCH_LINES]; // reused for the next batch, NULL until first needed
+  int n;
+  MIPS_Code code; // comments refer to lines of the batch
+  bool last;      // nothing follows
+  bool failed;    // a statement could not be parsed, nothing of the batch is output
+} Batch;
+
+typedef struct Pipeline {
+  const Input* in;
+  MIPS_Arch march;
+  const MIPS_Tune* tune;
+  FILE* out;
+  Ring parsed;   // parser to code generator
+  Ring compiled; // code generator to writer
+  Ring unused;   // writer back to parser
+  Batch* batches[N_BATCHES];
+  Stats stats[2]; // of the parser and the code generator, the writer counts into the caller's
+  Error_Buffer error;
+} Pipeline;
+
+void* parse_stage(void* arg) {
+  Pipeline* pipe = (Pipeline*) arg;
+  use_stats(&(pipe->stats[0]));
+  error_buffer = &(pipe->error);
+  char reg_table[][MAX_TOKEN_SIZE] = {"(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)"};
+
+  size_t pos = 0;
+  bool last = false;
+  while (!last) {
+    Batch* batch = (Batch*) ring_pop(&(pipe->unused));
+    stats_begin(PHASE_READ);
+    batch->n = 0;
+    while (batch->n < BATCH_LINES && next_statement(pipe->in, &pos, &(batch->lines[batch->n])))
+      batch->n++;
+    last = (batch->n < BATCH_LINES);
+    stats_end(batch->n);
+
+    stats_begin(PHASE_PARSE);
+    batch->failed = false;
+    for (int i = 0; i < batch->n && !batch->failed; ++i) {
+      Line* line = &(batch->lines[i]);
+      if (batch->eqs[i] == NULL)
+        batch->eqs[i] = alloc_eq(line->str - pipe->in->data, line->len);
+      else
+        reuse_eq(batch->eqs[i], line->str - pipe->in->data, line->len);
+      batch->failed = !make_eq(line->str, line->len, reg_table, batch->eqs[i]);
+    }
+    stats_end(batch->failed ? 0 : batch->n);
+    last |= batch->failed;
+    batch->last = last;
+    ring_push(&(pipe->parsed), batch);
+  }
+  return NULL;
+}
+
+void* codegen_stage(void* arg) {
+  Pipeline* pipe = (Pipeline*) arg;
+  use_stats(&(pipe->stats[1]));
+  int curr_t = -1;
+  int curr_L = -1;
+  Const_Pool pool;
+  init_const_pool(&pool);
+
+  bool last = false;
+  while (!last) {
+    Batch* batch = (Batch*) ring_pop(&(pipe->parsed));
+    last = batch->last; // the batch belongs to the writer once pushed
+    batch->code.n = 0;
+    if (!batch->failed) {
+      stats_begin(PHASE_CODEGEN);
+      for (int i = 0; i < batch->n; ++i)
+        eq_to_MIPS(batch->eqs[i], i, &(batch->code), &curr_t, &curr_L, &pool);
+      stats_end(batch->n);
+    }
+    ring_push(&(pipe->compiled), batch);
+  }
+  return NULL;
+}
+
+// writing on the calling thread
+bool write_stage(Pipeline* pipe) {
+  bool parsed = true;
+  bool last = false;
+  while (!last) {
+    Batch* batch = (Batch*) ring_pop(&(pipe->compiled));
+    last = batch->last;
+    parsed = !batch->failed;
+    if (parsed) {
+      stats_begin(PHASE_OUTPUT);
+      write_MIPS_asm(pipe->out, &(batch->code), batch->lines);
+      stats_end(batch->n);
+    }
+    ring_push(&(pipe->unused), batch);
+  }
+  fflush(pipe->out);
+  return parsed;
+}
+
+// compiling and writing in (not split yet) at -O0, false if a statement could not be parsed
+bool pipeline_to_MIPS(const Input* in, const MIPS_Arch march, const MIPS_Tune* tune, const bool mul_by_cost, FILE* out) {
+  Pipeline pipe; // on the stack, where the rings get their cache line alignment
+  memset(&pipe, 0, sizeof(Pipeline));
+  pipe.in = in;
+  pipe.march = march;
+  pipe.tune = tune;
+  pipe.out = out;
+  pipe.stats[0].mem_into = pipe.stats[1].mem_into = mem_stats(stats); // blocks move between the threads
+  init_ring(&(pipe.parsed));
+  init_ring(&(pipe.compiled));
+  init_ring(&(pipe.unused));
+  for (int i = 0; i < N_BATCHES; ++i) {
+    Batch* batch = (Batch*) counted_calloc(MEM_CACHE, 1, sizeof(Batch));
+    init_MIPS_code(&(batch->code));
+    batch->code.march = march;
+    batch->code.tune = tune;
+    batch->code.mul_by_cost = mul_by_cost;
+    pipe.batches[i] = batch;
+    ring_push(&(pipe.unused), batch);
+  }
+
+  pthread_t parser, codegen;
+  pthread_create(&parser, NULL, parse_stage, &pipe);
+  pthread_create(&codegen, NULL, codegen_stage, &pipe);
+  bool parsed = write_stage(&pipe);
+  pthread_join(parser, NULL);
+  pthread_join(codegen, NULL);
+  TRACE(TRACE_IO, "\nDebug: Pipeline done\n");
+
+  merge_stats(stats, &(pipe.stats[0]));
+  merge_stats(stats, &(pipe.stats[1]));
+  if (!parsed)
+    report_error("%s", pipe.error.msg);
+  for (int i = 0; i < N_BATCHES; ++i) {
+    Batch* batch = pipe.batches[i];
+    for (int j = 0; j < BATCH_LINES && batch->eqs[j] != NULL; ++j)
+      free_eq(batch->eqs[j]);
+    free_MIPS_code(&(batch->code));
+    counted_free(batch);
+  }
+  return parsed;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// driver and library (see hw6.h)
+
+typedef enum Emit_Format {
+  EMIT_ASM, // assembly text
+  EMIT_BIN, // raw image
+  EMIT_ELF, // relocatable object
+  N_EMITS
+} Emit_Format;
+
+const char* emit_names[N_EMITS] = {"asm", "bin", "elf"};
+
+struct HW6_Context {
+  Opt_Level opt_level;
+  MIPS_Arch march;
+  bool march_given;      // --march was given, constant multipliers are then costed (mips1 otherwise, always with shifts)
+  const MIPS_Tune* tune; // NULL for the usual core of march
+  Emit_Format emit;
+  bool sched;     // list scheduling for the tune core
+  bool noreorder; // filling delay slots ourselves
+  bool superopt;  // -Osuper over the generated code
+  char* super_db;  // --superopt-db (allocated), NULL to search every window again
+  bool pipeline;  // parsing, compiling and writing on three threads
+  size_t mem_limit; // --mem-limit in bytes, 0 for none
+  Stats stats;
+  Error_Buffer error;
+};
+
+// core for the costs, the one given or the usual one of the ISA
+const MIPS_Tune* context_tune(const HW6_Context* ctx) {
+  return (ctx->tune != NULL) ? ctx->tune : find_tune(default_tunes[ctx->march]);
+}
+
+// compiling in through the pipeline (--pipeline, or streaming under --mem-limit), which only does what
+// works one statement at a time (plan_memory only sends such compiles here)
+int compile_pipelined(HW6_Context* ctx, const Input* in, FILE* out) {
+  return pipeline_to_MIPS(in, ctx->march, context_tune(ctx), ctx->march_given, out) ? HW6_OK : HW6_ERROR;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// memory budget (--mem-limit)
+//
+// Compiling the whole program at once keeps all of its statements, trees and code in memory, roughly
+// in proportion to the number of statements and the size of the source (measured with --stats on
+// generated programs: at most 32 bytes a statement and 24 a source byte at -O0, a bit more through the
+// IR, twice as much for the passes over the whole code). When that does not fit next to what is live
+// already, the program is streamed through the pipeline instead, which holds N_BATCHES batches at any
+// time and writes the output as it goes, at -O0 if more was asked for. What needs the whole program
+// (-Osuper, --sched, --noreorder, machine code, --incremental, --eval-batch, --value-profile) cannot stream and
+// stops with an error up front rather than running out of memory halfway.
+
+#define MEM_BASE (32 << 10) // first capacities of the growing arrays
+#define MEM_PER_STATEMENT 32
+#define MEM_PER_BYTE 24
+
+// "123", "64K", "512M", "2G", false if it is none of them
+bool parse_size(const char* str, size_t* size) {
+  char* end = NULL;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (end == str)
+    return false;
+  int shift = 0;
+  if (*end == 'K' || *end == 'k')
+    shift = 10;
+  else if (*end == 'M' || *end == 'm')
+    shift = 20;
+  else if (*end == 'G' || *end == 'g')
+    shift = 30;
+  if (shift > 0)
+    end++;
+  if (*end != '\0' || value == 0 || value > (SIZE_MAX >> shift))
+    return false;
+  *size = (size_t) value << shift;
+  return true;
+}
+
+// bytes compiling the n_lines statements of in at once is expected to take
+size_t whole_program_mem(const HW6_Context* ctx, const Input* in, const int n_lines, const bool incremental) {
+  size_t per_byte = MEM_PER_BYTE;
+  if (ctx->opt_level != OPT_0)
+    per_byte += 4;
+  if (ctx->sched || ctx->noreorder || ctx->superopt)
+    per_byte *= 2;
+  if (ctx->emit != EMIT_ASM)
+    per_byte += 4; // the encoded words
+  if (incremental)
+    per_byte += 2 * MEM_PER_BYTE; // the cache of the last run and this one's entries
+  size_t proofs = ctx->superopt ? sizeof(Super_BDD) : 0;
+  return MEM_BASE + proofs + (size_t) n_lines * MEM_PER_STATEMENT + in->size * per_byte;
+}
+
+// bytes of the pipeline, its batches growing to the longest statement
+size_t streaming_mem(const int longest) {
+  return N_BATCHES * (sizeof(Batch) + BATCH_LINES * 512) + (size_t) longest * MEM_PER_STATEMENT;
+}
+
+// checking in against ctx->mem_limit, *stream set if it has to go through the pipeline; false (with the
+// error reported) if it does not fit either way
+bool plan_memory(HW6_Context* ctx, const Input* in, const bool whole_program, const bool incremental, bool* stream) {
+  // --pipeline for what needs more than one statement at a time, compiled at once instead
+  bool pipeline = ctx->pipeline;
+  if (pipeline && (ctx->opt_level != OPT_0 || ctx->emit != EMIT_ASM || ctx->sched || ctx->noreorder || ctx->superopt)) {
+    report_warning("--pipeline only works with -O0 and --emit=asm, without -Osuper, --sched or --noreorder, compiling at once instead");
+    pipeline = false;
+  }
+
+  *stream = pipeline;
+  Mem_Stats* mem = mem_stats(stats);
+  mem->limit = ctx->mem_limit;
+  if (ctx->mem_limit == 0 || pipeline)
+    return true;
+
+  int longest = 0;
+  int n_lines = count_statements(in, &longest);
+  size_t live = (size_t) atomic_load(&(mem->live[N_MEM_POOLS]));
+  mem->estimate = whole_program_mem(ctx, in, n_lines, incremental);
+  if (live + mem->estimate <= ctx->mem_limit)
+    return true;
+
+  size_t streamed = streaming_mem(longest);
+  if (whole_program || ctx->emit != EMIT_ASM || ctx->sched || ctx->noreorder || ctx->superopt) {
+    report_error("Compiling needs about %zu bytes, over the --mem-limit of %zu (only -O0 assembly without -Osuper, --sched, --noreorder, "
+                 "--incremental, --eval-batch or --value-profile can be streamed)", live + mem->estimate, ctx->mem_limit);
+    return false;
+  }
+  if (live + streamed > ctx->mem_limit) {
+    report_error("Compiling needs about %zu bytes even when streamed, over the --mem-limit of %zu", live + streamed, ctx->mem_limit);
+    return false;
+  }
+  if (ctx->opt_level != OPT_0)
+    report_warning("Compiling at once needs about %zu bytes, over the --mem-limit of %zu, streaming at -O0 instead", live + mem->estimate, ctx->mem_limit);
+  mem->estimate = streamed;
+  mem->streamed = true;
+  *stream = true;
+  return true;
+}
+
+// compiling the statements (pointing into src) to out, incremental if state_file is not NULL, running
+// the result over the inputs in eval_file instead of writing it if that is not NULL, with the divisors
+// of profile if that is not NULL
+int compile_lines(HW6_Context* ctx, const char* src, Line* lines, const int n_lines, const char* state_file, const char* eval_file,
+                  const Value_Profile* profile, FILE* out) {
+  char reg_table[][MAX_TOKEN_SIZE] = {"(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)"}; // register table for storing variable names
+  MIPS_Code code; // MIPS instructions (including comments)
+  init_MIPS_code(&code);
+  code.march = ctx->march;
+  code.tune = context_tune(ctx);
+  code.mul_by_cost = ctx->march_given;
+  code.profile = profile;
+
+  bool parsed = true;
+
+  // incremental: parsing and compiling only what changed since the last run
+  if (state_file != NULL)
+    parsed = incremental_to_MIPS(src, lines, n_lines, reg_table, state_file, &code);
+
+  else {
+    Equation** eqs = NULL; // equation array for storing equations and expressions
+    stats_begin(PHASE_PARSE);
+    parsed = make_tree(src, lines, n_lines, reg_table, &eqs); // convert lines into array-tree hybrid structure
+    stats_end(n_lines);
+    
+    if (TRACE_ON(TRACE_TREE) && parsed) {
+      printf("\nDebug: eqs: %p\n", eqs);
+      print_tree(eqs, n_lines, src);
     }
+
+    // code compiling
+    if (parsed && ctx->opt_level != OPT_0) { // through the IR and its passes
+      IR_Program prog;
+      IR_Target target = {code.march, code.tune, ctx->opt_level == OPT_S};
+      stats_begin(PHASE_OPTIMIZE);
+      build_IR(eqs, n_lines, &prog);
+      run_passes(&prog, opt_pipelines[ctx->opt_level], &target);
+      stats_end(n_lines);
+      stats_begin(PHASE_CODEGEN);
+      IR_to_MIPS(&prog, &code);
+      stats_end(n_lines);
+      free_IR(&prog);
+    } else {
+      stats_begin(PHASE_CODEGEN);
+      if (parsed)
+        eqs_to_MIPS(eqs, n_lines, &code); // compiling function
+      stats_end(parsed ? n_lines : 0);
+    }
+    // freeing equation/expression array/tree
+    for (int i = 0; i < n_lines; ++i) free_eq(eqs[i]);
+    counted_free(eqs);
+  }
   
-    // ---------------------------------------------------------------------------
-    // more complicated op
-    else
-      exs_to_MIPS(curr_eq, curr_eq->ex, MIPS_code, n_MIPS, &curr_t, &curr_L); // creating intermediate instructions 
-
-    // ---------------------------------------------------------------------------
-    // debugging
-    if (debug) {
-      printf("\nDebug: MIPS code (including comments):\n");
-      for (int i = 0; i < *n_MIPS; ++i)
-        printf("  %d:\t%s\n", i, (*MIPS_code)[i]);
+  // superoptimizing windows of the code
+  if (parsed && ctx->superopt) {
+    stats_begin(PHASE_OPTIMIZE);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int changes = superoptimize_MIPS(&code, ctx->super_db);
+    stats_pass("super", seconds_since(&start), changes);
+    stats_end(0);
+  }
+
+  // instruction scheduling, over the whole program
+  if (parsed && ctx->sched) {
+    stats_begin(PHASE_CODEGEN);
+    schedule_MIPS(&code, code.tune);
+    stats_end(0);
+  }
+
+  // delay slots, and on mips1 the HI/LO spacing the assembler no longer adds in noreorder mode
+  if (parsed && ctx->noreorder) {
+    stats_begin(PHASE_CODEGEN);
+    fill_delay_slots(&code);
+    if (code.march == ARCH_MIPS1)
+      space_hilo(&code);
+    stats_end(0);
+  }
+
+  // outputting
+  int status = HW6_OK;
+  stats_begin(PHASE_OUTPUT);
+  if (!parsed)
+    status = HW6_ERROR;
+  else if (eval_file != NULL)
+    status = eval_batch(&code, reg_table, eval_file, out) ? HW6_OK : HW6_ERROR;
+  else if (ctx->emit == EMIT_ASM)
+    write_MIPS_asm(out, &code, lines);
+
+  // machine code, on mips1 with the HI/LO spacing the assembler would have added
+  else {
+    if (code.march == ARCH_MIPS1)
+      space_hilo(&code);
+    MIPS_Bin bin;
+    if (MIPS_assemble(&code, &bin)) {
+      TRACE(TRACE_IO, "Debug: %d words, %d relocations\n", bin.n_words, bin.n_relocs);
+      if (ctx->emit == EMIT_BIN)
+        write_MIPS_bin(out, &bin);
+      else
+        write_MIPS_elf(out, &bin, code.march);
+    } else
+      status = HW6_ERROR;
+    free_MIPS_bin(&bin);
+  }
+  fflush(out);
+  stats_end(status == HW6_OK ? n_lines : 0);
+  free_MIPS_code(&code);
+  return status;
+}
+
+HW6_Context* hw6_alloc_context(void) {
+  HW6_Context* ctx = (HW6_Context*) calloc(1, sizeof(HW6_Context));
+  if (ctx == NULL)
+    return NULL;
+  ctx->opt_level = OPT_0;
+  ctx->march = ARCH_MIPS1;
+  ctx->tune = NULL;
+  ctx->emit = EMIT_ASM;
+  return ctx;
+}
+
+void hw6_free_context(HW6_Context* ctx) {
+  free(ctx->super_db);
+  free(ctx);
+}
+
+// a copy of filename as the --superopt-db of ctx, false if out of memory
+bool set_super_db(HW6_Context* ctx, const char* filename) {
+  char* copy = (char*) malloc(strlen(filename) + 1);
+  if (copy == NULL)
+    return false;
+  strcpy(copy, filename);
+  free(ctx->super_db);
+  ctx->super_db = copy;
+  return true;
+}
+
+int hw6_set_option(HW6_Context* ctx, const char* option) {
+  ctx->error.msg[0] = '\0';
+  int value = 0;
+  if (strcmp(option, "-Osuper") == 0)
+    ctx->superopt = true;
+  else if (strncmp(option, "-O", 2) == 0) {
+    value = find_opt_level(option + 2);
+    if (value >= 0)
+      ctx->opt_level = (Opt_Level) value;
+  } else if (strncmp(option, "--march=", 8) == 0) {
+    value = find_arch(option + 8);
+    if (value >= 0) {
+      ctx->march = (MIPS_Arch) value;
+      ctx->march_given = true;
+    }
+  } else if (strncmp(option, "--mtune=", 8) == 0) {
+    ctx->tune = find_tune(option + 8);
+    value = (ctx->tune != NULL) ? 0 : -1;
+  } else if (strncmp(option, "--emit=", 7) == 0) {
+    value = -1;
+    for (int i = 0; i < N_EMITS; ++i) {
+      if (strcmp(option + 7, emit_names[i]) == 0) {
+        ctx->emit = (Emit_Format) i;
+        value = 0;
+      }
     }
+  } else if (strcmp(option, "--sched") == 0)
+    ctx->sched = true;
+  else if (strcmp(option, "--noreorder") == 0)
+    ctx->noreorder = true;
+  else if (strcmp(option, "--pipeline") == 0)
+    ctx->pipeline = true;
+  else if (strncmp(option, "--superopt-db=", 14) == 0)
+    value = set_super_db(ctx, option + 14) ? 0 : -1;
+  else if (strncmp(option, "--mem-limit=", 12) == 0)
+    value = parse_size(option + 12, &(ctx->mem_limit)) ? 0 : -1;
+  else {
+    snprintf(ctx->error.msg, ERROR_SIZE, "Unknown option \"%s\"", option);
+    return HW6_UNKNOWN_OPTION;
   }
-  if (debug)
-    printf("\nDebug: Compiling completed!\n");
+
+  if (value < 0) {
+    snprintf(ctx->error.msg, ERROR_SIZE, "Invalid option \"%s\"", option);
+    return HW6_ERROR;
+  }
+  return HW6_OK;
+}
+
+int hw6_compile(HW6_Context* ctx, const char* src, size_t size, char* out, size_t cap, size_t* out_len) {
+  // everything below counts and reports into ctx
+  Stats* outer_stats = use_stats(&(ctx->stats));
+  Error_Buffer* outer_error = error_buffer;
+  error_buffer = &(ctx->error);
+  ctx->error.msg[0] = '\0';
+  *out_len = 0;
+
+  Input in = {src, size, false};
+  Line* lines = NULL;
+  int n_lines = 0;
+  bool stream = false;
+  stats_begin(PHASE_READ);
+  bool fits = plan_memory(ctx, &in, false, false, &stream);
+  if (fits && !stream)
+    lines = split_statements(&in, &n_lines);
+  stats_end(n_lines);
+
+  // output into memory first, its length is only known at the end
+  char* text = NULL;
+  size_t len = 0;
+  int status = HW6_ERROR;
+  FILE* mem = fits ? open_memstream(&text, &len) : NULL;
+  if (mem == NULL) {
+    if (fits)
+      report_error("Out of memory");
+  } else {
+    status = stream ? compile_pipelined(ctx, &in, mem) : compile_lines(ctx, src, lines, n_lines, NULL, NULL, NULL, mem);
+    fclose(mem);
+    if (status == HW6_OK) {
+      *out_len = len;
+      if (len <= cap)
+        memcpy(out, text, len);
+      else {
+        report_error("Output needs %zu bytes, the buffer has %zu", len, cap);
+        status = HW6_NO_SPACE;
+      }
+    }
+    free(text);
+  }
+  counted_free(lines);
+
+  use_stats(outer_stats);
+  error_buffer = outer_error;
+  return status;
+}
+
+const char* hw6_error(const HW6_Context* ctx) {
+  return ctx->error.msg;
+}
+
+void hw6_print_stats(const HW6_Context* ctx, FILE* out, bool json) {
+  print_stats(out, &(ctx->stats), json);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
+#ifndef HW6_NO_MAIN
 int main(int argc, char* argv[]) {
-  // getting debug value
-  if (argc >= 3) {
-    int cmp = strcmp(argv[2], "1");
-    // printf("%d\n", cmp); // TOREMOVE
+  HW6_Context* ctx = hw6_alloc_context();
+  if (ctx == NULL)
+    return 1;
+
+  // getting options, everything else is positional (file, debug, verbose)
+  char* pos_args[3] = {NULL, NULL, NULL};
+  int n_pos = 0;
+  char* state_file = NULL; // incremental mode
+  char* eval_file = NULL;  // --eval-batch: inputs to run the program on
+  char* profile_file = NULL; // --value-profile: divisors seen at run time
+  char* stats_format = NULL; // --stats: human or json
+  unsigned trace_request = 0;
+  bool bad_option = false;
+  char default_state[1]; // state_file of --incremental without a name, until it is named after the input file
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--stats") == 0)
+      stats_format = "human";
+    else if (strncmp(argv[i], "--stats=", 8) == 0)
+      stats_format = argv[i] + 8;
+    else if (strncmp(argv[i], "--trace=", 8) == 0)
+      bad_option |= !parse_trace_categories(argv[i] + 8, &trace_request);
+    else if (strcmp(argv[i], "--incremental") == 0)
+      state_file = default_state; // named after the input file below
+    else if (strncmp(argv[i], "--incremental=", 14) == 0)
+      state_file = argv[i] + 14;
+    else if (strcmp(argv[i], "--eval-batch") == 0 && i + 1 < argc)
+      eval_file = argv[++i];
+    else if (strncmp(argv[i], "--eval-batch=", 13) == 0)
+      eval_file = argv[i] + 13;
+    else if (strcmp(argv[i], "--value-profile") == 0 && i + 1 < argc)
+      profile_file = argv[++i];
+    else if (strncmp(argv[i], "--value-profile=", 16) == 0)
+      profile_file = argv[i] + 16;
+    else {
+      int result = hw6_set_option(ctx, argv[i]); // compiler options
+      if (result == HW6_UNKNOWN_OPTION && n_pos < 3)
+        pos_args[n_pos++] = argv[i];
+      else if (result != HW6_UNKNOWN_OPTION)
+        bad_option |= (result != HW6_OK);
+    }
+  }
+
+  // getting debug value (everything traced)
+  if (n_pos >= 2) {
+    int cmp = strcmp(pos_args[1], "1");
     if (cmp == 0)
-      debug = true;
-    if (argc >= 4) {
-      if (strcmp(argv[3], "1") == 0)
-        verbose = true;
+      trace_request |= TRACE_ALL;
+    if (n_pos >= 3) {
+      if (strcmp(pos_args[2], "1") == 0)
+        trace_request |= TRACE_VERBOSE;
     }
   }
+#ifdef HW6_TRACE
+  trace_mask = trace_request;
+#else
+  if (trace_request != 0)
+    fprintf(stderr, "WARNING: Tracing is not compiled in, build with -DHW6_TRACE\n");
+#endif
   // checking inputs
-  if (debug) {
+  if (TRACE_ON(TRACE_IO)) {
     printf("Debug: argc: %d\n", argc);
     for (int i = 0; i < argc; ++i)
       printf("Debug: argv[%d]: %s\n", i, argv[i]);
     printf("\n");
   }
+  if (n_pos < 1 || bad_option || (stats_format != NULL && strcmp(stats_format, "human") != 0 && strcmp(stats_format, "json") != 0)) {
+    printf("Usage: %s [-O0|-O1|-O2|-Os] [-Osuper [--superopt-db=FILE]] [--incremental[=STATE_FILE]] [--emit=asm|bin|elf]\n"
+           "          [--march=mips1|mips32|mips32r2|mips32r5|mips32r6] [--sched] [--mtune=r3000|r4000|24k|i6400] [--noreorder] [--pipeline]\n"
+           "          [--mem-limit=SIZE[K|M|G]] [--eval-batch INPUTS.csv] [--value-profile PROFILE] [--stats[=human|json]]\n"
+           "          [--trace=lexer,tree,regalloc,codegen,io,all,verbose] FILE [DEBUG] [VERBOSE]\n", argv[0]);
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (state_file != NULL && ctx->opt_level != OPT_0) {
+    printf("ERROR: --incremental only works with -O0\n");
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (state_file != NULL && ctx->pipeline) {
+    printf("ERROR: --incremental does not work with --pipeline\n");
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (eval_file != NULL && ctx->pipeline) {
+    printf("ERROR: --eval-batch does not work with --pipeline\n");
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (profile_file != NULL && (ctx->opt_level != OPT_0 || state_file != NULL || ctx->pipeline)) {
+    printf("ERROR: --value-profile only works with -O0, without --incremental or --pipeline\n");
+    hw6_free_context(ctx);
+    return 1;
+  }
+  char default_state_file[strlen(pos_args[0]) + sizeof(".state")];
+  if (state_file == default_state) {
+    snprintf(default_state_file, sizeof(default_state_file), "%s.state", pos_args[0]);
+    state_file = default_state_file;
+  }
+  if (ctx->superopt && ctx->super_db == NULL && !set_super_db(ctx, SUPER_DEFAULT_DB)) { // shared by everything compiled from here
+    printf("ERROR: Out of memory\n");
+    hw6_free_context(ctx);
+    return 1;
+  }
 
-  // file reading
-  FILE* file = get_file(argv[1]);
-  char** lines = NULL; // string array for storing lines
+  // file reading, errors are printed as they come
+  use_stats(&(ctx->stats));
+  Input in;
+  Line* lines = NULL; // statements, pointing into the input
   int n_lines = 0;
-  parse_file(file, &lines, &n_lines); // parse file into lines stored in string array
-  if (debug) printf("\nDebug: lines: %p\n", lines);
+  bool stream = false; // through the pipeline, which splits as it goes
+  stats_begin(PHASE_READ);
+  if (!read_file(pos_args[0], &in)) {
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (!plan_memory(ctx, &in, state_file != NULL || eval_file != NULL || profile_file != NULL, state_file != NULL, &stream)) {
+    unmap_file(&in);
+    hw6_free_context(ctx);
+    return 1;
+  }
+  if (!stream)
+    lines = read_statements(&in, &n_lines);
+  stats_end(n_lines);
+  TRACE(TRACE_IO, "\nDebug: lines: %p\n", lines);
+
+  // profile of the divisors
+  Value_Profile profile;
+  if (profile_file != NULL && !load_value_profile(profile_file, &profile)) {
+    counted_free(lines);
+    unmap_file(&in);
+    hw6_free_context(ctx);
+    return 1;
+  }
 
-  // parsing and tree making
-  char reg_table[][MAX_TOKEN_SIZE] = {"(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)", "(empty)"}; // register table for storing variable names
-  Equation** eqs = NULL; // equation array for storing equations and expressions
-  make_tree(lines, n_lines, reg_table, &eqs); // convert lines into array-tree hybrid structure
-  // freeing lines array
-  for (int i = 0; i < n_lines; ++i) free(lines[i]);
-  free(lines);
-  
-  if (debug) {
-    printf("\nDebug: eqs: %p\n", eqs);
-    print_tree(eqs, n_lines);
-  }
-
-  // code compiling
-  char** MIPS_code = NULL;
-  int n_MIPS = 0;  // lines of MIPS code (including comments)
-  eqs_to_MIPS(eqs, n_lines, &MIPS_code, &n_MIPS); // compiling function
-  // freeing equation/expression array/tree
-  for (int i = 0; i < n_lines; ++i) free_eq(eqs[i]);
-  free(eqs);
-  
-  // outputting
-  for (int i = 0; i < n_MIPS; ++i)
-    printf("%s\n", MIPS_code[i]);
+  // parsing, compiling and outputting
+  int status = stream ? compile_pipelined(ctx, &in, stdout)
+                      : compile_lines(ctx, in.data, lines, n_lines, state_file, eval_file, (profile_file != NULL) ? &profile : NULL, stdout);
+  if (stats_format != NULL)
+    print_stats(stderr, &(ctx->stats), strcmp(stats_format, "json") == 0);
   
   // memory management / cleaning up
-  if (debug)
-    printf("\nDebug: Freeing memory, cleaning up...\n");
-  for (int i = 0; i < n_MIPS; ++i)
-    free(MIPS_code[i]);
-  free(MIPS_code);
-  if (debug) printf("Debug: Process completed!\n");
-  return 0;	// successful process
-}
\ No newline at end of file
+  TRACE(TRACE_IO, "\nDebug: Freeing memory, cleaning up...\n");
+  counted_free(lines); // lines were kept for the comments
+  if (profile_file != NULL)
+    free_value_profile(&profile);
+  unmap_file(&in);
+  hw6_free_context(ctx);
+  TRACE(TRACE_IO, "Debug: Process completed!\n");
+  return status;	// 0 for a successful process
+}
+#endif
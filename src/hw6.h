@@ -0,0 +1,51 @@
+#ifndef HW6_H
+#define HW6_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// ---------------------------------------------------------------------------
+// compiler library
+//
+// Build hw6.c with -DHW6_NO_MAIN and link it in to compile without a process per file. Everything a
+// compile depends on (options, target, statistics, the error message) lives in its HW6_Context, so
+// any number of threads can compile at the same time as long as each one uses its own context.
+// Tracing (-DHW6_TRACE builds) is the exception and stays process wide.
+//
+//   HW6_Context* ctx = hw6_alloc_context();
+//   hw6_set_option(ctx, "-O2");
+//   if (hw6_compile(ctx, src, size, out, cap, &len) != HW6_OK)
+//     fprintf(stderr, "%s\n", hw6_error(ctx));
+//   hw6_free_context(ctx);
+
+#define HW6_OK 0
+#define HW6_ERROR 1          // see hw6_error
+#define HW6_NO_SPACE 2       // the output did not fit, its length is in *out_len anyway
+#define HW6_UNKNOWN_OPTION 3 // hw6_set_option only
+
+typedef struct HW6_Context HW6_Context;
+
+// context with the defaults of the command line (-O0, --march=mips1, --emit=asm), NULL if out of memory
+HW6_Context* hw6_alloc_context(void);
+void hw6_free_context(HW6_Context* ctx);
+
+// setting an option as written on the command line: -O0|-O1|-O2|-Os, -Osuper, --superopt-db=FILE
+// (none by default here, so every window is searched again; contexts sharing a file may lose each other's
+// new entries when they save at the same time), --march=..., --mtune=..., --emit=asm|bin|elf,
+// --sched, --noreorder, --pipeline (only -O0 assembly streams, anything else is compiled at once),
+// --mem-limit=SIZE[K|M|G]
+int hw6_set_option(HW6_Context* ctx, const char* option);
+
+// compiling size bytes of source into out (cap bytes), *out_len set to the length of the output
+// (assembly text is not NUL terminated)
+int hw6_compile(HW6_Context* ctx, const char* src, size_t size, char* out, size_t cap, size_t* out_len);
+
+// message of the last failed call, "" if none
+const char* hw6_error(const HW6_Context* ctx);
+
+// statistics of all compiles of ctx so far, as for --stats (memory per context in the counted live and
+// peak bytes; process_peak_rss_kb is the resident peak of the whole process, every context included)
+void hw6_print_stats(const HW6_Context* ctx, FILE* out, bool json);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// input file
+//
+// The whole file is mapped (or read in one go where mmap is not available) and split into statements
+// in place: every Line points into the buffer, so there is no copy and no limit on the line length.
+
+typedef struct Input {
+  const char* data;
+  size_t size;
+  bool mapped; // otherwise data was malloc'd
+} Input;
+
+// one statement of the C code, not NUL terminated
+typedef struct Line {
+  const char* str;
+  int len;
+} Line;
+
+// open and map file, false if it cannot be read
+bool map_file(const char* filename, Input* in) {
+  in->data = NULL;
+  in->size = 0;
+  in->mapped = false;
+
+#ifdef HAVE_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  in->size = (size_t) st.st_size;
+  if (in->size > 0) {
+    void* data = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, in->size, MADV_SEQUENTIAL);
+      in->data = (const char*) data;
+      in->mapped = true;
+    }
+  }
+  close(fd);
+  if (in->mapped || in->size == 0)
+    return true;
+#endif
+
+  // reading the whole file instead
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL)
+    return false;
+  size_t cap = 1 << 16;
+  char* data = (char*) counted_malloc(MEM_INPUT, cap);
+  size_t n;
+  in->size = 0;
+  while ((n = fread(data + in->size, 1, cap - in->size, file)) > 0) {
+    in->size += n;
+    if (in->size == cap) {
+      cap *= 2;
+      data = (char*) counted_realloc(MEM_INPUT, data, cap);
+    }
+  }
+  fclose(file);
+  in->data = data;
+  return true;
+}
+
+void unmap_file(Input* in) {
+#ifdef HAVE_MMAP
+  if (in->mapped) {
+    munmap((void*) in->data, in->size);
+    return;
+  }
+#endif
+  counted_free((void*) in->data);
+}
+
+// ---------------------------------------------------------------------------
+// statement splitting
+
+// index of the first ';' or '\n' in p[0, n), n if there is none
+size_t find_boundary(const char* p, const size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i semi32 = _mm256_set1_epi8(';');
+  const __m256i nl32 = _mm256_set1_epi8('\n');
+  for (; i + 32 <= n; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+    unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, semi32), _mm256_cmpeq_epi8(chunk, nl32)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i semi16 = _mm_set1_epi8(';');
+  const __m128i nl16 = _mm_set1_epi8('\n');
+  for (; i + 16 <= n; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+    unsigned mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, semi16), _mm_cmpeq_epi8(chunk, nl16)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < n; ++i) {
+    if (p[i] == ';' || p[i] == '\n')
+      return i;
+  }
+  return n;
+}
+
+bool is_blank(const char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// next statement from *pos on (moving *pos past it), ended by ';' (kept) or a newline, blank ones
+// and ones that are nothing but their ';' (";;", "; ;") are skipped, false at the end of the input
+bool next_statement(const Input* in, size_t* pos, Line* line) {
+  while (*pos < in->size) {
+    size_t start = *pos;
+    size_t end = start + find_boundary(in->data + start, in->size - start);
+    size_t next = end + 1;
+    if (end < in->size && in->data[end] == ';')
+      end++; // keeping the semicolon
+    if (next > in->size)
+      next = in->size;
+    *pos = next;
+
+    // trimming
+    while (start < end && is_blank(in->data[start]))
+      start++;
+    while (end > start && is_blank(in->data[end - 1]))
+      end--;
+
+    if (end > start && !(end - start == 1 && in->data[start] == ';')) {
+      line->str = in->data + start;
+      line->len = (int) (end - start);
+      return true;
+    }
+  }
+  return false;
+}
+
+// splitting the whole input into statements
+Line* split_statements(const Input* in, int* n_lines) {
+  int cap = 1024;
+  Line* lines = (Line*) counted_malloc(MEM_INPUT, cap * sizeof(Line));
+  *n_lines = 0;
+
+  size_t pos = 0;
+  Line line;
+  while (next_statement(in, &pos, &line)) {
+    if (*n_lines == cap) {
+      cap *= 2;
+      lines = (Line*) counted_realloc(MEM_INPUT, lines, cap * sizeof(Line));
+    }
+    lines[(*n_lines)++] = line;
+  }
+  return lines;
+}
+
+// number of statements in the input and the length of the longest one, without keeping them (--mem-limit)
+int count_statements(const Input* in, int* longest) {
+  int n = 0;
+  *longest = 0;
+  size_t pos = 0;
+  Line line;
+  while (next_statement(in, &pos, &line)) {
+    n++;
+    if (line.len > *longest)
+      *longest = line.len;
+  }
+  return n;
+}
+
+// ---------------------------------------------------------------------------
+// replacing files
+//
+// The --incremental state and the superoptimizer database are written to a temporary file of their
+// own next to the real one (mkstemp, so threads and processes never share one) and renamed over it,
+// so a reader never sees half of one.
+
+// temporary file for replacing filename, its name in *tmp_name (for replace_file), NULL if it cannot
+// be created
+FILE* open_replacement(const char* filename, char** tmp_name) {
+  size_t size = strlen(filename) + sizeof(".XXXXXX");
+  *tmp_name = (char*) counted_malloc(MEM_CACHE, size);
+  if (*tmp_name == NULL)
+    return NULL;
+  snprintf(*tmp_name, size, "%s.XXXXXX", filename);
+  int fd = mkstemp(*tmp_name);
+  FILE* file = (fd >= 0) ? fdopen(fd, "w") : NULL;
+  if (file == NULL) {
+    if (fd >= 0) {
+      close(fd);
+      remove(*tmp_name);
+    }
+    counted_free(*tmp_name);
+    *tmp_name = NULL;
+    return NULL;
+  }
+  fchmod(fd, 0644); // mkstemp makes it 0600
+  return file;
+}
+
+// closing file and putting it in place of filename, false (and the temporary file removed) if that fails
+bool replace_file(FILE* file, char* tmp_name, const char* filename) {
+  bool ok = (fclose(file) == 0) && rename(tmp_name, filename) == 0;
+  if (!ok)
+    remove(tmp_name);
+  counted_free(tmp_name);
+  return ok;
+}
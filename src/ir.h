@@ -0,0 +1,1022 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ---------------------------------------------------------------------------
+// SSA IR (-O1 and up)
+//
+// The whole program becomes a list of values, each computed once from earlier ones, and a statement
+// only binds its variable to one of them. A variable read before it is assigned is an input, the
+// value its $s register starts with. Passes rewrite values in place, a value found to be the same
+// as another one becomes a copy of it. Arithmetic is taken as wrapping and free of side effects, so
+// values nothing depends on are not computed at all.
+
+#define IR_CONST 'k' // imm
+#define IR_INPUT 'i' // imm: register of the variable
+#define IR_COPY  '=' // a
+#define IR_DEAD  'x' // no longer needed
+#define IR_NEG   'n' // -a
+#define IR_SHL   '<' // a << imm
+#define IR_SRA   '>' // a >> imm (arithmetic)
+#define IR_SRL   'r' // a >> imm (logical)
+#define IR_AND   '&' // a & imm (imm fits andi)
+// + - * / %: a op b, or a op imm if b < 0
+
+// src of a + or - that a pass put together from several of the C code (counted as + by --stats):
+// its partial results need not be any the C code computes, so it wraps instead of trapping
+#define IR_SRC_WRAP 'w'
+
+typedef struct IR_Value {
+  char op;
+  char src;  // operator of the C code it comes from (for --stats)
+  int32_t a; // operands (value ids), -1 if unused
+  int32_t b;
+  int32_t imm;
+} IR_Value;
+
+typedef struct IR_Stmt {
+  int32_t value; // value the variable is bound to
+  uint8_t rd;    // register of the variable
+  bool live;     // the register has to hold the value afterwards
+} IR_Stmt;
+
+typedef struct IR_Program {
+  IR_Value* values; // operands always come before the values using them
+  int n_values;
+  int cap;
+  IR_Stmt* stmts; // one per line of C code
+  int n_stmts;
+  int input[8];   // value of each variable before its first assignment, -1 if it is never read
+} IR_Program;
+
+void init_IR(IR_Program* prog, const int n_stmts) {
+  prog->values = NULL;
+  prog->n_values = 0;
+  prog->cap = 0;
+  prog->stmts = (IR_Stmt*) counted_malloc(MEM_TREE, n_stmts * sizeof(IR_Stmt));
+  prog->n_stmts = n_stmts;
+  for (int i = 0; i < 8; ++i)
+    prog->input[i] = -1;
+}
+
+void free_IR(IR_Program* prog) {
+  counted_free(prog->values);
+  counted_free(prog->stmts);
+}
+
+// appending a value, returns its id
+int IR_add(IR_Program* prog, const char op, const char src, const int32_t a, const int32_t b, const int32_t imm) {
+  if (prog->n_values == prog->cap) {
+    prog->cap = (prog->cap == 0) ? 256 : 2 * prog->cap;
+    prog->values = (IR_Value*) counted_realloc(MEM_TREE, prog->values, prog->cap * sizeof(IR_Value));
+  }
+  IR_Value* val = &(prog->values[prog->n_values]);
+  val->op = op;
+  val->src = src;
+  val->a = a;
+  val->b = b;
+  val->imm = imm;
+  return prog->n_values++;
+}
+
+bool IR_binary(const char op) {
+  return op == '+' || op == '-' || op == '*' || op == '/' || op == '%';
+}
+
+// value v stands for, following copies
+int IR_resolve(const IR_Program* prog, int v) {
+  while (prog->values[v].op == IR_COPY)
+    v = prog->values[v].a;
+  return v;
+}
+
+void IR_set_const(IR_Value* val, const int32_t c) {
+  val->op = IR_CONST;
+  val->a = -1;
+  val->b = -1;
+  val->imm = c;
+}
+
+void IR_set_copy(IR_Value* val, const int32_t a) {
+  val->op = IR_COPY;
+  val->a = a;
+  val->b = -1;
+  val->imm = 0;
+}
+
+void IR_set_unary(IR_Value* val, const char op, const int32_t a, const int32_t imm) {
+  val->op = op;
+  val->a = a;
+  val->b = -1;
+  val->imm = imm;
+}
+
+// ---------------------------------------------------------------------------
+// building
+
+// current value of variable reg, binding holds the value of every variable so far (-1 if unassigned)
+int IR_var(IR_Program* prog, int* binding, const int reg) {
+  int var = reg - REG_S(0);
+  if (binding[var] < 0)
+    binding[var] = prog->input[var] = IR_add(prog, IR_INPUT, '=', -1, -1, reg);
+  return binding[var];
+}
+
+// value of the chain of eq
+int IR_build_chain(IR_Program* prog, int* binding, Equation* eq) {
+  int v = IR_var(prog, binding, eq->rs);
+  for (int i = 0; i < eq->n_ops; ++i) {
+    const char op = eq->ops[i];
+    stats_op(op, 0); // instructions are counted while compiling
+    if (eq->kinds[i] == OPERAND_CONST)
+      v = IR_add(prog, op, op, v, -1, eq->operands[i]);
+    else
+      v = IR_add(prog, op, op, v, IR_var(prog, binding, eq->operands[i]), 0);
+  }
+  return v;
+}
+
+// turning the equations into the IR of the whole program
+void build_IR(Equation** eqs, const int n_eqs, IR_Program* prog) {
+  init_IR(prog, n_eqs);
+  int binding[8];
+  for (int i = 0; i < 8; ++i)
+    binding[i] = -1;
+  for (int i = 0; i < n_eqs; ++i) {
+    Equation* eq = eqs[i];
+    IR_Stmt* stmt = &(prog->stmts[i]);
+    if (eq->n_ops == 0) {
+      stmt->value = IR_add(prog, IR_CONST, '=', -1, -1, eq->im);
+      stats_op('=', 0);
+    } else
+      stmt->value = IR_build_chain(prog, binding, eq);
+    stmt->rd = eq->rd;
+    stmt->live = true;
+    binding[eq->rd - REG_S(0)] = stmt->value;
+  }
+}
+
+void print_IR(const IR_Program* prog) {
+  for (int i = 0; i < prog->n_values; ++i) {
+    const IR_Value* val = &(prog->values[i]);
+    switch (val->op) {
+      case IR_DEAD:
+        continue;
+      case IR_CONST:
+        printf("  v%d = %d\n", i, val->imm);
+        break;
+      case IR_INPUT:
+        printf("  v%d = $s%d\n", i, val->imm - REG_S(0));
+        break;
+      case IR_COPY:
+        printf("  v%d = v%d\n", i, val->a);
+        break;
+      case IR_NEG:
+        printf("  v%d = -v%d\n", i, val->a);
+        break;
+      case IR_SHL: case IR_SRA: case IR_SRL:
+        printf("  v%d = v%d %s %d\n", i, val->a, (val->op == IR_SHL) ? "<<" : (val->op == IR_SRA) ? ">>" : ">>>", val->imm);
+        break;
+      case IR_AND:
+        printf("  v%d = v%d & %d\n", i, val->a, val->imm);
+        break;
+      default:
+        if (val->b < 0)
+          printf("  v%d = v%d %c %d\n", i, val->a, val->op, val->imm);
+        else
+          printf("  v%d = v%d %c v%d\n", i, val->a, val->op, val->b);
+    }
+  }
+  for (int i = 0; i < prog->n_stmts; ++i)
+    printf("  %d: $s%d = v%d%s\n", i, prog->stmts[i].rd - REG_S(0), prog->stmts[i].value, prog->stmts[i].live ? "" : " (dead)");
+}
+
+// ---------------------------------------------------------------------------
+// constant folding
+
+int32_t wrap_add(const int32_t x, const int32_t y) {
+  return (int32_t) ((uint32_t) x + (uint32_t) y);
+}
+
+int32_t wrap_sub(const int32_t x, const int32_t y) {
+  return (int32_t) ((uint32_t) x - (uint32_t) y);
+}
+
+int32_t wrap_mul(const int32_t x, const int32_t y) {
+  return (int32_t) ((uint32_t) x * (uint32_t) y);
+}
+
+// x op y (+, - or *) on constants without wrapping, false if the result does not fit in 32 bits
+bool exact_eval(const char op, const int32_t x, const int32_t y, int32_t* r) {
+  const int64_t e = (op == '+') ? (int64_t) x + y : (op == '-') ? (int64_t) x - y : (int64_t) x * y;
+  if (e < INT32_MIN || e > INT32_MAX)
+    return false;
+  *r = (int32_t) e;
+  return true;
+}
+
+// x op y on constants (y is the shift for shifts), false if the result is undefined
+bool IR_eval(const char op, const int32_t x, const int32_t y, int32_t* r) {
+  switch (op) {
+    case '+': *r = wrap_add(x, y); return true;
+    case '-': *r = wrap_sub(x, y); return true;
+    case '*': *r = wrap_mul(x, y); return true;
+    case '/': case '%':
+      if (y == 0 || (x == INT32_MIN && y == -1))
+        return false;
+      *r = (op == '/') ? x / y : x % y;
+      return true;
+    case IR_NEG: *r = wrap_sub(0, x); return true;
+    case IR_SHL: *r = (int32_t) ((uint32_t) x << y); return true;
+    case IR_SRA: *r = (x < 0) ? ~(~x >> y) : x >> y; return true;
+    case IR_SRL: *r = (int32_t) ((uint32_t) x >> y); return true;
+    case IR_AND: *r = x & y; return true;
+  }
+  return false;
+}
+
+// one simplification of val, false if there is none
+bool fold_value(IR_Program* prog, IR_Value* val) {
+  const IR_Value* values = prog->values;
+  if (val->op == IR_CONST || val->op == IR_INPUT || val->op == IR_COPY || val->op == IR_DEAD)
+    return false;
+
+  // constant operands go into imm: the right one, or the left one of + and *
+  if (IR_binary(val->op) && val->b >= 0) {
+    if (values[val->b].op == IR_CONST) {
+      val->imm = values[val->b].imm;
+      val->b = -1;
+      return true;
+    }
+    if ((val->op == '+' || val->op == '*') && values[val->a].op == IR_CONST) {
+      val->imm = values[val->a].imm;
+      val->a = val->b;
+      val->b = -1;
+      return true;
+    }
+  }
+
+  const IR_Value* x = &(values[val->a]);
+  int32_t r;
+  if (x->op == IR_CONST && (!IR_binary(val->op) || val->b < 0) && IR_eval(val->op, x->imm, val->imm, &r)) {
+    IR_set_const(val, r);
+    return true;
+  }
+
+  switch (val->op) {
+    case '+':
+      if (val->b >= 0)
+        return false;
+      if (val->imm == 0) {
+        IR_set_copy(val, val->a);
+        return true;
+      }
+      if (x->op == '+' && x->b < 0 && exact_eval('+', x->imm, val->imm, &r)) { // (x + c1) + c2
+        val->imm = r;
+        val->a = x->a;
+        return true;
+      }
+      return false;
+
+    case '-':
+      if (val->b < 0 && val->imm != INT32_MIN) { // x - c is x + -c
+        val->op = '+';
+        val->imm = wrap_sub(0, val->imm);
+        return true;
+      }
+      if (val->a == val->b) {
+        IR_set_const(val, 0);
+        return true;
+      }
+      if (x->op == IR_CONST && x->imm == 0) {
+        IR_set_unary(val, IR_NEG, val->b, 0);
+        return true;
+      }
+      return false;
+
+    case '*':
+      if (val->b >= 0)
+        return false;
+      if (val->imm == 0)
+        IR_set_const(val, 0);
+      else if (val->imm == 1)
+        IR_set_copy(val, val->a);
+      else if (val->imm == -1)
+        IR_set_unary(val, IR_NEG, val->a, 0);
+      else if (x->op == '*' && x->b < 0 && exact_eval('*', x->imm, val->imm, &r)) { // (x * c1) * c2
+        val->imm = r;
+        val->a = x->a;
+      } else
+        return false;
+      return true;
+
+    case '/':
+      if (val->b >= 0 || (val->imm != 1 && val->imm != -1))
+        return false;
+      if (val->imm == 1)
+        IR_set_copy(val, val->a);
+      else
+        IR_set_unary(val, IR_NEG, val->a, 0);
+      return true;
+
+    case '%':
+      if (val->b >= 0 || (val->imm != 1 && val->imm != -1))
+        return false;
+      IR_set_const(val, 0);
+      return true;
+
+    case IR_NEG:
+      if (x->op != IR_NEG)
+        return false;
+      IR_set_copy(val, x->a);
+      return true;
+
+    case IR_SHL: case IR_SRA: case IR_SRL:
+      if (val->imm == 0) {
+        IR_set_copy(val, val->a);
+        return true;
+      }
+      if (x->op == val->op && x->imm + val->imm < 32) { // shifting twice
+        val->imm += x->imm;
+        val->a = x->a;
+        return true;
+      }
+      return false;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+// passes
+//
+// Every pass returns the number of changes it made. The target is there for the ones that weigh
+// instructions against each other.
+
+typedef struct IR_Target {
+  MIPS_Arch march;
+  const MIPS_Tune* tune;
+  bool size; // -Os: fewer instructions rather than fewer cycles
+} IR_Target;
+
+// folding constants and simplifying x + 0, x * 1, x - x, (x + c1) + c2, ...
+int fold_pass(IR_Program* prog, const IR_Target* target) {
+  (void) target;
+  int changes = 0;
+  for (int i = 0; i < prog->n_values; ++i) {
+    IR_Value* val = &(prog->values[i]);
+    if (val->op == IR_COPY)
+      continue;
+    if (val->a >= 0)
+      val->a = IR_resolve(prog, val->a);
+    if (val->b >= 0)
+      val->b = IR_resolve(prog, val->b);
+    while (fold_value(prog, val))
+      changes++;
+  }
+  return changes;
+}
+
+bool IR_same(const IR_Value* x, const IR_Value* y) {
+  return x->op == y->op && x->a == y->a && x->b == y->b && x->imm == y->imm;
+}
+
+uint32_t IR_hash(const IR_Value* val) {
+  uint32_t h = (uint32_t) val->op * 0x9e3779b1u;
+  h ^= (uint32_t) val->a * 0x85ebca6bu;
+  h ^= (uint32_t) val->b * 0xc2b2ae35u;
+  h ^= (uint32_t) val->imm * 0x27d4eb2fu;
+  return h ^ (h >> 15);
+}
+
+// common subexpressions: a value computed the same way as an earlier one becomes a copy of it
+int cse_pass(IR_Program* prog, const IR_Target* target) {
+  (void) target;
+  int size = 16;
+  while (size < 2 * prog->n_values)
+    size *= 2;
+  int* table = (int*) counted_malloc(MEM_TREE, size * sizeof(int)); // open addressing, -1 marks an empty slot
+  for (int i = 0; i < size; ++i)
+    table[i] = -1;
+
+  int changes = 0;
+  for (int i = 0; i < prog->n_values; ++i) {
+    IR_Value* val = &(prog->values[i]);
+    if (val->op == IR_COPY || val->op == IR_DEAD || val->op == IR_INPUT)
+      continue;
+    if (val->a >= 0)
+      val->a = IR_resolve(prog, val->a);
+    if (val->b >= 0)
+      val->b = IR_resolve(prog, val->b);
+    if ((val->op == '+' || val->op == '*') && val->b >= 0 && val->b < val->a) { // one order for both
+      int32_t a = val->a;
+      val->a = val->b;
+      val->b = a;
+    }
+
+    int slot = (int) (IR_hash(val) & (size - 1));
+    while (table[slot] >= 0 && !IR_same(&(prog->values[table[slot]]), val))
+      slot = (slot + 1) & (size - 1);
+    if (table[slot] >= 0) {
+      IR_set_copy(val, table[slot]);
+      changes++;
+    } else
+      table[slot] = i;
+  }
+  counted_free(table);
+  return changes;
+}
+
+// dead code: only the last assignment of each variable is left at the end of the program, and only
+// the values leading up to those have to be computed
+int dce_pass(IR_Program* prog, const IR_Target* target) {
+  (void) target;
+  int changes = 0;
+  bool assigned[8] = {false};
+  for (int i = prog->n_stmts - 1; i >= 0; --i) {
+    IR_Stmt* stmt = &(prog->stmts[i]);
+    int var = stmt->rd - REG_S(0);
+    if (stmt->value >= 0) // values of dead statements may be gone
+      stmt->value = IR_resolve(prog, stmt->value);
+    bool live = !assigned[var] && stmt->value != prog->input[var]; // still holding its input needs nothing
+    assigned[var] = true;
+    if (stmt->live && !live) {
+      stmt->live = false;
+      changes++;
+    }
+  }
+
+  bool* needed = (bool*) counted_calloc(MEM_TREE, prog->n_values + 1, sizeof(bool));
+  for (int i = 0; i < prog->n_stmts; ++i) {
+    if (prog->stmts[i].live)
+      needed[prog->stmts[i].value] = true;
+  }
+  for (int i = prog->n_values - 1; i >= 0; --i) {
+    IR_Value* val = &(prog->values[i]);
+    if (!needed[i] || val->op == IR_COPY)
+      continue;
+    if (val->a >= 0) {
+      val->a = IR_resolve(prog, val->a);
+      needed[val->a] = true;
+    }
+    if (val->b >= 0) {
+      val->b = IR_resolve(prog, val->b);
+      needed[val->b] = true;
+    }
+  }
+  for (int i = 0; i < prog->n_values; ++i) {
+    IR_Value* val = &(prog->values[i]);
+    if (!needed[i] && val->op != IR_DEAD && val->op != IR_INPUT) {
+      val->op = IR_DEAD;
+      changes++;
+    }
+  }
+  counted_free(needed);
+  return changes;
+}
+
+// cost of multiplying or dividing by the constant c in a register: instructions with -Os, otherwise cycles
+int muldiv_cost(const IR_Target* target, const int32_t c, const bool div) {
+  bool hilo = (target->march == ARCH_MIPS1) || (div && target->march != ARCH_MIPS32R6); // result taken from HI/LO
+  int op = target->size ? 1 : div ? target->tune->div : target->tune->mult;
+  return imm_cost(c) + op + (hilo ? 1 : 0);
+}
+
+// x * c as shifts, additions and subtractions of x, -1 if mult is cheaper
+// c is written in non-adjacent form (signed digits, no two neighbours non-zero), 7 being 8 - 1
+int reduce_mul(IR_Program* out, const int x, const int32_t c, const IR_Target* target) {
+  int8_t digit[33];
+  int64_t m = (c < 0) ? -(int64_t) c : c;
+  int n_terms = 0, n_shifts = 0, n_positive = 0;
+  for (int k = 0; k < 33; ++k) {
+    digit[k] = 0;
+    if (m & 1) {
+      digit[k] = (m & 2) ? -1 : 1;
+      m -= digit[k];
+      if (c < 0)
+        digit[k] = -digit[k];
+      n_terms++;
+      n_shifts += (k > 0);
+      n_positive += (digit[k] > 0);
+    }
+    m >>= 1;
+  }
+  int n_instrs = n_shifts + (n_terms - 1) + ((n_positive == 0) ? 1 : 0);
+  if (n_terms == 0 || digit[32] != 0 || n_instrs > muldiv_cost(target, c, false))
+    return -1;
+
+  // starting from the highest positive term (any term if there is none, negating at the end)
+  int first = -1;
+  for (int k = 31; k >= 0 && first < 0; --k) {
+    if (digit[k] > 0 || (digit[k] != 0 && n_positive == 0))
+      first = k;
+  }
+  int acc = (first == 0) ? x : IR_add(out, IR_SHL, '*', x, -1, first);
+  for (int k = 31; k >= 0; --k) {
+    if (digit[k] == 0 || k == first)
+      continue;
+    int term = (k == 0) ? x : IR_add(out, IR_SHL, '*', x, -1, k);
+    bool add = (digit[k] > 0) || n_positive == 0;
+    acc = IR_add(out, add ? '+' : '-', '*', acc, term, 0);
+  }
+  return (n_positive == 0) ? IR_add(out, IR_NEG, '*', acc, -1, 0) : acc;
+}
+
+// x / c or x % c for c = +-2^k as shifts, -1 if div is cheaper or c is no power of 2
+// negative x get 2^k - 1 added before shifting, so the quotient rounds towards zero like div
+int reduce_div(IR_Program* out, const int x, const int32_t c, const char op, const IR_Target* target) {
+  if (c == INT32_MIN)
+    return -1;
+  uint32_t m = (c < 0) ? -(uint32_t) c : (uint32_t) c;
+  if (m < 2 || (m & (m - 1)) != 0)
+    return -1;
+  int k = __builtin_ctz(m);
+  int n_instrs = ((k == 1) ? 3 : 4) + ((op == '%') ? 2 : (c < 0) ? 1 : 0);
+  if (n_instrs > muldiv_cost(target, c, true))
+    return -1;
+
+  int sign = (k == 1) ? x : IR_add(out, IR_SRA, op, x, -1, 31);
+  int bias = IR_add(out, IR_SRL, op, sign, -1, 32 - k);
+  int q = IR_add(out, IR_SRA, op, IR_add(out, '+', op, x, bias, 0), -1, k);
+  if (op == '%') // sign of the dividend, whatever the sign of c
+    return IR_add(out, '-', op, x, IR_add(out, IR_SHL, op, q, -1, k), 0);
+  return (c < 0) ? IR_add(out, IR_NEG, op, q, -1, 0) : q;
+}
+
+// passes that replace a value by several new ones rebuild the program, so the new values still come
+// before their uses: out gets the values, map[v] the new id of the old value v
+int* begin_rebuild(const IR_Program* prog, IR_Program* out) {
+  out->values = NULL;
+  out->n_values = 0;
+  out->cap = 0;
+  return (int*) counted_malloc(MEM_TREE, (prog->n_values + 1) * sizeof(int));
+}
+
+// making out the values of prog
+void end_rebuild(IR_Program* prog, IR_Program* out, int* map) {
+  for (int i = 0; i < prog->n_stmts; ++i) {
+    if (prog->stmts[i].value >= 0)
+      prog->stmts[i].value = map[prog->stmts[i].value];
+  }
+  for (int i = 0; i < 8; ++i) {
+    if (prog->input[i] >= 0)
+      prog->input[i] = map[prog->input[i]];
+  }
+  counted_free(map);
+  counted_free(prog->values);
+  prog->values = out->values;
+  prog->n_values = out->n_values;
+  prog->cap = out->cap;
+}
+
+// strength reduction: multiplying and dividing by constants with shifts where that is cheaper
+int strength_pass(IR_Program* prog, const IR_Target* target) {
+  IR_Program out;
+  int* map = begin_rebuild(prog, &out);
+  int changes = 0;
+  for (int i = 0; i < prog->n_values; ++i) {
+    IR_Value val = prog->values[i];
+    if (val.op == IR_COPY || val.op == IR_DEAD) {
+      map[i] = (val.op == IR_COPY) ? map[val.a] : -1;
+      continue;
+    }
+    if (val.a >= 0)
+      val.a = map[val.a];
+    if (val.b >= 0)
+      val.b = map[val.b];
+
+    int r = -1;
+    if (val.b < 0 && val.op == '*')
+      r = reduce_mul(&out, val.a, val.imm, target);
+    else if (val.b < 0 && (val.op == '/' || val.op == '%'))
+      r = reduce_div(&out, val.a, val.imm, val.op, target);
+    if (r >= 0)
+      changes++;
+    else
+      r = IR_add(&out, val.op, val.src, val.a, val.b, val.imm);
+    map[i] = r;
+  }
+  end_rebuild(prog, &out, map);
+  return changes;
+}
+
+// ---------------------------------------------------------------------------
+// value ranges and known bits
+//
+// Going forward through the program, every value gets the interval it lies in and the number of
+// its low bits known to be 0. Constants are exact, inputs could be anything, and each operator maps
+// the facts of its operands (an interval that may wrap becomes the full one, the low zero bits
+// survive wrapping). That is enough to know the sign of most values computed from constants, % and
+// shifts, so that
+//   - x / +-2^k needs no rounding fix-up when x >= 0 or x is a multiple of 2^k,
+//   - x % 2^k is a mask when x >= 0 and 0 when x is a multiple of 2^k,
+//   - x % c is x when |x| < |c|,
+//   - a value that can only be one number is a constant (x / c with |x| < |c| for one).
+
+typedef struct IR_Range {
+  int64_t lo;
+  int64_t hi;
+  int tz; // low bits known to be 0, 32 for 0
+} IR_Range;
+
+// [lo, hi], or every 32 bit number if that does not fit
+IR_Range make_range(const int64_t lo, const int64_t hi, const int tz) {
+  IR_Range r = {lo, hi, (tz > 32) ? 32 : (tz < 0) ? 0 : tz};
+  if (lo < INT32_MIN || hi > INT32_MAX) {
+    r.lo = INT32_MIN;
+    r.hi = INT32_MAX;
+  }
+  return r;
+}
+
+IR_Range const_range(const int32_t c) {
+  return make_range(c, c, (c == 0) ? 32 : __builtin_ctz((uint32_t) c));
+}
+
+int64_t min64(const int64_t x, const int64_t y) {
+  return (x < y) ? x : y;
+}
+
+int64_t max64(const int64_t x, const int64_t y) {
+  return (x > y) ? x : y;
+}
+
+int64_t abs64(const int64_t x) {
+  return (x < 0) ? -x : x;
+}
+
+// x >> k rounding down, also for negative x
+int64_t floor_shift(const int64_t x, const int k) {
+  return (x < 0) ? ~(~x >> k) : x >> k;
+}
+
+// range of val from the ranges of the values before it
+IR_Range value_range(const IR_Value* val, const IR_Range* ranges) {
+  if (val->op == IR_CONST)
+    return const_range(val->imm);
+  if (val->op == IR_INPUT || val->op == IR_DEAD)
+    return make_range(INT32_MIN, INT32_MAX, 0);
+  const IR_Range x = ranges[val->a];
+  const IR_Range y = (val->b >= 0) ? ranges[val->b] : const_range(val->imm);
+  const int k = val->imm; // shifts
+
+  switch (val->op) {
+    case IR_COPY:
+      return x;
+    case IR_NEG:
+      return make_range(-x.hi, -x.lo, x.tz);
+    case '+':
+      return make_range(x.lo + y.lo, x.hi + y.hi, (x.tz < y.tz) ? x.tz : y.tz);
+    case '-':
+      return make_range(x.lo - y.hi, x.hi - y.lo, (x.tz < y.tz) ? x.tz : y.tz);
+    case '*': {
+      int64_t p[4] = {x.lo * y.lo, x.lo * y.hi, x.hi * y.lo, x.hi * y.hi};
+      return make_range(min64(min64(p[0], p[1]), min64(p[2], p[3])), max64(max64(p[0], p[1]), max64(p[2], p[3])), x.tz + y.tz);
+    }
+    case '/': {
+      if (y.lo > y.hi || y.lo == 0 || y.hi == 0) // no divisor known to be nonzero at either end
+        return make_range(INT32_MIN, INT32_MAX, 0);
+      if (y.lo < 0 && y.hi > 0) { // the quotient is no larger than the dividend
+        int64_t m = max64(abs64(x.lo), abs64(x.hi));
+        return make_range(-m, m, 0);
+      }
+      int64_t q[4] = {x.lo / y.lo, x.lo / y.hi, x.hi / y.lo, x.hi / y.hi}; // monotonic while y keeps its sign
+      return make_range(min64(min64(q[0], q[1]), min64(q[2], q[3])), max64(max64(q[0], q[1]), max64(q[2], q[3])), 0);
+    }
+    case '%': { // smaller than the divisor, with the sign of the dividend
+      int64_t limit = max64(abs64(y.lo), abs64(y.hi)) - 1;
+      if (y.lo > y.hi || limit < 0) // only ever by 0
+        return make_range(INT32_MIN, INT32_MAX, 0);
+      int64_t lo = (x.lo >= 0) ? 0 : max64(x.lo, -limit);
+      int64_t hi = (x.hi <= 0) ? 0 : min64(x.hi, limit);
+      return make_range(lo, hi, (x.tz < y.tz) ? x.tz : y.tz);
+    }
+    case IR_SHL:
+      return make_range(x.lo * ((int64_t) 1 << k), x.hi * ((int64_t) 1 << k), x.tz + k);
+    case IR_SRA:
+      return make_range(floor_shift(x.lo, k), floor_shift(x.hi, k), x.tz - k);
+    case IR_SRL:
+      if (x.lo >= 0)
+        return make_range(x.lo >> k, x.hi >> k, x.tz - k);
+      return make_range(0, (int64_t) (UINT32_MAX >> k), x.tz - k);
+    case IR_AND:
+      return make_range(0, (x.lo >= 0) ? min64(x.hi, val->imm) : val->imm, (x.tz > y.tz) ? x.tz : y.tz);
+  }
+  return make_range(INT32_MIN, INT32_MAX, 0);
+}
+
+// appending a value to out together with its range
+int range_add(IR_Program* out, IR_Range* ranges, const char op, const char src, const int32_t a, const int32_t b, const int32_t imm) {
+  int v = IR_add(out, op, src, a, b, imm);
+  ranges[v] = value_range(&(out->values[v]), ranges);
+  return v;
+}
+
+// val (operands already in out) in fewer instructions from what is known about its operands, -1 if
+// nothing is
+int reduce_range(IR_Program* out, IR_Range* ranges, const IR_Value* val) {
+  IR_Range r = value_range(val, ranges);
+  if (r.lo == r.hi && val->op != IR_CONST)
+    return range_add(out, ranges, IR_CONST, val->src, -1, -1, (int32_t) r.lo);
+  if (val->op != '/' && val->op != '%')
+    return -1;
+
+  const IR_Range x = ranges[val->a];
+  const IR_Range y = (val->b >= 0) ? ranges[val->b] : const_range(val->imm);
+  if (val->op == '%' && (y.lo > 0 || y.hi < 0) && max64(abs64(x.lo), abs64(x.hi)) < min64(abs64(y.lo), abs64(y.hi)))
+    return val->a; // smaller than the divisor
+
+  // by +-2^k
+  if (val->b >= 0 || val->imm == INT32_MIN)
+    return -1;
+  uint32_t m = (val->imm < 0) ? -(uint32_t) val->imm : (uint32_t) val->imm;
+  if (m < 2 || (m & (m - 1)) != 0)
+    return -1;
+  int k = __builtin_ctz(m);
+  bool exact = (x.tz >= k);
+  if (val->op == '/') {
+    if (!exact && x.lo < 0)
+      return -1;
+    int q = range_add(out, ranges, IR_SRA, '/', val->a, -1, k);
+    return (val->imm < 0) ? range_add(out, ranges, IR_NEG, '/', q, -1, 0) : q;
+  }
+  if (exact)
+    return range_add(out, ranges, IR_CONST, '%', -1, -1, 0);
+  if (x.lo < 0)
+    return -1;
+  if (k <= 16) // the mask fits andi
+    return range_add(out, ranges, IR_AND, '%', val->a, -1, (int32_t) (m - 1));
+  int high = range_add(out, ranges, IR_SHL, '%', val->a, -1, 32 - k);
+  return range_add(out, ranges, IR_SRL, '%', high, -1, 32 - k);
+}
+
+// using the ranges to drop sign fix-ups, see above
+int range_pass(IR_Program* prog, const IR_Target* target) {
+  (void) target;
+  IR_Program out;
+  int* map = begin_rebuild(prog, &out);
+  IR_Range* ranges = (IR_Range*) counted_malloc(MEM_TREE, (2 * prog->n_values + 1) * sizeof(IR_Range)); // at most 2 new values for one
+  int changes = 0;
+  for (int i = 0; i < prog->n_values; ++i) {
+    IR_Value val = prog->values[i];
+    if (val.op == IR_COPY || val.op == IR_DEAD) {
+      map[i] = (val.op == IR_COPY) ? map[val.a] : -1;
+      continue;
+    }
+    if (val.a >= 0)
+      val.a = map[val.a];
+    if (val.b >= 0)
+      val.b = map[val.b];
+
+    int r = reduce_range(&out, ranges, &val);
+    if (r >= 0)
+      changes++;
+    else
+      r = range_add(&out, ranges, val.op, val.src, val.a, val.b, val.imm);
+    map[i] = r;
+  }
+  if (TRACE_ON(TRACE_CODEGEN | TRACE_VERBOSE)) {
+    printf("Debug: ranges:\n");
+    for (int i = 0; i < out.n_values; ++i)
+      printf("  v%d: [%lld, %lld], %d low bits 0\n", i, (long long) ranges[i].lo, (long long) ranges[i].hi, ranges[i].tz);
+  }
+  counted_free(ranges);
+  end_rebuild(prog, &out, map);
+  return changes;
+}
+
+// ---------------------------------------------------------------------------
+// tree height reduction
+//
+// A chain is built left-deep, so every operation of a + b + c + d waits for the one before. A chain
+// of + and - (or of *) whose inner values are used nowhere else is taken apart into its terms and
+// put back together as a balanced tree, ((a + b) + (c + d)), whose halves do not wait for each
+// other. Subtracted terms are summed up on their own and subtracted once, and the constants become
+// a single one added (multiplied) last. Wrapping arithmetic is associative, so the value stays the
+// same; the new partial sums are not the ones of the C code, so they wrap (IR_SRC_WRAP) rather than
+// trap on an overflow the program would not have.
+//
+// Every level of the tree holds one more partial result in a register while the other half is
+// computed. Past BALANCE_LEVELS levels, the terms are first combined in serial runs (one register
+// each), and only the runs are balanced.
+
+#define BALANCE_LEVELS 3
+
+// chains the value belongs to: '+' (+ and -), '*', 0 for none
+char balance_family(const IR_Value* val) {
+  if (val->op == '+' || (val->op == '-' && val->b >= 0))
+    return '+';
+  return (val->op == '*') ? '*' : 0;
+}
+
+// src of the values balance_terms builds for family op
+char balance_src(const char op) {
+  return (op == '+') ? IR_SRC_WRAP : op;
+}
+
+// terms t[0..n-1] combined with op, left-deep within each run and balanced across the runs
+int balance_terms(IR_Program* out, const int* t, const int n, const char op, const int n_runs) {
+  if (n_runs == 1) {
+    int acc = t[0];
+    for (int i = 1; i < n; ++i)
+      acc = IR_add(out, op, balance_src(op), acc, t[i], 0);
+    return acc;
+  }
+  int half = n_runs / 2;
+  int split = (int) ((int64_t) n * half / n_runs);
+  int a = balance_terms(out, t, split, op, half);
+  int b = balance_terms(out, t + split, n - split, op, n_runs - half);
+  return IR_add(out, op, balance_src(op), a, b, 0);
+}
+
+// height of balance_terms
+int balance_height(const int n, const int n_runs) {
+  int levels = 0;
+  while ((1 << levels) < n_runs)
+    levels++;
+  return (n + n_runs - 1) / n_runs - 1 + levels;
+}
+
+// runs for n terms, at most 2^BALANCE_LEVELS and at least 2 terms each
+int balance_runs(const int n) {
+  int n_runs = n / 2;
+  if (n_runs > (1 << BALANCE_LEVELS))
+    n_runs = 1 << BALANCE_LEVELS;
+  return (n_runs < 1) ? 1 : n_runs;
+}
+
+// rebalancing the chains, see above
+int balance_pass(IR_Program* prog, const IR_Target* target) {
+  (void) target;
+  const int n = prog->n_values;
+  int* uses = (int*) counted_calloc(MEM_TREE, n + 1, sizeof(int));
+  char* user = (char*) counted_calloc(MEM_TREE, n + 1, sizeof(char)); // family of the last value using it
+  for (int i = 0; i < n; ++i) {
+    IR_Value* val = &(prog->values[i]);
+    if (val->op == IR_COPY || val->op == IR_DEAD)
+      continue;
+    if (val->a >= 0) {
+      uses[IR_resolve(prog, val->a)]++;
+      user[IR_resolve(prog, val->a)] = balance_family(val);
+    }
+    if (val->b >= 0) {
+      uses[IR_resolve(prog, val->b)]++;
+      user[IR_resolve(prog, val->b)] = balance_family(val);
+    }
+  }
+  for (int i = 0; i < prog->n_stmts; ++i) {
+    if (prog->stmts[i].live && prog->stmts[i].value >= 0)
+      uses[IR_resolve(prog, prog->stmts[i].value)]++;
+  }
+
+  IR_Program out;
+  int* map = begin_rebuild(prog, &out);
+  int* stack = (int*) counted_malloc(MEM_TREE, 3 * (n + 1) * sizeof(int)); // value, sign, depth
+  int* plus = (int*) counted_malloc(MEM_TREE, (n + 1) * sizeof(int));      // terms (new ids)
+  int* minus = (int*) counted_malloc(MEM_TREE, (n + 1) * sizeof(int));
+  int* inner = (int*) counted_malloc(MEM_TREE, (n + 1) * sizeof(int));     // values taken apart
+  int changes = 0;
+  for (int i = 0; i < n; ++i) {
+    IR_Value val = prog->values[i];
+    if (val.op == IR_COPY || val.op == IR_DEAD) {
+      map[i] = (val.op == IR_COPY) ? map[val.a] : -1;
+      continue;
+    }
+    const int a = (val.a >= 0) ? IR_resolve(prog, val.a) : -1;
+    const int b = (val.b >= 0) ? IR_resolve(prog, val.b) : -1;
+    map[i] = IR_add(&out, val.op, val.src, (a >= 0) ? map[a] : -1, (b >= 0) ? map[b] : -1, val.imm);
+    const char family = balance_family(&val);
+    if (family == 0)
+      continue;
+
+    // taking the chain apart, unless its value is only an operand of a longer one
+    if (uses[i] == 1 && user[i] == family)
+      continue;
+    int n_stack = 0, n_plus = 0, n_minus = 0, n_inner = 0, height = 0;
+    int32_t con = (family == '*') ? 1 : 0;
+    bool exact = true; // con is the product or sum of the constants, not wrapped
+    stack[n_stack++] = i; stack[n_stack++] = 1; stack[n_stack++] = 0;
+    while (n_stack > 0) {
+      const int depth = stack[--n_stack];
+      const int sign = stack[--n_stack];
+      const int v = stack[--n_stack];
+      const IR_Value* x = &(prog->values[v]);
+      if (v != i && (balance_family(x) != family || uses[v] != 1)) { // a term
+        if (x->op == IR_CONST)
+          exact = exact && exact_eval((family == '*') ? '*' : (sign > 0) ? '+' : '-', con, x->imm, &con);
+        else if (sign > 0)
+          plus[n_plus++] = map[v];
+        else
+          minus[n_minus++] = map[v];
+        continue;
+      }
+      inner[n_inner++] = v;
+      height = (depth + 1 > height) ? depth + 1 : height;
+      if (x->b < 0) // constant operand
+        exact = exact && exact_eval((family == '*') ? '*' : (sign > 0) ? '+' : '-', con, x->imm, &con);
+      else { // the left operand on top, the terms keep their order
+        stack[n_stack++] = IR_resolve(prog, x->b); stack[n_stack++] = (x->op == '-') ? -sign : sign; stack[n_stack++] = depth + 1;
+      }
+      stack[n_stack++] = IR_resolve(prog, x->a); stack[n_stack++] = sign; stack[n_stack++] = depth + 1;
+    }
+    const bool has_con = (family == '*') ? con != 1 : con != 0;
+    int new_height = balance_height(n_plus, balance_runs(n_plus));
+    if (n_minus > 0) {
+      int h = balance_height(n_minus, balance_runs(n_minus));
+      new_height = ((h > new_height) ? h : new_height) + 1;
+    }
+    new_height += has_con ? 1 : 0;
+    if (n_plus == 0 || new_height >= height || !exact)
+      continue;
+
+    TRACE(TRACE_CODEGEN, "Debug: balancing v%d: %d terms, height %d -> %d\n", i, n_plus + n_minus, height, new_height);
+    int r = balance_terms(&out, plus, n_plus, family, balance_runs(n_plus));
+    if (n_minus > 0)
+      r = IR_add(&out, '-', IR_SRC_WRAP, r, balance_terms(&out, minus, n_minus, '+', balance_runs(n_minus)), 0);
+    if (has_con)
+      r = IR_add(&out, family, balance_src(family), r, -1, con);
+    for (int j = 0; j < n_inner; ++j) // only used by the chain
+      out.values[map[inner[j]]].op = IR_DEAD;
+    map[i] = r;
+    changes++;
+  }
+  counted_free(uses);
+  counted_free(user);
+  counted_free(stack);
+  counted_free(plus);
+  counted_free(minus);
+  counted_free(inner);
+  end_rebuild(prog, &out, map);
+  return changes;
+}
+
+// ---------------------------------------------------------------------------
+// pass manager (-O)
+
+typedef struct IR_Pass {
+  const char* name;
+  int (*run)(IR_Program* prog, const IR_Target* target);
+} IR_Pass;
+
+const IR_Pass IR_passes[] = {
+  {"fold",     fold_pass},
+  {"cse",      cse_pass},
+  {"strength", strength_pass},
+  {"range",    range_pass},
+  {"balance",  balance_pass},
+  {"dce",      dce_pass}
+};
+
+#define N_IR_PASSES ((int) (sizeof(IR_passes) / sizeof(IR_passes[0])))
+
+typedef enum Opt_Level {
+  OPT_0,
+  OPT_1,
+  OPT_2,
+  OPT_S,
+  N_OPT_LEVELS
+} Opt_Level;
+
+const char* opt_level_names[N_OPT_LEVELS] = {"0", "1", "2", "s"};
+
+// passes of every level in order, -O0 compiles the equations directly
+const char* opt_pipelines[N_OPT_LEVELS] = {
+  "",
+  "fold,cse,dce",
+  "fold,cse,dce,balance,range,strength,fold,cse,dce",
+  "fold,cse,range,strength,fold,cse,dce"
+};
+
+// optimization level by name ("2" for -O2), -1 if unknown
+int find_opt_level(const char* name) {
+  for (int i = 0; i < N_OPT_LEVELS; ++i) {
+    if (strcmp(opt_level_names[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// running the comma separated list of passes in order, timing each of them
+void run_passes(IR_Program* prog, const char* pipeline, const IR_Target* target) {
+  if (TRACE_ON(TRACE_CODEGEN | TRACE_VERBOSE)) {
+    printf("\nDebug: IR:\n");
+    print_IR(prog);
+  }
+  while (*pipeline != '\0') {
+    int len = (int) strcspn(pipeline, ",");
+    for (int i = 0; i < N_IR_PASSES; ++i) {
+      if ((int) strlen(IR_passes[i].name) != len || strncmp(pipeline, IR_passes[i].name, len) != 0)
+        continue;
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      int changes = IR_passes[i].run(prog, target);
+      stats_pass(IR_passes[i].name, seconds_since(&start), changes);
+      TRACE(TRACE_CODEGEN, "Debug: pass %s: %d changes\n", IR_passes[i].name, changes);
+      if (TRACE_ON(TRACE_CODEGEN | TRACE_VERBOSE))
+        print_IR(prog);
+    }
+    pipeline += (pipeline[len] == ',') ? len + 1 : len;
+  }
+}
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------------------
+// tokens
+//
+// Tokens point into the source buffer (offset and length), nothing is copied. Numbers are parsed and
+// range checked while scanning, so nobody has to look at their characters again. All state lives in
+// the Lexer, so any number of them can run at the same time.
+
+typedef enum Token_Kind {
+  TOK_END,    // end of the line
+  TOK_NAME,   // variable
+  TOK_NUM,    // constant, value holds it
+  TOK_OP,     // +, -, *, /, %
+  TOK_ASSIGN, // =
+  TOK_ERROR   // constant out of the 32 bit range
+} Token_Kind;
+
+typedef struct Token {
+  Token_Kind kind;
+  int offset; // into the source
+  int length;
+  int32_t value;
+} Token;
+
+typedef struct Lexer {
+  const char* src;
+  int len;
+  int pos;
+} Lexer;
+
+void init_lexer(Lexer* lex, const char* src, const int len) {
+  lex->src = src;
+  lex->len = len;
+  lex->pos = 0;
+}
+
+// spaces and semicolons only separate tokens
+bool is_separator(const char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ';';
+}
+
+Token next_token(Lexer* lex) {
+  const char* src = lex->src;
+  while (lex->pos < lex->len && is_separator(src[lex->pos]))
+    lex->pos++;
+
+  Token tok = {TOK_END, lex->pos, 0, 0};
+  if (lex->pos == lex->len)
+    return tok;
+
+  // scanning the token, parsing it as a number on the way
+  bool neg = (src[lex->pos] == '-');
+  bool numeric = true;
+  bool overflow = false;
+  int64_t value = 0;
+  int end = lex->pos + (neg ? 1 : 0);
+  for (; end < lex->len && !is_separator(src[end]); ++end) {
+    char c = src[end];
+    if (c < '0' || c > '9')
+      numeric = false;
+    else if (numeric && !overflow) {
+      value = 10 * value + (c - '0');
+      overflow = value > (neg ? 2147483648LL : 2147483647LL);
+    }
+  }
+  tok.length = end - lex->pos;
+  lex->pos = end;
+
+  // classifying
+  const char first = src[tok.offset];
+  if (tok.length == 1 && (first == '+' || first == '-' || first == '*' || first == '/' || first == '%'))
+    tok.kind = TOK_OP;
+  else if (tok.length == 1 && first == '=')
+    tok.kind = TOK_ASSIGN;
+  else if (numeric && tok.length > (neg ? 1 : 0)) {
+    tok.kind = overflow ? TOK_ERROR : TOK_NUM;
+    tok.value = (int32_t) (neg ? -value : value);
+  } else
+    tok.kind = TOK_NAME;
+  return tok;
+}
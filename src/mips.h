@@ -0,0 +1,405 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// registers
+//
+// Register ids are the hardware numbers ($zero = 0, $t0-$t7 = 8-15, $s0-$s7 = 16-23, $t8-$t9 = 24-25).
+// Temporaries past $t9 get ids from 32 on, they still print as $t10, $t11, ... but cannot be encoded.
+// The MSA vector registers $w0-$w31 take the last ids, REG_W(0) and up.
+
+#define REG_ZERO 0
+#define REG_S(n) (16 + (n))
+#define REG_W(n) (0xffe0 + (n))
+#define N_REGS 32
+#define N_W_REGS 32
+#define W_LANES 4 // words in a vector register
+
+// register id of temporary $tn
+int t_reg(const int n) {
+  if (n < 8)
+    return 8 + n;
+  return (n < 10) ? 16 + n : 32 + n;
+}
+
+// number of the temporary behind a register id, -1 if it is not a temporary
+int t_num(const int reg) {
+  if (reg >= 8 && reg <= 15)
+    return reg - 8;
+  if (reg == 24 || reg == 25)
+    return reg - 16;
+  if (reg >= 42 && reg < REG_W(0))
+    return reg - 32;
+  return -1;
+}
+
+// register id from a name such as "$s3", -1 if invalid
+int reg_id(const char* name) {
+  if (strcmp(name, "$zero") == 0)
+    return REG_ZERO;
+  if (name[0] != '$' || strchr("stw", name[1]) == NULL || name[2] < '0' || name[2] > '9')
+    return -1;
+  int n = atoi(name + 2);
+  switch (name[1]) {
+    case 's':
+      return (n < 8) ? REG_S(n) : -1;
+    case 'w':
+      return (n < N_W_REGS) ? REG_W(n) : -1;
+  }
+  return t_reg(n);
+}
+
+// ---------------------------------------------------------------------------
+// ISA revisions (--march)
+//
+// mips32 adds mul into a register (still clobbering HI/LO), mips32r6 drops HI/LO altogether for
+// mul/div/mod into registers and removes addi, so constants are added with addiu there. mips32r5
+// selects like mips32r2 and is taken to come with the SIMD architecture (MSA, as on the P5600), for
+// statements packed into vector lanes (see slp_group).
+
+typedef enum MIPS_Arch {
+  ARCH_MIPS1,
+  ARCH_MIPS32,
+  ARCH_MIPS32R2,
+  ARCH_MIPS32R6,
+  ARCH_MIPS32R5,
+  N_ARCHS
+} MIPS_Arch;
+
+const char* MIPS_arch_names[N_ARCHS] = {"mips1", "mips32", "mips32r2", "mips32r6", "mips32r5"};
+
+bool has_msa(const MIPS_Arch march) {
+  return march == ARCH_MIPS32R5;
+}
+
+// ISA revision by name, -1 if unknown
+int find_arch(const char* name) {
+  for (int i = 0; i < N_ARCHS; ++i) {
+    if (strcmp(MIPS_arch_names[i], name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// ---------------------------------------------------------------------------
+// instructions
+
+typedef enum MIPS_Op {
+  OP_COMMENT, // imm: line of the original C code
+  OP_LABEL,   // label
+  OP_ADD,     // rd,rs,rt
+  OP_ADDI,    // rd,rs,imm
+  OP_SUB,     // rd,rs,rt
+  OP_MULT,    // rs,rt
+  OP_DIV,     // rs,rt
+  OP_MFLO,    // rd
+  OP_MFHI,    // rd
+  OP_MOVE,    // rd,rs
+  OP_LI,      // rd,imm
+  OP_LUI,     // rd,imm (upper half)
+  OP_ORI,     // rd,rs,imm (zero extended)
+  OP_SLL,     // rd,rs,imm
+  OP_SRL,     // rd,rs,imm
+  OP_BLTZ,    // rs,label
+  OP_J,       // label
+  OP_NOP,
+  OP_ADDIU,   // rd,rs,imm
+  OP_MUL,     // rd,rs,rt (mips32, HI/LO undefined afterwards)
+  OP_MUL_R6,  // rd,rs,rt
+  OP_DIV_R6,  // rd,rs,rt
+  OP_MOD_R6,  // rd,rs,rt
+  OP_ADDU,    // rd,rs,rt (never traps)
+  OP_SUBU,    // rd,rs,rt (never traps)
+  OP_SRA,     // rd,rs,imm
+  OP_ANDI,    // rd,rs,imm (zero extended)
+  OP_INSERT_W, // rd[imm],rs (MSA: word imm of vector rd = rs)
+  OP_COPY_S_W, // rd,rs[imm] (MSA: rd = word imm of vector rs)
+  OP_FILL_W,   // rd,rs (MSA: every word of vector rd = rs)
+  OP_LDI_W,    // rd,imm (MSA: every word = imm, 10 bits signed)
+  OP_ADDV_W,   // rd,rs,rt (MSA, wrapping)
+  OP_SUBV_W,   // rd,rs,rt (MSA, wrapping)
+  OP_MULV_W,   // rd,rs,rt (MSA, low words of the products)
+  OP_SLLI_W,   // rd,rs,imm (MSA)
+  OP_BNE,      // rs,rt,label
+  N_OPS
+} MIPS_Op;
+
+const char* MIPS_op_names[N_OPS] = {
+  "#", "", "add", "addi", "sub", "mult", "div", "mflo", "mfhi", "move", "li", "lui", "ori", "sll", "srl", "bltz", "j", "nop",
+  "addiu", "mul", "mul", "div", "mod", "addu", "subu", "sra", "andi",
+  "insert.w", "copy_s.w", "fill.w", "ldi.w", "addv.w", "subv.w", "mulv.w", "slli.w",
+  "bne"
+};
+
+typedef struct MIPS_Instr {
+  uint8_t op;
+  uint16_t rd;
+  uint16_t rs;
+  uint16_t rt;
+  int32_t imm;
+  int32_t label;
+} MIPS_Instr;
+
+// flat, growing array of instructions
+typedef struct MIPS_Code {
+  MIPS_Instr* instrs;
+  int n;
+  int cap;
+  bool delay_slots; // every branch is followed by its delay slot instruction (.set noreorder)
+  MIPS_Arch march;              // instructions are selected for this ISA
+  const struct MIPS_Tune* tune; // and costed for this core (see sched.h), set before compiling
+  bool mul_by_cost;             // constant multipliers that are cheaper as mult/mul than shifts on tune go to mult/mul (--march)
+  const struct Value_Profile* profile; // divisors seen at run time (see profile.h), NULL if none
+} MIPS_Code;
+
+void init_MIPS_code(MIPS_Code* code) {
+  code->instrs = NULL;
+  code->n = 0;
+  code->cap = 0;
+  code->delay_slots = false;
+  code->march = ARCH_MIPS1;
+  code->tune = NULL;
+  code->mul_by_cost = false;
+  code->profile = NULL;
+}
+
+void free_MIPS_code(MIPS_Code* code) {
+  counted_free(code->instrs);
+  code->instrs = NULL;
+  code->n = 0;
+  code->cap = 0;
+}
+
+// appending an instruction, unused fields are 0
+void MIPS_emit(MIPS_Code* code, const MIPS_Op op, const int rd, const int rs, const int rt, const int32_t imm, const int label) {
+  if (code->n == code->cap) {
+    code->cap = (code->cap == 0) ? 256 : 2 * code->cap;
+    code->instrs = (MIPS_Instr*) counted_realloc(MEM_CODE, code->instrs, code->cap * sizeof(MIPS_Instr));
+  }
+  MIPS_Instr* instr = &(code->instrs[code->n++]);
+  instr->op = op;
+  instr->rd = rd;
+  instr->rs = rs;
+  instr->rt = rt;
+  instr->imm = imm;
+  instr->label = label;
+}
+
+// ---------------------------------------------------------------------------
+// immediates
+
+// fits the signed 16 bit immediate of addi/addiu
+bool fits_imm16(const int32_t v) {
+  return v >= -32768 && v <= 32767;
+}
+
+// fits the signed 10 bit immediate of ldi
+bool fits_imm10(const int32_t v) {
+  return v >= -512 && v <= 511;
+}
+
+// number of instructions needed to build v in a register
+int imm_cost(const int32_t v) {
+  if (fits_imm16(v) || (v >= 0 && v <= 65535) || (v & 0xffff) == 0)
+    return 1;
+  return 2;
+}
+
+// building v in register rd with the fewest instructions: addiu (as li), ori, lui or lui+ori
+void MIPS_load_imm(MIPS_Code* code, const int rd, const int32_t v) {
+  if (fits_imm16(v))
+    MIPS_emit(code, OP_LI, rd, 0, 0, v, 0);
+  else if (v >= 0 && v <= 65535)
+    MIPS_emit(code, OP_ORI, rd, REG_ZERO, 0, v, 0);
+  else {
+    MIPS_emit(code, OP_LUI, rd, 0, 0, (int32_t) ((uint32_t) v >> 16), 0);
+    if ((v & 0xffff) != 0)
+      MIPS_emit(code, OP_ORI, rd, rd, 0, v & 0xffff, 0);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// formatting
+
+char* put_str(char* p, const char* str) {
+  while (*str != '\0')
+    *(p++) = *(str++);
+  return p;
+}
+
+char* put_int(char* p, const int32_t n) {
+  char digits[12];
+  int n_digits = 0;
+  uint32_t u = (n < 0) ? -(uint32_t) n : (uint32_t) n;
+  do {
+    digits[n_digits++] = '0' + (u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (n < 0)
+    *(p++) = '-';
+  while (n_digits > 0)
+    *(p++) = digits[--n_digits];
+  return p;
+}
+
+char* put_reg(char* p, const int reg) {
+  if (reg == REG_ZERO)
+    return put_str(p, "$zero");
+  if (reg >= REG_S(0) && reg <= REG_S(7)) {
+    *(p++) = '$';
+    *(p++) = 's';
+    return put_int(p, reg - REG_S(0));
+  }
+  if (reg >= REG_W(0)) {
+    *(p++) = '$';
+    *(p++) = 'w';
+    return put_int(p, reg - REG_W(0));
+  }
+  *(p++) = '$';
+  *(p++) = 't';
+  return put_int(p, t_num(reg));
+}
+
+// vector register and word index, as $w1[2]
+char* put_element(char* p, const int reg, const int i) {
+  p = put_reg(p, reg);
+  *(p++) = '[';
+  p = put_int(p, i);
+  *(p++) = ']';
+  return p;
+}
+
+char* put_label(char* p, const int label) {
+  *(p++) = 'L';
+  return put_int(p, label);
+}
+
+// writing one instruction as a line of text (without newline) into buf, returns its length
+// lines is the original C code, for comments (buf must have room for the whole line)
+int MIPS_format(const MIPS_Instr* instr, const Line* lines, char* buf) {
+  char* p = buf;
+  switch (instr->op) {
+    case OP_COMMENT:
+      p = put_str(p, "# ");
+      memcpy(p, lines[instr->imm].str, lines[instr->imm].len);
+      p += lines[instr->imm].len;
+      break;
+
+    case OP_LABEL:
+      p = put_label(p, instr->label);
+      *(p++) = ':';
+      break;
+
+    case OP_NOP:
+      p = put_str(p, "nop");
+      break;
+
+    default:
+      p = put_str(p, MIPS_op_names[instr->op]);
+      *(p++) = ' ';
+      switch (instr->op) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_MUL_R6: case OP_DIV_R6: case OP_MOD_R6: case OP_ADDU: case OP_SUBU:
+        case OP_ADDV_W: case OP_SUBV_W: case OP_MULV_W: // rd,rs,rt
+          p = put_reg(p, instr->rd);
+          *(p++) = ',';
+          p = put_reg(p, instr->rs);
+          *(p++) = ',';
+          p = put_reg(p, instr->rt);
+          break;
+
+        case OP_ADDI: case OP_ADDIU: case OP_ORI: case OP_ANDI: case OP_SLL: case OP_SRL: case OP_SRA: case OP_SLLI_W: // rd,rs,imm
+          p = put_reg(p, instr->rd);
+          *(p++) = ',';
+          p = put_reg(p, instr->rs);
+          *(p++) = ',';
+          p = put_int(p, instr->imm);
+          break;
+
+        case OP_MULT: case OP_DIV: // rs,rt
+          p = put_reg(p, instr->rs);
+          *(p++) = ',';
+          p = put_reg(p, instr->rt);
+          break;
+
+        case OP_MFLO: case OP_MFHI: // rd
+          p = put_reg(p, instr->rd);
+          break;
+
+        case OP_MOVE: case OP_FILL_W: // rd,rs
+          p = put_reg(p, instr->rd);
+          *(p++) = ',';
+          p = put_reg(p, instr->rs);
+          break;
+
+        case OP_INSERT_W: // rd[imm],rs
+          p = put_element(p, instr->rd, instr->imm);
+          *(p++) = ',';
+          p = put_reg(p, instr->rs);
+          break;
+
+        case OP_COPY_S_W: // rd,rs[imm]
+          p = put_reg(p, instr->rd);
+          *(p++) = ',';
+          p = put_element(p, instr->rs, instr->imm);
+          break;
+
+        case OP_LI: case OP_LUI: case OP_LDI_W: // rd,imm
+          p = put_reg(p, instr->rd);
+          *(p++) = ',';
+          p = put_int(p, instr->imm);
+          break;
+
+        case OP_BLTZ: // rs,label
+          p = put_reg(p, instr->rs);
+          *(p++) = ',';
+          p = put_label(p, instr->label);
+          break;
+
+        case OP_BNE: // rs,rt,label
+          p = put_reg(p, instr->rs);
+          *(p++) = ',';
+          p = put_reg(p, instr->rt);
+          *(p++) = ',';
+          p = put_label(p, instr->label);
+          break;
+
+        case OP_J: // label
+          p = put_label(p, instr->label);
+          break;
+      }
+  }
+  *p = '\0';
+  return p - buf;
+}
+
+// writing the whole program as assembly text
+void write_MIPS_asm(FILE* out, MIPS_Code* code, const Line* lines) {
+  char buf[1 << 16];
+  int n_buf = 0;
+  if (code->delay_slots)
+    n_buf += sprintf(buf, ".set noreorder\n");
+  if (has_msa(code->march))
+    n_buf += sprintf(buf + n_buf, ".set msa\n");
+  for (int i = 0; i < code->n; ++i) {
+    MIPS_Instr* instr = &(code->instrs[i]);
+
+    // comments of long lines go out directly
+    if (instr->op == OP_COMMENT && lines[instr->imm].len > MAX_STRING_SIZE) {
+      fwrite(buf, 1, n_buf, out);
+      n_buf = 0;
+      fprintf(out, "# %.*s\n", lines[instr->imm].len, lines[instr->imm].str);
+      continue;
+    }
+
+    if (n_buf > (int) sizeof(buf) - 2 * MAX_STRING_SIZE) {
+      fwrite(buf, 1, n_buf, out);
+      n_buf = 0;
+    }
+    n_buf += MIPS_format(instr, lines, buf + n_buf);
+    buf[n_buf++] = '\n';
+  }
+  fwrite(buf, 1, n_buf, out);
+}
@@ -0,0 +1,146 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// value profiles (--value-profile)
+//
+// The divisors a division by a register was seen with at run time, one division per line:
+//   LINE OP VALUE:COUNT VALUE:COUNT ... [*:COUNT]
+// LINE is the statement and OP the operation in it (both from 1), * counts the divisors not listed.
+// Empty lines and lines starting with # are skipped. A division the profile says is nearly always by
+// the same power of 2 gets a test for it and a shift in front of the div (see MIPS_div).
+
+typedef struct Div_Profile {
+  int line;        // statement, from 0
+  int op;          // operation in its chain, from 0
+  int n;           // divisors listed
+  int32_t* values;
+  long* counts;
+  long total;      // executions, listed divisors or not
+} Div_Profile;
+
+typedef struct Value_Profile {
+  Div_Profile* divs; // by line, then op
+  int n;
+  int cap;
+} Value_Profile;
+
+void init_value_profile(Value_Profile* profile) {
+  profile->divs = NULL;
+  profile->n = 0;
+  profile->cap = 0;
+}
+
+void free_value_profile(Value_Profile* profile) {
+  for (int i = 0; i < profile->n; ++i) {
+    counted_free(profile->divs[i].values);
+    counted_free(profile->divs[i].counts);
+  }
+  counted_free(profile->divs);
+}
+
+int compare_div_profiles(const void* x, const void* y) {
+  const Div_Profile* a = (const Div_Profile*) x;
+  const Div_Profile* b = (const Div_Profile*) y;
+  if (a->line != b->line)
+    return (a->line < b->line) ? -1 : 1;
+  return (a->op > b->op) - (a->op < b->op);
+}
+
+// one line of the file into div, false if it is not LINE OP VALUE:COUNT ...
+bool parse_div_profile(char* text, Div_Profile* div) {
+  div->values = NULL;
+  div->counts = NULL;
+  char* end;
+  long line = strtol(text, &end, 10);
+  long op = (end != text) ? strtol(end, &end, 10) : 0;
+  if (line < 1 || line > INT32_MAX || op < 1 || op > INT32_MAX)
+    return false;
+  div->line = (int) line - 1;
+  div->op = (int) op - 1;
+  div->n = 0;
+  div->total = 0;
+  int cap = 4;
+  div->values = (int32_t*) counted_malloc(MEM_INPUT, cap * sizeof(int32_t));
+  div->counts = (long*) counted_malloc(MEM_INPUT, cap * sizeof(long));
+  for (char* p = end; ; ) {
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '\0' || *p == '\n' || *p == '\r')
+      return div->total > 0;
+    bool other = (*p == '*');
+    long long value = other ? 0 : strtoll(p, &end, 10);
+    if (other)
+      end = p + 1;
+    if (end == p || *end != ':' || value < INT32_MIN || value > INT32_MAX)
+      return false;
+    p = end + 1;
+    long count = strtol(p, &end, 10);
+    if (end == p || count < 0)
+      return false;
+    p = end;
+    div->total += count;
+    if (other)
+      continue;
+    if (div->n == cap) {
+      cap *= 2;
+      div->values = (int32_t*) counted_realloc(MEM_INPUT, div->values, cap * sizeof(int32_t));
+      div->counts = (long*) counted_realloc(MEM_INPUT, div->counts, cap * sizeof(long));
+    }
+    div->values[div->n] = (int32_t) value;
+    div->counts[div->n++] = count;
+  }
+}
+
+// reading filename into profile, false (reported) if it cannot be read or a line is malformed
+bool load_value_profile(const char* filename, Value_Profile* profile) {
+  init_value_profile(profile);
+  FILE* file = fopen(filename, "r");
+  if (file == NULL) {
+    report_error("Cannot read \"%s\"", filename);
+    return false;
+  }
+  char* text = NULL;
+  size_t text_cap = 0;
+  bool ok = true;
+  for (int i_line = 1; ok && getline(&text, &text_cap, file) >= 0; ++i_line) {
+    char* p = text + strspn(text, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+      continue;
+    if (profile->n == profile->cap) {
+      profile->cap = (profile->cap == 0) ? 64 : 2 * profile->cap;
+      profile->divs = (Div_Profile*) counted_realloc(MEM_INPUT, profile->divs, profile->cap * sizeof(Div_Profile));
+    }
+    Div_Profile* div = &(profile->divs[profile->n++]);
+    if (!parse_div_profile(p, div)) {
+      report_error("Expected LINE OP VALUE:COUNT ... (%s, line %d)", filename, i_line);
+      ok = false;
+    }
+  }
+  free(text);
+  fclose(file);
+
+  if (ok) {
+    qsort(profile->divs, profile->n, sizeof(Div_Profile), compare_div_profiles);
+    for (int i = 1; i < profile->n && ok; ++i) {
+      if (compare_div_profiles(&(profile->divs[i - 1]), &(profile->divs[i])) == 0) {
+        report_error("Operation %d of statement %d is listed twice (%s)", profile->divs[i].op + 1, profile->divs[i].line + 1, filename);
+        ok = false;
+      }
+    }
+  }
+  if (!ok)
+    free_value_profile(profile);
+  return ok;
+}
+
+// profile of operation op of statement line, NULL if there is none
+const Div_Profile* find_div_profile(const Value_Profile* profile, const int line, const int op) {
+  if (profile == NULL)
+    return NULL;
+  Div_Profile key = {line, op, 0, NULL, NULL, 0};
+  return (const Div_Profile*) bsearch(&key, profile->divs, profile->n, sizeof(Div_Profile), compare_div_profiles);
+}
@@ -0,0 +1,54 @@
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// ---------------------------------------------------------------------------
+// single producer, single consumer ring (--pipeline)
+//
+// Bounded queue of pointers between two threads, without locks: only the producer moves tail and
+// only the consumer moves head, each publishing its slot with a release store that the other side
+// reads with acquire. head and tail sit on their own cache lines so the two threads do not keep
+// taking the line from each other. A full ring makes the producer wait, which is the back pressure
+// of the pipeline.
+
+#define RING_SIZE 16 // power of 2
+#define CACHE_LINE 64
+
+typedef struct Ring {
+  void* slots[RING_SIZE];
+  _Alignas(CACHE_LINE) atomic_size_t head; // next slot to read
+  _Alignas(CACHE_LINE) atomic_size_t tail; // next slot to write
+} Ring;
+
+void init_ring(Ring* ring) {
+  atomic_init(&(ring->head), 0);
+  atomic_init(&(ring->tail), 0);
+}
+
+// waiting for the other side: spinning briefly, then giving the core away
+void ring_wait(int* spins) {
+  if (++(*spins) > 64)
+    sched_yield();
+}
+
+// appending p, waiting while the ring is full
+void ring_push(Ring* ring, void* p) {
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+  int spins = 0;
+  while (tail - atomic_load_explicit(&(ring->head), memory_order_acquire) == RING_SIZE)
+    ring_wait(&spins);
+  ring->slots[tail & (RING_SIZE - 1)] = p;
+  atomic_store_explicit(&(ring->tail), tail + 1, memory_order_release);
+}
+
+// taking the oldest pointer, waiting while the ring is empty
+void* ring_pop(Ring* ring) {
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+  int spins = 0;
+  while (atomic_load_explicit(&(ring->tail), memory_order_acquire) == head)
+    ring_wait(&spins);
+  void* p = ring->slots[head & (RING_SIZE - 1)];
+  atomic_store_explicit(&(ring->head), head + 1, memory_order_release);
+  return p;
+}
@@ -0,0 +1,320 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// target cores (--mtune)
+//
+// All the scheduler needs to know about a core is how long results take and whether HI/LO reads
+// are interlocked. On the older cores mfhi/mflo followed too closely by mult/div corrupts HI/LO,
+// so they need that many other instructions in between.
+
+typedef struct MIPS_Tune {
+  const char* name;
+  int alu;         // cycles until an ALU result can be used
+  int mult;        // cycles until HI/LO hold a product
+  int div;         // cycles until HI/LO hold quotient and remainder
+  int hilo_hazard; // instructions needed between mfhi/mflo and the next mult/div, 0 if interlocked
+} MIPS_Tune;
+
+const MIPS_Tune MIPS_tunes[] = {
+  {"r3000", 1, 12, 35, 2},
+  {"r4000", 1, 10, 69, 2},
+  {"24k",   1,  5, 34, 0},
+  {"i6400", 1,  4, 26, 0}
+};
+
+#define N_TUNES ((int) (sizeof(MIPS_tunes) / sizeof(MIPS_tunes[0])))
+
+// core assumed for each ISA revision when there is no --mtune
+const char* default_tunes[N_ARCHS] = {"r3000", "24k", "24k", "i6400", "24k"};
+
+// latency model by name, NULL if unknown
+const MIPS_Tune* find_tune(const char* name) {
+  for (int i = 0; i < N_TUNES; ++i) {
+    if (strcmp(MIPS_tunes[i].name, name) == 0)
+      return &(MIPS_tunes[i]);
+  }
+  return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// registers read and written by an instruction, HI and LO count as registers of their own
+
+#define RES_HI (-2)
+#define RES_LO (-3)
+
+typedef struct MIPS_Access {
+  int defs[3];
+  int n_defs;
+  int uses[2];
+  int n_uses;
+} MIPS_Access;
+
+void add_def(MIPS_Access* acc, const int reg) {
+  if (reg != REG_ZERO)
+    acc->defs[acc->n_defs++] = reg;
+}
+
+void add_use(MIPS_Access* acc, const int reg) {
+  if (reg != REG_ZERO)
+    acc->uses[acc->n_uses++] = reg;
+}
+
+void MIPS_access(const MIPS_Instr* instr, MIPS_Access* acc) {
+  acc->n_defs = 0;
+  acc->n_uses = 0;
+  switch (instr->op) {
+    case OP_ADD: case OP_SUB: case OP_ADDU: case OP_SUBU: case OP_MUL_R6: case OP_DIV_R6: case OP_MOD_R6:
+    case OP_ADDV_W: case OP_SUBV_W: case OP_MULV_W:
+      add_def(acc, instr->rd);
+      add_use(acc, instr->rs);
+      add_use(acc, instr->rt);
+      break;
+    case OP_MUL: // clobbering HI/LO
+      add_def(acc, instr->rd);
+      add_def(acc, RES_HI);
+      add_def(acc, RES_LO);
+      add_use(acc, instr->rs);
+      add_use(acc, instr->rt);
+      break;
+    case OP_ADDI: case OP_ADDIU: case OP_ORI: case OP_ANDI: case OP_SLL: case OP_SRL: case OP_SRA: case OP_MOVE:
+    case OP_SLLI_W: case OP_FILL_W: case OP_COPY_S_W:
+      add_def(acc, instr->rd);
+      add_use(acc, instr->rs);
+      break;
+    case OP_INSERT_W: // the other words stay
+      add_def(acc, instr->rd);
+      add_use(acc, instr->rd);
+      add_use(acc, instr->rs);
+      break;
+    case OP_LI: case OP_LUI: case OP_LDI_W:
+      add_def(acc, instr->rd);
+      break;
+    case OP_MULT: case OP_DIV:
+      add_def(acc, RES_HI);
+      add_def(acc, RES_LO);
+      add_use(acc, instr->rs);
+      add_use(acc, instr->rt);
+      break;
+    case OP_MFLO:
+      add_def(acc, instr->rd);
+      add_use(acc, RES_LO);
+      break;
+    case OP_MFHI:
+      add_def(acc, instr->rd);
+      add_use(acc, RES_HI);
+      break;
+    case OP_BLTZ:
+      add_use(acc, instr->rs);
+      break;
+    case OP_BNE:
+      add_use(acc, instr->rs);
+      add_use(acc, instr->rt);
+      break;
+  }
+}
+
+bool acc_has(const int* regs, const int n, const int reg) {
+  for (int i = 0; i < n; ++i) {
+    if (regs[i] == reg)
+      return true;
+  }
+  return false;
+}
+
+// cycles until the result of instr can be used
+int result_latency(const MIPS_Instr* instr, const MIPS_Tune* tune) {
+  if (instr->op == OP_MULT || instr->op == OP_MUL || instr->op == OP_MUL_R6 || instr->op == OP_MULV_W)
+    return tune->mult;
+  if (instr->op == OP_DIV || instr->op == OP_DIV_R6 || instr->op == OP_MOD_R6)
+    return tune->div;
+  return tune->alu;
+}
+
+// minimum distance in cycles from a to b (a first), -1 if they are independent
+int dep_latency(const MIPS_Instr* a, const MIPS_Access* acc_a, const MIPS_Access* acc_b, const MIPS_Tune* tune) {
+  for (int i = 0; i < acc_a->n_defs; ++i) {
+    if (acc_has(acc_b->uses, acc_b->n_uses, acc_a->defs[i]))
+      return result_latency(a, tune); // read after write
+  }
+  for (int i = 0; i < acc_b->n_defs; ++i) {
+    if (acc_has(acc_a->uses, acc_a->n_uses, acc_b->defs[i]) || acc_has(acc_a->defs, acc_a->n_defs, acc_b->defs[i]))
+      return 1; // write after read / write
+  }
+  return -1;
+}
+
+bool is_hilo_read(const int op) {
+  return op == OP_MFHI || op == OP_MFLO;
+}
+
+bool is_hilo_write(const int op) {
+  return op == OP_MULT || op == OP_DIV || op == OP_MUL;
+}
+
+// labels and branches end a scheduling window and never move
+bool is_sched_barrier(const int op) {
+  return op == OP_LABEL || op == OP_BLTZ || op == OP_BNE || op == OP_J;
+}
+
+// ---------------------------------------------------------------------------
+// list scheduling (--sched)
+//
+// The code is cut into windows of up to SCHED_WINDOW instructions that do not cross a label or a
+// branch, so instructions of neighbouring statements can fill the shadow of a mult/div. Within a
+// window the ready instruction with the longest latency path to the end goes first, ties keep the
+// original order. Comments keep their place in the output, instructions may move past them.
+
+#define SCHED_WINDOW 64
+
+typedef struct Sched_State {
+  const MIPS_Tune* tune;
+  int since_hilo_read; // instructions emitted since the last mfhi/mflo
+} Sched_State;
+
+void sched_emit(MIPS_Code* out, Sched_State* state, const MIPS_Instr* instr) {
+  MIPS_emit(out, instr->op, instr->rd, instr->rs, instr->rt, instr->imm, instr->label);
+  if (is_hilo_read(instr->op))
+    state->since_hilo_read = 0;
+  else if (instr->op != OP_COMMENT && instr->op != OP_LABEL && state->since_hilo_read < INT_MAX)
+    state->since_hilo_read++;
+}
+
+// scheduling the m instructions of window (no comments) into order, -1 entries being nops in front
+// of the next instruction, returns its length
+int schedule_window(const MIPS_Instr* window[], const int m, Sched_State* state, int* order) {
+  int lat[SCHED_WINDOW][SCHED_WINDOW];
+  MIPS_Access acc[SCHED_WINDOW];
+  int height[SCHED_WINDOW];
+  int n_preds[SCHED_WINDOW];
+  int earliest[SCHED_WINDOW];
+  bool done[SCHED_WINDOW];
+
+  // dependency DAG
+  for (int i = 0; i < m; ++i) {
+    MIPS_access(window[i], &(acc[i]));
+    n_preds[i] = 0;
+    earliest[i] = 0;
+    done[i] = false;
+  }
+  for (int i = 0; i < m; ++i) {
+    for (int j = i + 1; j < m; ++j) {
+      lat[i][j] = dep_latency(window[i], &(acc[i]), &(acc[j]), state->tune);
+      if (lat[i][j] >= 0)
+        n_preds[j]++;
+    }
+  }
+  for (int i = m - 1; i >= 0; --i) {
+    height[i] = result_latency(window[i], state->tune);
+    for (int j = i + 1; j < m; ++j) {
+      if (lat[i][j] >= 0 && lat[i][j] + height[j] > height[i])
+        height[i] = lat[i][j] + height[j];
+    }
+  }
+
+  // issuing one instruction per cycle
+  int n_order = 0;
+  int n_done = 0;
+  int cycle = 0;
+  while (n_done < m) {
+    int best = -1;
+    int next_cycle = INT_MAX; // earliest cycle something waiting on a latency becomes ready
+    bool blocked = false;     // something is only held back by the HI/LO hazard
+    for (int i = 0; i < m; ++i) {
+      if (done[i] || n_preds[i] > 0)
+        continue;
+      if (earliest[i] > cycle) {
+        if (earliest[i] < next_cycle)
+          next_cycle = earliest[i];
+        continue;
+      }
+      if (is_hilo_write(window[i]->op) && state->since_hilo_read < state->tune->hilo_hazard) {
+        blocked = true;
+        continue;
+      }
+      if (best < 0 || height[i] > height[best])
+        best = i;
+    }
+
+    if (best < 0) {
+      if (next_cycle != INT_MAX) { // stalling, the hardware waits anyway
+        cycle = next_cycle;
+        continue;
+      }
+      if (blocked) { // nothing else to put between mfhi/mflo and mult/div
+        order[n_order++] = -1;
+        state->since_hilo_read++;
+        cycle++;
+      }
+      continue;
+    }
+
+    order[n_order++] = best;
+    done[best] = true;
+    n_done++;
+    if (is_hilo_read(window[best]->op))
+      state->since_hilo_read = 0;
+    else if (state->since_hilo_read < INT_MAX)
+      state->since_hilo_read++;
+    for (int j = best + 1; j < m; ++j) {
+      if (lat[best][j] < 0)
+        continue;
+      n_preds[j]--;
+      if (cycle + lat[best][j] > earliest[j])
+        earliest[j] = cycle + lat[best][j];
+    }
+    cycle++;
+  }
+  return n_order;
+}
+
+// scheduling the whole program in place
+void schedule_MIPS(MIPS_Code* code, const MIPS_Tune* tune) {
+  MIPS_Code out;
+  init_MIPS_code(&out);
+  out.march = code->march;
+  out.tune = code->tune;
+  Sched_State state = {tune, INT_MAX};
+  const MIPS_Instr nop = {OP_NOP, 0, 0, 0, 0, 0};
+
+  const MIPS_Instr* window[SCHED_WINDOW];
+  int order[4 * SCHED_WINDOW];
+  int i = 0;
+  while (i < code->n) {
+    if (is_sched_barrier(code->instrs[i].op)) {
+      sched_emit(&out, &state, &(code->instrs[i]));
+      i++;
+      continue;
+    }
+
+    // window up to the next barrier
+    int start = i;
+    int m = 0;
+    for (; i < code->n && !is_sched_barrier(code->instrs[i].op) && m < SCHED_WINDOW; ++i) {
+      if (code->instrs[i].op != OP_COMMENT)
+        window[m++] = &(code->instrs[i]);
+    }
+    Sched_State before = state;
+    schedule_window(window, m, &state, order);
+    state = before; // recounted while emitting
+
+    // comments stay where they were, the other slots take the scheduled instructions in order
+    int next = 0;
+    for (int j = start; j < i; ++j) {
+      if (code->instrs[j].op == OP_COMMENT) {
+        sched_emit(&out, &state, &(code->instrs[j]));
+        continue;
+      }
+      while (order[next] < 0) {
+        sched_emit(&out, &state, &nop);
+        next++;
+      }
+      sched_emit(&out, &state, window[order[next++]]);
+    }
+  }
+
+  free_MIPS_code(code);
+  *code = out;
+}
@@ -0,0 +1,306 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// statistics (--stats)
+//
+// Per phase wall time (added up over the threads of --pipeline), statements processed and allocations, instructions emitted per C operator,
+// time and changes of every optimization pass and the peak memory of the process. Collecting them is a handful of additions, so it is always on and
+// only printing is optional. Everything but the peak resident memory is per context; that one comes from the OS for the whole process, so in a
+// library it covers every context and whatever else the process does (the counted peak bytes are the per context figure).
+//
+// Heap memory is accounted per subsystem (Mem_Pool): every counted block carries its size and pool in
+// a small header, so freeing it (counted_free) takes the bytes off again and live and peak bytes are
+// known at any time, for --stats and --mem-limit.
+
+typedef enum Phase {
+  PHASE_READ,     // mapping and splitting the input
+  PHASE_PARSE,    // lexing, register table and tree building
+  PHASE_OPTIMIZE, // IR building and passes (-O1 and up)
+  PHASE_CODEGEN,  // MIPS instructions
+  PHASE_OUTPUT,   // formatting / encoding and writing
+  N_PHASES
+} Phase;
+
+const char* phase_names[N_PHASES] = {"read", "parse", "optimize", "codegen", "output"};
+
+// operators of the C code, "=" being a plain li
+#define N_STAT_OPS 6
+const char stat_ops[N_STAT_OPS] = {'=', '+', '-', '*', '/', '%'};
+
+// one run of an optimization pass
+typedef struct Pass_Stats {
+  const char* name;
+  double time;
+  long changes;
+} Pass_Stats;
+
+#define MAX_PASS_RUNS 32
+
+// what heap memory is for
+typedef enum Mem_Pool {
+  MEM_INPUT, // the source (when read rather than mapped) and its statements
+  MEM_TREE,  // equations and the IR
+  MEM_CODE,  // MIPS instructions, machine code and the code generators' tables
+  MEM_CACHE, // --incremental state and the pipeline's batches
+  N_MEM_POOLS
+} Mem_Pool;
+
+const char* mem_pool_names[N_MEM_POOLS] = {"input", "tree", "code", "cache"};
+
+// live and peak bytes of the counted blocks, shared by the threads of --pipeline
+typedef struct Mem_Stats {
+  atomic_long live[N_MEM_POOLS + 1]; // the last one is the total
+  atomic_long peak[N_MEM_POOLS + 1];
+  size_t limit;    // --mem-limit, 0 for none
+  size_t estimate; // bytes the compile was expected to need, 0 if not estimated
+  bool streamed;   // compiled through the pipeline to stay under limit
+} Mem_Stats;
+
+typedef struct Stats {
+  Phase phase; // current phase
+  double time[N_PHASES];
+  long statements[N_PHASES];
+  long allocs[N_PHASES];
+  long alloc_bytes[N_PHASES];
+  long op_count[N_STAT_OPS];  // operations per operator
+  long op_instrs[N_STAT_OPS]; // instructions emitted for them
+  Pass_Stats passes[MAX_PASS_RUNS]; // in the order they ran
+  int n_passes;
+  Mem_Stats mem;
+  Mem_Stats* mem_into; // counting memory there instead of into mem (pipeline stages), NULL if not
+  struct timespec start;
+} Stats;
+
+// statistics of the compile running on this thread (its context's, see hw6.h), the counters below
+// write to them
+_Thread_local Stats* stats = NULL;
+
+// making s the statistics of this thread, returns the ones before
+Stats* use_stats(Stats* s) {
+  Stats* before = stats;
+  stats = s;
+  return before;
+}
+
+// index of an operator in stat_ops, 0 ("=") if unknown
+int stat_op(const char op) {
+  for (int i = 1; i < N_STAT_OPS; ++i) {
+    if (stat_ops[i] == op)
+      return i;
+  }
+  return 0;
+}
+
+// counting the instructions an operator produced
+void stats_op(const char op, const int n_instrs) {
+  int i = stat_op(op);
+  stats->op_count[i]++;
+  stats->op_instrs[i] += n_instrs;
+}
+
+// instructions only, for operators counted before (the IR compiles an operator in several pieces)
+void stats_op_instrs(const char op, const int n_instrs) {
+  stats->op_instrs[stat_op(op)] += n_instrs;
+}
+
+// recording a pass that ran for the given time
+void stats_pass(const char* name, const double time, const long changes) {
+  if (stats->n_passes == MAX_PASS_RUNS)
+    return;
+  Pass_Stats* pass = &(stats->passes[stats->n_passes++]);
+  pass->name = name;
+  pass->time = time;
+  pass->changes = changes;
+}
+
+double seconds_since(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+void stats_begin(const Phase phase) {
+  stats->phase = phase;
+  clock_gettime(CLOCK_MONOTONIC, &(stats->start));
+}
+
+// ending the current phase, which processed n statements
+void stats_end(const long n) {
+  stats->time[stats->phase] += seconds_since(&(stats->start));
+  stats->statements[stats->phase] += n;
+}
+
+// where the memory of s is counted
+Mem_Stats* mem_stats(Stats* s) {
+  return (s->mem_into != NULL) ? s->mem_into : &(s->mem);
+}
+
+// adding the statistics of another thread (a pipeline stage) to into, memory is shared through mem_into
+// already
+void merge_stats(Stats* into, const Stats* from) {
+  for (int i = 0; i < N_PHASES; ++i) {
+    into->time[i] += from->time[i];
+    into->statements[i] += from->statements[i];
+    into->allocs[i] += from->allocs[i];
+    into->alloc_bytes[i] += from->alloc_bytes[i];
+  }
+  for (int i = 0; i < N_STAT_OPS; ++i) {
+    into->op_count[i] += from->op_count[i];
+    into->op_instrs[i] += from->op_instrs[i];
+  }
+  for (int i = 0; i < from->n_passes && into->n_passes < MAX_PASS_RUNS; ++i)
+    into->passes[into->n_passes++] = from->passes[i];
+}
+
+// ---------------------------------------------------------------------------
+// counted allocation
+//
+// Blocks from counted_malloc / counted_calloc / counted_realloc have to go back through counted_free.
+
+// in front of every counted block, keeping the block aligned like malloc's
+typedef struct Mem_Header {
+  _Alignas(max_align_t) size_t size;
+  Mem_Pool pool;
+} Mem_Header;
+
+void raise_peak(atomic_long* peak, const long live) {
+  long before = atomic_load_explicit(peak, memory_order_relaxed);
+  while (live > before && !atomic_compare_exchange_weak_explicit(peak, &before, live, memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+// adding delta bytes (negative when freeing) to a pool
+void count_mem(const Mem_Pool pool, const long delta) {
+  Mem_Stats* mem = mem_stats(stats);
+  long live = atomic_fetch_add_explicit(&(mem->live[pool]), delta, memory_order_relaxed) + delta;
+  long total = atomic_fetch_add_explicit(&(mem->live[N_MEM_POOLS]), delta, memory_order_relaxed) + delta;
+  if (delta > 0) {
+    raise_peak(&(mem->peak[pool]), live);
+    raise_peak(&(mem->peak[N_MEM_POOLS]), total);
+  }
+}
+
+// header to block, NULL stays NULL
+void* mem_block(Mem_Header* header, const Mem_Pool pool, const size_t size) {
+  if (header == NULL)
+    return NULL;
+  header->size = size;
+  header->pool = pool;
+  count_mem(pool, (long) size);
+  return header + 1;
+}
+
+void* counted_malloc(const Mem_Pool pool, const size_t size) {
+  stats->allocs[stats->phase]++;
+  stats->alloc_bytes[stats->phase] += size;
+  return mem_block((Mem_Header*) malloc(sizeof(Mem_Header) + size), pool, size);
+}
+
+void* counted_calloc(const Mem_Pool pool, const size_t n, const size_t size) {
+  stats->allocs[stats->phase]++;
+  stats->alloc_bytes[stats->phase] += n * size;
+  return mem_block((Mem_Header*) calloc(1, sizeof(Mem_Header) + n * size), pool, n * size);
+}
+
+// moving ptr into pool as well, NULL for a new block
+void* counted_realloc(const Mem_Pool pool, void* ptr, const size_t size) {
+  stats->allocs[stats->phase]++;
+  stats->alloc_bytes[stats->phase] += size;
+  Mem_Header* header = NULL;
+  if (ptr != NULL) {
+    header = (Mem_Header*) ptr - 1;
+    count_mem(header->pool, -(long) header->size);
+  }
+  Mem_Header* moved = (Mem_Header*) realloc(header, sizeof(Mem_Header) + size);
+  if (moved == NULL && header != NULL) { // the old block is still there
+    count_mem(header->pool, (long) header->size);
+    return NULL;
+  }
+  return mem_block(moved, pool, size);
+}
+
+void counted_free(void* ptr) {
+  if (ptr == NULL)
+    return;
+  Mem_Header* header = (Mem_Header*) ptr - 1;
+  count_mem(header->pool, -(long) header->size);
+  free(header);
+}
+
+// ---------------------------------------------------------------------------
+// printing
+
+// peak resident memory of the whole process in KB, -1 if unknown
+long process_peak_rss_kb() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+  return -1;
+}
+
+void print_stats(FILE* out, const Stats* stats, const bool json) {
+  const Mem_Stats* mem = &(stats->mem);
+  if (json) {
+    fprintf(out, "{\n  \"phases\": {\n");
+    for (int i = 0; i < N_PHASES; ++i) {
+      fprintf(out, "    \"%s\": {\"seconds\": %.9f, \"statements\": %ld, \"allocations\": %ld, \"allocated_bytes\": %ld}%s\n",
+              phase_names[i], stats->time[i], stats->statements[i], stats->allocs[i], stats->alloc_bytes[i], (i < N_PHASES - 1) ? "," : "");
+    }
+    fprintf(out, "  },\n  \"operators\": {\n");
+    for (int i = 0; i < N_STAT_OPS; ++i) {
+      fprintf(out, "    \"%c\": {\"count\": %ld, \"instructions\": %ld}%s\n",
+              stat_ops[i], stats->op_count[i], stats->op_instrs[i], (i < N_STAT_OPS - 1) ? "," : "");
+    }
+    fprintf(out, "  },\n  \"passes\": [\n");
+    for (int i = 0; i < stats->n_passes; ++i) {
+      fprintf(out, "    {\"name\": \"%s\", \"seconds\": %.9f, \"changes\": %ld}%s\n",
+              stats->passes[i].name, stats->passes[i].time, stats->passes[i].changes, (i < stats->n_passes - 1) ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"memory\": {\n");
+    for (int i = 0; i <= N_MEM_POOLS; ++i) {
+      fprintf(out, "    \"%s\": {\"live_bytes\": %ld, \"peak_bytes\": %ld},\n",
+              (i < N_MEM_POOLS) ? mem_pool_names[i] : "total", atomic_load(&(mem->live[i])), atomic_load(&(mem->peak[i])));
+    }
+    fprintf(out, "    \"limit_bytes\": %zu, \"estimated_bytes\": %zu, \"streamed\": %s\n  },\n",
+            mem->limit, mem->estimate, mem->streamed ? "true" : "false");
+    fprintf(out, "  \"process_peak_rss_kb\": %ld\n}\n", process_peak_rss_kb());
+    return;
+  }
+
+  fprintf(out, "phase       seconds  statements  allocations       bytes\n");
+  for (int i = 0; i < N_PHASES; ++i) {
+    fprintf(out, "%-8s %10.6f %11ld %12ld %11ld\n",
+            phase_names[i], stats->time[i], stats->statements[i], stats->allocs[i], stats->alloc_bytes[i]);
+  }
+  fprintf(out, "\noperator    count  instructions\n");
+  for (int i = 0; i < N_STAT_OPS; ++i)
+    fprintf(out, "%c        %8ld %13ld\n", stat_ops[i], stats->op_count[i], stats->op_instrs[i]);
+  if (stats->n_passes > 0) {
+    fprintf(out, "\npass          seconds   changes\n");
+    for (int i = 0; i < stats->n_passes; ++i)
+      fprintf(out, "%-9s %11.6f %9ld\n", stats->passes[i].name, stats->passes[i].time, stats->passes[i].changes);
+  }
+  fprintf(out, "\nmemory        live bytes   peak bytes\n");
+  for (int i = 0; i <= N_MEM_POOLS; ++i) {
+    fprintf(out, "%-8s %15ld %12ld\n",
+            (i < N_MEM_POOLS) ? mem_pool_names[i] : "total", atomic_load(&(mem->live[i])), atomic_load(&(mem->peak[i])));
+  }
+  if (mem->limit > 0)
+    fprintf(out, "limit: %zu bytes, estimated %zu%s\n", mem->limit, mem->estimate, mem->streamed ? ", streamed" : "");
+  fprintf(out, "\npeak memory of the process: %ld KB\n", process_peak_rss_kb());
+}
@@ -0,0 +1,863 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// superoptimizer (-Osuper)
+//
+// Every window of up to SUPER_WINDOW straight-line ALU instructions is compared against all sequences
+// of up to SUPER_MAX_LEN instructions that assemble into fewer words, built from the opcodes every ISA
+// revision has, the registers of the window and immediates derived from its own. A candidate has to
+// leave the same values as the window in every register read after it (see dead_from) on SUPER_TESTS
+// boundary and random inputs, and is then proved equal bit by bit with a BDD over the bits of the
+// registers the window reads (see super_prove). add/sub/addi trap and mult/div go through HI/LO, so
+// windows never contain them.
+//
+// Windows are keyed with their registers renumbered (the ones read before written first, in order of
+// first read) together with the mask of those live after them. The outcome of every search, rewrite
+// or not, goes into the database (--superopt-db), so later compilations only look it up.
+
+#define SUPER_WINDOW 4  // instructions in a window
+#define SUPER_MAX_LEN 2 // instructions in a candidate
+#define SUPER_INPUTS 4  // registers a window may read before writing them
+#define SUPER_REGS (1 + SUPER_INPUTS + SUPER_WINDOW) // $zero, inputs, the rest written
+#define SUPER_TESTS 32
+#define SUPER_IMMS 32            // immediates of each kind tried
+#define SUPER_BUDGET (1L << 22)  // candidates tested per window
+#define SUPER_BDD_NODES (1 << 18)
+#define SUPER_BDD_CACHE (1 << 16)
+#define SUPER_KEY_SIZE (2 + 5 * SUPER_WINDOW)
+#define SUPER_DB_MAGIC "hw6-superopt 1"
+#define SUPER_DEFAULT_DB "hw6.superopt" // of the command line, in the working directory
+
+// instructions a window may hold
+bool super_op(const MIPS_Instr* instr) {
+  switch (instr->op) {
+    case OP_SLL: case OP_SRL: case OP_SRA:
+      return instr->imm >= 0 && instr->imm < 32;
+    case OP_ADDU: case OP_SUBU: case OP_ADDIU: case OP_ANDI: case OP_ORI: case OP_LUI: case OP_LI: case OP_MOVE: case OP_MUL: case OP_MUL_R6:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// registers read: rs and rt, rs or none
+int super_n_uses(const int op) {
+  switch (op) {
+    case OP_ADDU: case OP_SUBU: case OP_MUL: case OP_MUL_R6:
+      return 2;
+    case OP_LI: case OP_LUI:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+bool super_has_imm(const int op) {
+  return super_n_uses(op) < 2 && op != OP_MOVE;
+}
+
+uint32_t super_value(const MIPS_Instr* instr, const uint32_t a, const uint32_t b) {
+  switch (instr->op) {
+    case OP_ADDU:  return a + b;
+    case OP_SUBU:  return a - b;
+    case OP_ADDIU: return a + (uint32_t) instr->imm;
+    case OP_SLL:   return a << instr->imm;
+    case OP_SRL:   return a >> instr->imm;
+    case OP_SRA:   return (uint32_t) ((int32_t) a >> instr->imm);
+    case OP_ANDI:  return a & (uint32_t) (instr->imm & 0xffff);
+    case OP_ORI:   return a | (uint32_t) (instr->imm & 0xffff);
+    case OP_LUI:   return (uint32_t) instr->imm << 16;
+    case OP_LI:    return (uint32_t) instr->imm;
+    case OP_MOVE:  return a;
+    default:       return a * b; // mul
+  }
+}
+
+// ---------------------------------------------------------------------------
+// windows
+
+typedef struct Super_Window {
+  int n;
+  MIPS_Instr instrs[SUPER_WINDOW]; // with canonical registers
+  int n_regs;                      // canonical registers, 0 is $zero
+  int n_inputs;                    // 1 to n_inputs are read before they are written
+  int regs[SUPER_REGS];            // register behind each canonical one
+  unsigned written;                // canonical registers the window writes
+  unsigned live;                   // and of those, the ones read after it
+  int cost;                        // words it assembles into
+} Super_Window;
+
+// canonical number of reg, -1 if there is none
+int super_find_reg(const Super_Window* w, const int reg) {
+  for (int k = 0; k < w->n_regs; ++k) {
+    if (w->regs[k] == reg)
+      return k;
+  }
+  return -1;
+}
+
+// canonical number of reg, numbering it if new; -1 if there are too many
+int super_add_reg(Super_Window* w, const int reg) {
+  int k = super_find_reg(w, reg);
+  if (k >= 0 || w->n_regs == SUPER_REGS)
+    return k;
+  w->regs[w->n_regs] = reg;
+  return w->n_regs++;
+}
+
+// the n instructions of code at i as a window, false if they do not make one
+bool make_super_window(MIPS_Code* code, const int* label_pos, const int i, const int n, Super_Window* w) {
+  memset(w, 0, sizeof(Super_Window));
+  w->n = n;
+  w->n_regs = 1;
+  w->regs[0] = REG_ZERO;
+
+  // inputs first, in order of first read
+  for (int j = 0; j < n; ++j) {
+    const MIPS_Instr* instr = &(code->instrs[i + j]);
+    int uses[2] = {instr->rs, instr->rt};
+    for (int u = 0; u < super_n_uses(instr->op); ++u) {
+      if (super_find_reg(w, uses[u]) >= 0)
+        continue;
+      bool written = false;
+      for (int k = 0; k < j && !written; ++k)
+        written = (code->instrs[i + k].rd == uses[u]);
+      if (!written && super_add_reg(w, uses[u]) < 0)
+        return false;
+    }
+  }
+  w->n_inputs = w->n_regs - 1;
+  if (w->n_inputs > SUPER_INPUTS)
+    return false;
+
+  for (int j = 0; j < n; ++j) {
+    const MIPS_Instr* instr = &(code->instrs[i + j]);
+    int rd = super_add_reg(w, instr->rd);
+    if (rd <= 0) // out of numbers, or writing $zero
+      return false;
+    w->written |= 1u << rd;
+    MIPS_Instr canonical = {instr->op, rd, 0, 0, super_has_imm(instr->op) ? instr->imm : 0, 0};
+    if (super_n_uses(instr->op) >= 1)
+      canonical.rs = super_find_reg(w, instr->rs);
+    if (super_n_uses(instr->op) == 2)
+      canonical.rt = super_find_reg(w, instr->rt);
+    w->instrs[j] = canonical;
+    w->cost += MIPS_instr_size(instr, false);
+  }
+
+  // registers still read afterwards
+  for (int k = 1; k < w->n_regs; ++k) {
+    int budget = DELAY_LOOKAHEAD;
+    if ((w->written & (1u << k)) && !dead_from(code, label_pos, i + n, w->regs[k], &budget))
+      w->live |= 1u << k;
+  }
+  return true;
+}
+
+void super_key(const Super_Window* w, int* key) {
+  memset(key, 0, SUPER_KEY_SIZE * sizeof(int));
+  key[0] = w->n;
+  key[1] = (int) w->live;
+  for (int j = 0; j < w->n; ++j) {
+    const MIPS_Instr* instr = &(w->instrs[j]);
+    int* field = key + 2 + 5 * j;
+    field[0] = instr->op;
+    field[1] = instr->rd;
+    field[2] = instr->rs;
+    field[3] = instr->rt;
+    field[4] = instr->imm;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// proofs, with reduced ordered BDDs over the bits of the inputs (bit 0 of every input first)
+
+typedef struct Super_BDD {
+  int var[SUPER_BDD_NODES]; // variable of every node, INT_MAX for the constants 0 and 1
+  int lo[SUPER_BDD_NODES];
+  int hi[SUPER_BDD_NODES];
+  int n;
+  int table[2 * SUPER_BDD_NODES];  // unique table, open addressing, 0 for an empty slot
+  int cache[4 * SUPER_BDD_CACHE];  // ite(f, g, h) = r, f = 0 for an empty slot
+  bool full;                       // out of nodes, nothing can be proved
+} Super_BDD;
+
+void reset_super_BDD(Super_BDD* bdd) {
+  bdd->var[0] = bdd->var[1] = INT_MAX;
+  bdd->n = 2;
+  memset(bdd->table, 0, sizeof(bdd->table));
+  memset(bdd->cache, 0, sizeof(bdd->cache));
+  bdd->full = false;
+}
+
+unsigned super_hash3(const int a, const int b, const int c) {
+  return ((unsigned) a * 12582917u) ^ ((unsigned) b * 4256249u) ^ ((unsigned) c * 741457u);
+}
+
+int bdd_node(Super_BDD* bdd, const int v, const int lo, const int hi) {
+  if (lo == hi)
+    return lo;
+  const unsigned mask = 2 * SUPER_BDD_NODES - 1;
+  unsigned h = super_hash3(v, lo, hi) & mask;
+  for (; bdd->table[h] != 0; h = (h + 1) & mask) {
+    int node = bdd->table[h];
+    if (bdd->var[node] == v && bdd->lo[node] == lo && bdd->hi[node] == hi)
+      return node;
+  }
+  if (bdd->n == SUPER_BDD_NODES) {
+    bdd->full = true;
+    return 0;
+  }
+  int node = bdd->n++;
+  bdd->var[node] = v;
+  bdd->lo[node] = lo;
+  bdd->hi[node] = hi;
+  bdd->table[h] = node;
+  return node;
+}
+
+// if f then g else h
+int bdd_ite(Super_BDD* bdd, const int f, const int g, const int h) {
+  if (f == 1 || g == h)
+    return g;
+  if (f == 0)
+    return h;
+  if (g == 1 && h == 0)
+    return f;
+  if (bdd->full)
+    return 0;
+  int* cached = &(bdd->cache[4 * (super_hash3(f, g, h) & (SUPER_BDD_CACHE - 1))]);
+  if (cached[0] == f && cached[1] == g && cached[2] == h)
+    return cached[3];
+
+  int v = bdd->var[f];
+  if (bdd->var[g] < v)
+    v = bdd->var[g];
+  if (bdd->var[h] < v)
+    v = bdd->var[h];
+  int lo = bdd_ite(bdd, (bdd->var[f] == v) ? bdd->lo[f] : f, (bdd->var[g] == v) ? bdd->lo[g] : g, (bdd->var[h] == v) ? bdd->lo[h] : h);
+  int hi = bdd_ite(bdd, (bdd->var[f] == v) ? bdd->hi[f] : f, (bdd->var[g] == v) ? bdd->hi[g] : g, (bdd->var[h] == v) ? bdd->hi[h] : h);
+  int r = bdd_node(bdd, v, lo, hi);
+  cached[0] = f;
+  cached[1] = g;
+  cached[2] = h;
+  cached[3] = r;
+  return r;
+}
+
+int bdd_not(Super_BDD* bdd, const int f) {
+  return bdd_ite(bdd, f, 0, 1);
+}
+
+int bdd_xor(Super_BDD* bdd, const int f, const int g) {
+  return bdd_ite(bdd, f, bdd_not(bdd, g), g);
+}
+
+// sum = a + b + carry, the 32 bits of each
+void bdd_add(Super_BDD* bdd, const int* a, const int* b, int carry, int* sum) {
+  for (int i = 0; i < 32; ++i) {
+    int x = bdd_xor(bdd, a[i], b[i]);
+    int s = bdd_xor(bdd, x, carry);
+    carry = bdd_ite(bdd, x, carry, a[i]);
+    sum[i] = s; // sum may be a
+  }
+}
+
+void bdd_const(const uint32_t c, int* bits) {
+  for (int i = 0; i < 32; ++i)
+    bits[i] = (c >> i) & 1;
+}
+
+// regs[instr->rd] after instr, regs holding the 32 bits of every canonical register
+void bdd_instr(Super_BDD* bdd, const MIPS_Instr* instr, int regs[][32]) {
+  const int* a = regs[instr->rs];
+  const int* b = regs[instr->rt];
+  const int s = instr->imm;
+  int r[32];
+  int t[32];
+  switch (instr->op) {
+    case OP_ADDU:
+      bdd_add(bdd, a, b, 0, r);
+      break;
+    case OP_SUBU:
+      for (int i = 0; i < 32; ++i)
+        t[i] = bdd_not(bdd, b[i]);
+      bdd_add(bdd, a, t, 1, r);
+      break;
+    case OP_ADDIU:
+      bdd_const((uint32_t) instr->imm, t);
+      bdd_add(bdd, a, t, 0, r);
+      break;
+    case OP_MUL: case OP_MUL_R6: // adding up a shifted by every bit of b
+      bdd_const(0, r);
+      for (int i = 0; i < 32; ++i) {
+        if (b[i] == 0)
+          continue;
+        for (int j = 0; j < 32; ++j)
+          t[j] = (j < i) ? 0 : bdd_ite(bdd, b[i], a[j - i], 0);
+        bdd_add(bdd, r, t, 0, r);
+      }
+      break;
+    case OP_SLL: case OP_SRL: case OP_SRA:
+      for (int i = 0; i < 32; ++i) {
+        if (instr->op == OP_SLL)
+          r[i] = (i >= s) ? a[i - s] : 0;
+        else
+          r[i] = (i + s < 32) ? a[i + s] : (instr->op == OP_SRA) ? a[31] : 0;
+      }
+      break;
+    case OP_ANDI: case OP_ORI:
+      for (int i = 0; i < 32; ++i) {
+        bool set = (instr->imm & 0xffff) >> i & 1;
+        r[i] = (instr->op == OP_ANDI) ? (set ? a[i] : 0) : (set ? 1 : a[i]);
+      }
+      break;
+    case OP_LUI: case OP_LI:
+      bdd_const(super_value(instr, 0, 0), r);
+      break;
+    case OP_MOVE:
+      memcpy(r, a, sizeof(r));
+      break;
+  }
+  memcpy(regs[instr->rd], r, sizeof(r));
+}
+
+// the len instructions of cand leave the live registers of w as w does, for every input
+bool super_prove(Super_BDD* bdd, const Super_Window* w, const MIPS_Instr* cand, const int len) {
+  reset_super_BDD(bdd);
+  int before[SUPER_REGS][32];
+  int after[SUPER_REGS][32];
+  for (int k = 0; k < SUPER_REGS; ++k) {
+    for (int i = 0; i < 32; ++i)
+      before[k][i] = (k >= 1 && k <= w->n_inputs) ? bdd_node(bdd, i * w->n_inputs + k - 1, 0, 1) : 0;
+  }
+  memcpy(after, before, sizeof(before));
+  for (int j = 0; j < w->n; ++j)
+    bdd_instr(bdd, &(w->instrs[j]), before);
+  for (int j = 0; j < len; ++j)
+    bdd_instr(bdd, &(cand[j]), after);
+  if (bdd->full)
+    return false;
+  for (int k = 1; k < w->n_regs; ++k) {
+    if ((w->live & (1u << k)) && memcmp(before[k], after[k], sizeof(before[k])) != 0)
+      return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// search
+
+typedef struct Super_Search {
+  const Super_Window* w;
+  MIPS_Instr* instrs; // every instruction a candidate may use
+  unsigned* uses;     // the canonical registers each of them reads
+  int n_instrs;
+  uint32_t values[SUPER_REGS][SUPER_TESTS];   // of the candidate so far
+  uint32_t expected[SUPER_REGS][SUPER_TESTS]; // after the window
+  MIPS_Instr cand[SUPER_MAX_LEN];
+  int len;      // of the candidates tried
+  long budget;  // candidates left to test
+  Super_BDD* bdd;
+} Super_Search;
+
+const uint32_t super_boundary[] = {
+  0, 1, 0xffffffff, 2, 0x80000000, 0x7fffffff, 0x80000001, 0xfffffffe, 0x55555555, 0xaaaaaaaa, 0xffff, 0x10000,
+  0xffff8000, 0x7fff, 31, 32
+};
+
+#define N_SUPER_BOUNDARY ((int) (sizeof(super_boundary) / sizeof(super_boundary[0])))
+
+// adding v to the n values in set unless it is there already
+void super_add_value(int32_t* set, int* n, const int32_t v) {
+  for (int i = 0; i < *n; ++i) {
+    if (set[i] == v)
+      return;
+  }
+  if (*n < SUPER_IMMS)
+    set[(*n)++] = v;
+}
+
+void super_add_instr(Super_Search* s, const int op, const int rd, const int rs, const int rt, const int32_t imm) {
+  MIPS_Instr instr = {op, rd, rs, rt, imm, 0};
+  s->instrs[s->n_instrs] = instr;
+  s->uses[s->n_instrs++] = (1u << rs) | ((super_n_uses(op) == 2) ? 1u << rt : 0);
+}
+
+// every instruction over the registers of the window, with immediates near the window's own
+void super_instrs(Super_Search* s) {
+  const Super_Window* w = s->w;
+  int32_t consts[SUPER_IMMS];
+  int32_t shifts[SUPER_IMMS];
+  int n_consts = 0;
+  int n_shifts = 0;
+  super_add_value(shifts, &n_shifts, 1);
+  super_add_value(shifts, &n_shifts, 31);
+  super_add_value(consts, &n_consts, 0);
+  super_add_value(consts, &n_consts, 1);
+  super_add_value(consts, &n_consts, -1);
+  for (int j = 0; j < w->n; ++j) {
+    const MIPS_Instr* instr = &(w->instrs[j]);
+    if (instr->op == OP_SLL || instr->op == OP_SRL || instr->op == OP_SRA) {
+      for (int k = 0; k < j; ++k) {
+        int other = w->instrs[k].imm;
+        if (w->instrs[k].op == OP_SLL || w->instrs[k].op == OP_SRL || w->instrs[k].op == OP_SRA) {
+          if (instr->imm + other < 32)
+            super_add_value(shifts, &n_shifts, instr->imm + other);
+          if (instr->imm != other)
+            super_add_value(shifts, &n_shifts, abs(instr->imm - other));
+        }
+      }
+      if (instr->imm > 0) {
+        super_add_value(shifts, &n_shifts, instr->imm);
+        super_add_value(shifts, &n_shifts, 32 - instr->imm);
+      }
+    } else if (super_has_imm(instr->op)) {
+      uint32_t c = super_value(instr, 0, 0);
+      if (instr->op == OP_ADDIU)
+        c = (uint32_t) instr->imm;
+      int32_t derived[] = {(int32_t) c, (int32_t) -c, (int32_t) (c + 1), (int32_t) (c - 1), (int32_t) ~c};
+      for (int k = 0; k < 5; ++k)
+        super_add_value(consts, &n_consts, derived[k]);
+    }
+  }
+
+  int n_sources = w->n_regs; // candidates may read every register they have written
+  s->n_instrs = 0;
+  int max_instrs = n_sources * n_sources * 2 + n_sources * (3 * n_shifts + 3 * n_consts + 1) + n_consts;
+  s->instrs = (MIPS_Instr*) counted_malloc(MEM_CODE, w->n_regs * max_instrs * sizeof(MIPS_Instr));
+  s->uses = (unsigned*) counted_malloc(MEM_CODE, w->n_regs * max_instrs * sizeof(unsigned));
+  for (int rd = 1; rd < w->n_regs; ++rd) {
+    if (!(w->written & (1u << rd))) // inputs only read stay as they are
+      continue;
+    for (int rs = 1; rs < n_sources; ++rs) {
+      for (int rt = 0; rt < n_sources; ++rt) {
+        if (rt >= rs && rt != 0)
+          super_add_instr(s, OP_ADDU, rd, rs, rt, 0);
+        if (rt != rs)
+          super_add_instr(s, OP_SUBU, rd, rt, rs, 0);
+      }
+      super_add_instr(s, OP_MOVE, rd, rs, 0, 0);
+      for (int k = 0; k < n_shifts; ++k) {
+        super_add_instr(s, OP_SLL, rd, rs, 0, shifts[k]);
+        super_add_instr(s, OP_SRL, rd, rs, 0, shifts[k]);
+        super_add_instr(s, OP_SRA, rd, rs, 0, shifts[k]);
+      }
+      for (int k = 0; k < n_consts; ++k) {
+        if (consts[k] != 0 && fits_imm16(consts[k]))
+          super_add_instr(s, OP_ADDIU, rd, rs, 0, consts[k]);
+        if (consts[k] > 0 && consts[k] <= 65535) {
+          super_add_instr(s, OP_ANDI, rd, rs, 0, consts[k]);
+          super_add_instr(s, OP_ORI, rd, rs, 0, consts[k]);
+        }
+      }
+    }
+    for (int k = 0; k < n_consts; ++k)
+      super_add_instr(s, OP_LI, rd, 0, 0, consts[k]);
+  }
+}
+
+int super_cost(const MIPS_Instr* instr) {
+  return MIPS_instr_size(instr, false);
+}
+
+// trying every candidate from position depth on, true once one is proved
+bool super_enumerate(Super_Search* s, const int depth, const int cost, const unsigned defined, const unsigned written) {
+  const Super_Window* w = s->w;
+  int unwritten = __builtin_popcount(w->live & ~written);
+  for (int c = 0; c < s->n_instrs && s->budget > 0; ++c) {
+    const MIPS_Instr* instr = &(s->instrs[c]);
+    int rd = instr->rd;
+    int instr_cost = super_cost(instr);
+    if ((s->uses[c] & ~defined) != 0 || cost + instr_cost + (s->len - depth - 1) >= w->cost)
+      continue;
+    if (depth == s->len - 1 && !(w->live >> rd & 1)) // the last one has to write something read later
+      continue;
+    if (unwritten - (int) ((w->live & ~written) >> rd & 1) > s->len - depth - 1)
+      continue;
+    s->cand[depth] = *instr;
+    uint32_t* row = s->values[rd];
+    uint32_t saved[SUPER_TESTS];
+    memcpy(saved, row, sizeof(saved));
+
+    // last one: testing, reading the sources before row is overwritten
+    if (depth == s->len - 1) {
+      s->budget--;
+      bool same = true;
+      for (int t = 0; t < SUPER_TESTS && same; ++t) {
+        uint32_t v = super_value(instr, s->values[instr->rs][t], s->values[instr->rt][t]);
+        same = (v == s->expected[rd][t]);
+        row[t] = v;
+      }
+      for (int k = 1; k < w->n_regs && same; ++k) {
+        if (k != rd && (w->live >> k & 1))
+          same = memcmp(s->values[k], s->expected[k], sizeof(s->values[k])) == 0;
+      }
+      memcpy(row, saved, sizeof(saved));
+      if (same && super_prove(s->bdd, w, s->cand, s->len))
+        return true;
+      continue;
+    }
+
+    uint32_t next[SUPER_TESTS];
+    for (int t = 0; t < SUPER_TESTS; ++t)
+      next[t] = super_value(instr, s->values[instr->rs][t], s->values[instr->rt][t]);
+    memcpy(row, next, sizeof(next));
+    bool found = super_enumerate(s, depth + 1, cost + instr_cost, defined | (1u << rd), written | (1u << rd));
+    memcpy(row, saved, sizeof(saved));
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+// the test inputs of w (boundary values, then pseudo random ones) into values, 0 in the other registers
+void super_test_inputs(const Super_Window* w, uint32_t values[][SUPER_TESTS]) {
+  memset(values, 0, SUPER_REGS * sizeof(values[0]));
+  uint32_t seed = 0x9e3779b9u;
+  for (int k = 1; k <= w->n_inputs; ++k) {
+    for (int t = 0; t < SUPER_TESTS; ++t) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      values[k][t] = (t < N_SUPER_BOUNDARY) ? super_boundary[(t + 5 * k) % N_SUPER_BOUNDARY] : seed;
+    }
+  }
+}
+
+// running the n instructions on every test at once
+void super_run(const MIPS_Instr* instrs, const int n, uint32_t values[][SUPER_TESTS]) {
+  for (int j = 0; j < n; ++j) {
+    const MIPS_Instr* instr = &(instrs[j]);
+    for (int t = 0; t < SUPER_TESTS; ++t)
+      values[instr->rd][t] = super_value(instr, values[instr->rs][t], values[instr->rt][t]);
+  }
+}
+
+// shortest sequence doing what w does into repl, its length or -1 if there is none shorter
+int super_search(const Super_Window* w, Super_BDD* bdd, MIPS_Instr* repl) {
+  if (w->live == 0) // nothing read afterwards
+    return 0;
+  Super_Search s;
+  s.w = w;
+  s.bdd = bdd;
+  s.budget = SUPER_BUDGET;
+  super_test_inputs(w, s.values);
+  memcpy(s.expected, s.values, sizeof(s.values));
+  super_run(w->instrs, w->n, s.expected);
+
+  super_instrs(&s);
+  unsigned inputs = (1u << (w->n_inputs + 1)) - 1; // and $zero
+  int found = -1;
+  for (s.len = 1; s.len <= SUPER_MAX_LEN && s.len < w->cost && found < 0; ++s.len) {
+    if (super_enumerate(&s, 0, 0, inputs, 0)) {
+      memcpy(repl, s.cand, s.len * sizeof(MIPS_Instr));
+      found = s.len;
+    }
+  }
+  counted_free(s.instrs);
+  counted_free(s.uses);
+  return found;
+}
+
+// ---------------------------------------------------------------------------
+// database (--superopt-db)
+//
+// One search per line: the key (instructions in the window, live mask, then op rd rs rt imm for every
+// instruction), the length of the replacement (-1 for none) and op rd rs rt imm for each of its
+// instructions, all in canonical registers. A missing or foreign file is taken as empty, lines that
+// do not parse are dropped. A replacement read from the file is only used once it passes what a
+// search asks of a candidate (super_check_entry), otherwise the window is searched again and the
+// entry replaced.
+
+typedef struct Super_Entry {
+  int key[SUPER_KEY_SIZE];
+  int n_repl;                     // -1 if there is nothing shorter
+  MIPS_Instr repl[SUPER_MAX_LEN]; // canonical registers
+  bool checked;                   // searched here, or read from the file and checked against its window
+} Super_Entry;
+
+typedef struct Super_DB {
+  Super_Entry* entries;
+  int n;
+  int cap;
+  int* slots;    // open addressing, 1 + index into entries, 0 for an empty slot
+  int n_slots;   // power of 2
+  int n_loaded;  // read from the file, the rest are new
+  bool replaced; // an entry read from the file failed its check and was searched again
+} Super_DB;
+
+// entry (read from the file) can stand for w: nothing shorter, or a shorter replacement that writes
+// only what the window writes, reads only the inputs and what it wrote itself, and leaves the live
+// registers as the window does on the test inputs and in the proof
+bool super_check_entry(const Super_Window* w, const Super_Entry* entry, Super_BDD* bdd) {
+  if (entry->n_repl < 0)
+    return true;
+  if (entry->n_repl == 0)
+    return w->live == 0;
+  int cost = 0;
+  unsigned defined = (1u << (w->n_inputs + 1)) - 1; // and $zero
+  for (int j = 0; j < entry->n_repl; ++j) {
+    const MIPS_Instr* instr = &(entry->repl[j]);
+    int uses[2] = {instr->rs, instr->rt};
+    for (int u = 0; u < super_n_uses(instr->op); ++u) {
+      if (uses[u] >= w->n_regs || !(defined >> uses[u] & 1))
+        return false;
+    }
+    if (instr->rd >= w->n_regs || !(w->written >> instr->rd & 1))
+      return false;
+    defined |= 1u << instr->rd;
+    cost += super_cost(instr);
+  }
+  if (cost >= w->cost)
+    return false;
+
+  uint32_t expected[SUPER_REGS][SUPER_TESTS];
+  uint32_t values[SUPER_REGS][SUPER_TESTS];
+  super_test_inputs(w, expected);
+  memcpy(values, expected, sizeof(values));
+  super_run(w->instrs, w->n, expected);
+  super_run(entry->repl, entry->n_repl, values);
+  for (int k = 1; k < w->n_regs; ++k) {
+    if ((w->live >> k & 1) && memcmp(values[k], expected[k], sizeof(values[k])) != 0)
+      return false;
+  }
+  return super_prove(bdd, w, entry->repl, entry->n_repl);
+}
+
+unsigned super_key_hash(const int* key) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < SUPER_KEY_SIZE; ++i)
+    h = (h ^ (unsigned) key[i]) * 16777619u;
+  return h;
+}
+
+// slot of key, holding it or empty
+int* find_super_slot(Super_DB* db, const int* key) {
+  unsigned i = super_key_hash(key) & (db->n_slots - 1);
+  while (db->slots[i] != 0 && memcmp(db->entries[db->slots[i] - 1].key, key, sizeof(db->entries[0].key)) != 0)
+    i = (i + 1) & (db->n_slots - 1);
+  return &(db->slots[i]);
+}
+
+// adding entry unless its key is there already, the entry of the key either way
+Super_Entry* add_super_entry(Super_DB* db, const Super_Entry* entry) {
+  int* slot = find_super_slot(db, entry->key);
+  if (*slot != 0)
+    return &(db->entries[*slot - 1]);
+  if (db->n == db->cap) {
+    db->cap = (db->cap == 0) ? 256 : 2 * db->cap;
+    db->entries = (Super_Entry*) counted_realloc(MEM_CACHE, db->entries, db->cap * sizeof(Super_Entry));
+  }
+  db->entries[db->n++] = *entry;
+  *slot = db->n;
+  if (2 * db->n > db->n_slots) { // rehashing
+    counted_free(db->slots);
+    db->n_slots *= 2;
+    db->slots = (int*) counted_calloc(MEM_CACHE, db->n_slots, sizeof(int));
+    for (int i = 0; i < db->n; ++i)
+      *find_super_slot(db, db->entries[i].key) = i + 1;
+  }
+  return &(db->entries[db->n - 1]);
+}
+
+// n ints from the text at *p, false if there are not as many
+bool parse_super_ints(char** p, int* ints, const int n) {
+  for (int i = 0; i < n; ++i) {
+    char* end;
+    long v = strtol(*p, &end, 10);
+    if (end == *p || v < INT32_MIN || v > INT32_MAX)
+      return false;
+    ints[i] = (int) v;
+    *p = end;
+  }
+  return true;
+}
+
+// op rd rs rt imm into instr, false if it is none a window or candidate could hold
+bool parse_super_instr(char** p, MIPS_Instr* instr) {
+  int f[5];
+  if (!parse_super_ints(p, f, 5) || f[0] < 0 || f[0] >= N_OPS)
+    return false;
+  for (int i = 1; i <= 3; ++i) {
+    if (f[i] < 0 || f[i] >= SUPER_REGS)
+      return false;
+  }
+  MIPS_Instr parsed = {f[0], f[1], f[2], f[3], f[4], 0};
+  *instr = parsed;
+  return super_op(instr);
+}
+
+void load_super_db(const char* filename, Super_DB* db) {
+  db->entries = NULL;
+  db->n = 0;
+  db->cap = 0;
+  db->n_slots = 256;
+  db->slots = (int*) counted_calloc(MEM_CACHE, db->n_slots, sizeof(int));
+  db->n_loaded = 0;
+  db->replaced = false;
+  FILE* file = (filename != NULL) ? fopen(filename, "r") : NULL;
+  if (file == NULL)
+    return;
+  char* buf = NULL;
+  size_t cap = 0;
+  if (getline(&buf, &cap, file) >= 0 && strncmp(buf, SUPER_DB_MAGIC "\n", strlen(SUPER_DB_MAGIC) + 1) == 0) {
+    while (getline(&buf, &cap, file) >= 0) {
+      Super_Entry entry;
+      memset(&entry, 0, sizeof(entry));
+      char* p = buf;
+      bool ok = parse_super_ints(&p, entry.key, 2) && entry.key[0] >= 1 && entry.key[0] <= SUPER_WINDOW;
+      for (int j = 0; ok && j < entry.key[0]; ++j) {
+        MIPS_Instr instr;
+        ok = parse_super_instr(&p, &instr);
+        int* field = entry.key + 2 + 5 * j;
+        field[0] = instr.op;
+        field[1] = instr.rd;
+        field[2] = instr.rs;
+        field[3] = instr.rt;
+        field[4] = instr.imm;
+      }
+      ok = ok && parse_super_ints(&p, &(entry.n_repl), 1) && entry.n_repl >= -1 && entry.n_repl <= SUPER_MAX_LEN;
+      for (int j = 0; ok && j < entry.n_repl; ++j)
+        ok = parse_super_instr(&p, &(entry.repl[j]));
+      if (ok)
+        add_super_entry(db, &entry);
+    }
+  }
+  db->n_loaded = db->n;
+  fclose(file);
+  free(buf);
+  TRACE(TRACE_IO, "Debug: Loaded %d superoptimizer results from \"%s\"\n", db->n_loaded, filename);
+}
+
+// writing the whole database back if it changed, through a temporary file of its own (see
+// open_replacement) so that compilations sharing it never read half of it. Writers do not merge: of
+// compilations saving at the same time, the last rename wins and the new entries of the others are
+// lost, which only costs their searches again later. Being a cache, failing to write it only warns.
+void save_super_db(const char* filename, const Super_DB* db) {
+  if (filename == NULL || (db->n == db->n_loaded && !db->replaced))
+    return;
+  char* tmp_name;
+  FILE* file = open_replacement(filename, &tmp_name);
+  if (file == NULL) {
+    report_warning("Unable to write \"%s\", its new results are lost", filename);
+    return;
+  }
+  fprintf(file, "%s\n", SUPER_DB_MAGIC);
+  for (int i = 0; i < db->n; ++i) {
+    const Super_Entry* entry = &(db->entries[i]);
+    fprintf(file, "%d %d", entry->key[0], entry->key[1]);
+    for (int j = 2; j < 2 + 5 * entry->key[0]; ++j)
+      fprintf(file, " %d", entry->key[j]);
+    fprintf(file, " %d", entry->n_repl);
+    for (int j = 0; j < entry->n_repl; ++j) {
+      const MIPS_Instr* instr = &(entry->repl[j]);
+      fprintf(file, " %d %d %d %d %d", instr->op, instr->rd, instr->rs, instr->rt, instr->imm);
+    }
+    fprintf(file, "\n");
+  }
+  if (!replace_file(file, tmp_name, filename))
+    report_warning("Unable to write \"%s\", its new results are lost", filename);
+}
+
+void free_super_db(Super_DB* db) {
+  counted_free(db->entries);
+  counted_free(db->slots);
+}
+
+// ---------------------------------------------------------------------------
+// the pass
+
+// rewriting every window of code that has a shorter equivalent, looking searches up in (and adding
+// them to) db_file if it is not NULL; the number of windows rewritten
+int superoptimize_MIPS(MIPS_Code* code, const char* db_file) {
+  int n_labels = 0;
+  for (int i = 0; i < code->n; ++i) {
+    if ((code->instrs[i].op == OP_LABEL || is_branch(code->instrs[i].op)) && code->instrs[i].label >= n_labels)
+      n_labels = code->instrs[i].label + 1;
+  }
+  int* label_pos = (int*) counted_malloc(MEM_CODE, (n_labels + 1) * sizeof(int));
+  for (int i = 0; i < n_labels; ++i)
+    label_pos[i] = code->n; // unused
+  for (int i = 0; i < code->n; ++i) {
+    if (code->instrs[i].op == OP_LABEL)
+      label_pos[code->instrs[i].label] = i;
+  }
+
+  Super_DB db;
+  load_super_db(db_file, &db);
+  Super_BDD* bdd = NULL; // only once there is something to prove
+  MIPS_Code out;
+  init_MIPS_code(&out);
+  out.march = code->march;
+  out.tune = code->tune;
+  out.profile = code->profile;
+  int n_rewrites = 0;
+  int n_searches = 0;
+  for (int i = 0; i < code->n; ) {
+    int run = 0;
+    while (run < SUPER_WINDOW && i + run < code->n && super_op(&(code->instrs[i + run])))
+      run++;
+
+    // longest window first
+    const Super_Entry* entry = NULL;
+    Super_Window w;
+    for (int n = run; n >= 1 && entry == NULL; --n) {
+      if (!make_super_window(code, label_pos, i, n, &w) || (w.live != 0 && w.cost == 1)) // nothing to gain
+        continue;
+      Super_Entry found;
+      memset(&found, 0, sizeof(found));
+      super_key(&w, found.key);
+      int* slot = find_super_slot(&db, found.key);
+      Super_Entry* known = (*slot != 0) ? &(db.entries[*slot - 1]) : NULL;
+      if (bdd == NULL && (known == NULL || !known->checked))
+        bdd = (Super_BDD*) counted_malloc(MEM_CODE, sizeof(Super_BDD));
+      if (known != NULL && !known->checked) {
+        known->checked = true;
+        if (!super_check_entry(&w, known, bdd)) {
+          TRACE(TRACE_IO, "Debug: Superoptimizer result for a window of %d does not hold, searching again\n", w.n);
+          known->n_repl = super_search(&w, bdd, known->repl);
+          db.replaced = true;
+          n_searches++;
+        }
+      }
+      if (known != NULL)
+        entry = known;
+      else {
+        found.n_repl = super_search(&w, bdd, found.repl);
+        found.checked = true;
+        entry = add_super_entry(&db, &found);
+        n_searches++;
+      }
+      if (entry->n_repl < 0)
+        entry = NULL;
+    }
+    if (entry == NULL) {
+      MIPS_Instr* instr = &(code->instrs[i++]);
+      MIPS_emit(&out, instr->op, instr->rd, instr->rs, instr->rt, instr->imm, instr->label);
+      continue;
+    }
+
+    TRACE(TRACE_CODEGEN, "Debug: super: %d instructions at %d into %d\n", w.n, i, entry->n_repl);
+    for (int j = 0; j < entry->n_repl; ++j) {
+      const MIPS_Instr* instr = &(entry->repl[j]);
+      MIPS_emit(&out, instr->op, w.regs[instr->rd], w.regs[instr->rs], w.regs[instr->rt], instr->imm, 0);
+    }
+    i += w.n;
+    n_rewrites++;
+  }
+  TRACE(TRACE_CODEGEN, "Debug: super: %d windows rewritten, %d searched, %d looked up\n", n_rewrites, n_searches, db.n_loaded);
+
+  save_super_db(db_file, &db);
+  free_super_db(&db);
+  counted_free(bdd);
+  counted_free(label_pos);
+  free_MIPS_code(code);
+  *code = out;
+  return n_rewrites;
+}
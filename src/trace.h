@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// tracing
+//
+// TRACE(category, ...) prints like printf when that category is switched on (--trace=... or the
+// positional DEBUG/VERBOSE arguments). Tracing only exists in builds with -DHW6_TRACE, otherwise every
+// TRACE and TRACE_ON disappears at compile time and the hot paths carry no checks at all.
+
+#define TRACE_LEXER    0x01
+#define TRACE_TREE     0x02
+#define TRACE_REGALLOC 0x04
+#define TRACE_CODEGEN  0x08
+#define TRACE_IO       0x10 // files, incremental state, output
+#define TRACE_ALL      0x1f
+#define TRACE_VERBOSE  0x80 // combined with a category for the chattiest messages
+
+#ifdef HW6_TRACE
+unsigned trace_mask = 0;
+#define TRACE_ON(cat) ((trace_mask & (cat)) == (cat))
+#define TRACE(cat, ...) do { if (TRACE_ON(cat)) printf(__VA_ARGS__); } while (0)
+#else
+#define TRACE_ON(cat) false
+#define TRACE(cat, ...) ((void) 0)
+#endif
+
+// category mask from a list such as "lexer,tree" (or "all"), false if a name is unknown
+bool parse_trace_categories(const char* list, unsigned* mask) {
+  const char* names[] = {"lexer", "tree", "regalloc", "codegen", "io", "all", "verbose"};
+  const unsigned bits[] = {TRACE_LEXER, TRACE_TREE, TRACE_REGALLOC, TRACE_CODEGEN, TRACE_IO, TRACE_ALL, TRACE_VERBOSE};
+  *mask = 0;
+  while (*list != '\0') {
+    int len = 0;
+    while (list[len] != '\0' && list[len] != ',')
+      len++;
+    bool found = false;
+    for (int i = 0; i < 7 && !found; ++i) {
+      if ((int) strlen(names[i]) == len && strncmp(list, names[i], len) == 0) {
+        *mask |= bits[i];
+        found = true;
+      }
+    }
+    if (!found)
+      return false;
+    list += (list[len] == ',') ? len + 1 : len;
+  }
+  return true;
+}
@@ -0,0 +1,78 @@
+// ---------------------------------------------------------------------------
+// library API (hw6.h) check for quick_tester.sh
+//
+// Compiles the same programs on two threads with contexts of their own, then goes through the error
+// paths of one context. Everything printed is deterministic, so the output is compared against
+// tests/library.expected.
+//
+//   gcc -std=gnu11 -O2 tests/library.c -o build/library -lm -lpthread
+
+#define HW6_NO_MAIN
+#include "../src/hw6.c"
+
+#define OUT_SIZE (1 << 16)
+
+const char* program = "a = b * 255;\nc = a / 4 - b;\nd = c % 7;\n";
+
+typedef struct Job {
+  const char* option;
+  char out[OUT_SIZE];
+  size_t len;
+  int status;
+} Job;
+
+// compiling program 100 times in a context of its own, keeping the last output
+void* compile_job(void* arg) {
+  Job* job = (Job*) arg;
+  HW6_Context* ctx = hw6_alloc_context();
+  hw6_set_option(ctx, job->option);
+  for (int i = 0; i < 100; ++i)
+    job->status = hw6_compile(ctx, program, strlen(program), job->out, OUT_SIZE, &(job->len));
+  hw6_free_context(ctx);
+  return NULL;
+}
+
+long peak_bytes(const HW6_Context* ctx) {
+  return atomic_load(&(ctx->stats.mem.peak[N_MEM_POOLS]));
+}
+
+int main() {
+  // two threads at the same time
+  Job jobs[2] = {{.option = "-O2"}, {.option = "--march=mips32r6"}};
+  pthread_t threads[2];
+  for (int i = 0; i < 2; ++i)
+    pthread_create(&threads[i], NULL, compile_job, &jobs[i]);
+  for (int i = 0; i < 2; ++i) {
+    pthread_join(threads[i], NULL);
+    printf("%s: status %d\n%.*s\n", jobs[i].option, jobs[i].status, (int) jobs[i].len, jobs[i].out);
+  }
+
+  // errors, one context
+  HW6_Context* ctx = hw6_alloc_context();
+  char out[OUT_SIZE];
+  size_t len = 0;
+  printf("unknown option: status %d\n", hw6_set_option(ctx, "--fast"));
+  int status = hw6_compile(ctx, "a = b +;\n", 9, out, OUT_SIZE, &len);
+  printf("bad source: status %d, \"%s\"\n", status, hw6_error(ctx));
+  status = hw6_compile(ctx, program, strlen(program), out, 8, &len);
+  printf("small buffer: status %d, %zu bytes needed\n", status, len);
+  status = hw6_compile(ctx, program, strlen(program), out, OUT_SIZE, &len);
+  printf("after the errors: status %d, %zu bytes, \"%s\"\n", status, len, hw6_error(ctx));
+
+  // memory is counted per context: a large compile in another one leaves ctx's peak alone
+  long before = peak_bytes(ctx);
+  HW6_Context* other = hw6_alloc_context();
+  size_t size = 20000 * strlen(program);
+  char* large = (char*) malloc(size + 1);
+  char* big_out = (char*) malloc(64 * size);
+  for (int i = 0; i < 20000; ++i)
+    strcpy(large + i * strlen(program), program);
+  status = hw6_compile(other, large, size, big_out, 64 * size, &len);
+  printf("large compile: status %d, own peak above the small one's: %s, small one's peak unchanged: %s\n",
+         status, (peak_bytes(other) > before) ? "yes" : "no", (peak_bytes(ctx) == before) ? "yes" : "no");
+  free(large);
+  free(big_out);
+  hw6_free_context(other);
+  hw6_free_context(ctx);
+  return 0;
+}